@@ -21,7 +21,7 @@ const char *info_verbS =
                     "\"info\": \"Subscribe to gps data with condition\","
                     "\"verb\": \"subscribe\","
                     "\"usage\": {"
-                        "\"data\": \"gps_data\", \"condition\" : \"condition_type\", \"value\" : \"condition_value (see readme for available values)\""
+                        "\"data\": \"gps_data\", \"condition\" : \"condition_type\", \"value\" : \"condition_value (see readme for available values)\", \"projection\" : \"utm|enu|ecef, or an array of them (optional)\""
                     "},"
                     "\"sample\": ["
                         "{"
@@ -32,6 +32,21 @@ const char *info_verbS =
                         "},"
                         "{"
                             "\"data\" : \"gps_data\", \"condition\" : \"max_speed\", \"value\" : 20"
+                        "},"
+                        "{"
+                            "\"data\" : \"gps_data\", \"condition\" : \"adaptive\", \"value\" : 20, \"min_interval\" : 200, \"max_interval\" : 5000"
+                        "},"
+                        "{"
+                            "\"data\" : \"gps_data\", \"condition\" : \"expression\", \"value\" : \"speed_kmh > 50 and mode == 3 and epx < 10\", \"debounce\" : 1000"
+                        "},"
+                        "{"
+                            "\"data\" : \"gps_data\", \"condition\" : \"movement\", \"value\" : 10, \"projection\" : \"enu\""
+                        "},"
+                        "{"
+                            "\"data\" : \"gps_data\", \"condition\" : \"composite\", \"value\" : [{\"condition\" : \"frequency\", \"value\" : 10}, {\"condition\" : \"movement\", \"value\" : 100}, {\"condition\" : \"max_speed\", \"value\" : 90}]"
+                        "},"
+                        "{"
+                            "\"data\" : \"gpsd_raw\", \"condition\" : \"class\", \"value\" : \"TPV\""
                         "}"
                     "]"
                 "},"
@@ -51,9 +66,132 @@ const char *info_verbS =
                       "},"
                       "{"
                           "\"data\" : \"gps_data\", \"condition\" : \"max_speed\", \"value\" : 20"
+                      "},"
+                      "{"
+                          "\"data\" : \"gps_data\", \"condition\" : \"expression\", \"value\" : \"speed_kmh > 50 and mode == 3 and epx < 10\", \"debounce\" : 1000"
+                      "},"
+                      "{"
+                          "\"data\" : \"gpsd_raw\", \"condition\" : \"class\", \"value\" : \"TPV\""
+                      "}"
+                  "]"
+              "},"
+              "{"
+                  "\"uid\": \"ack\","
+                  "\"info\": \"acknowledge events of a flow controlled stream\","
+                  "\"verb\": \"ack\","
+                  "\"usage\": {"
+                      "\"stream\": \"stream id given by subscribe\", \"count\" : \"number of events acknowledged (default 1)\""
+                  "},"
+                  "\"sample\": ["
+                      "{"
+                          "\"stream\" : 1, \"count\" : 4"
+                      "}"
+                  "]"
+              "},"
+              "{"
+                  "\"uid\": \"trip\","
+                  "\"info\": \"get, (re)start, delete or subscribe to trip statistics\","
+                  "\"verb\": \"trip\","
+                  "\"usage\": {"
+                      "\"name\": \"trip name (default: default)\", \"action\" : \"get|start|reset|delete|subscribe|unsubscribe\""
+                  "},"
+                  "\"sample\": ["
+                      "{"
+                          "\"name\" : \"default\""
+                      "},"
+                      "{"
+                          "\"name\" : \"commute\", \"action\" : \"start\""
+                      "}"
+                  "]"
+              "},"
+              "{"
+                  "\"uid\": \"enu-origin\","
+                  "\"info\": \"get or move the origin of the ENU frame\","
+                  "\"verb\": \"enu-origin\","
+                  "\"usage\": {"
+                      "\"latitude\": \"degrees\", \"longitude\" : \"degrees\", \"altitude\" : \"m (default 0)\", \"current\" : \"true to use the latest fix\""
+                  "},"
+                  "\"sample\": ["
+                      "{"
+                          "\"latitude\" : 47.745, \"longitude\" : -3.366, \"altitude\" : 10.0"
+                      "},"
+                      "{"
+                          "\"current\" : true"
+                      "}"
+                  "]"
+              "},"
+              "{"
+                  "\"uid\": \"history\","
+                  "\"info\": \"recorded fixes of a time window, in an area, simplified\","
+                  "\"verb\": \"history\","
+                  "\"usage\": {"
+                      "\"start\": \"fix timestamp (s)\", \"end\" : \"fix timestamp (s)\", \"last\" : \"s before the newest fix\", \"latitude\" : \"degrees\", \"longitude\" : \"degrees\", \"radius\" : \"m\", \"bbox\" : \"[south, west, north, east]\", \"tolerance\" : \"m (default 0)\""
+                  "},"
+                  "\"sample\": ["
+                      "{"
+                          "\"last\" : 3600, \"latitude\" : 47.745, \"longitude\" : -3.366, \"radius\" : 200"
+                      "},"
+                      "{"
+                          "\"last\" : 86400, \"tolerance\" : 10"
+                      "},"
+                      "{"
+                          "\"bbox\" : [47.7, -3.4, 47.8, -3.3], \"tolerance\" : 5"
                       "}"
                   "]"
               "},"
+              "{"
+                  "\"uid\": \"export\","
+                  "\"info\": \"GPX or GeoJSON export of the stored fixes, a page at a time\","
+                  "\"verb\": \"export\","
+                  "\"usage\": {"
+                      "\"format\": \"gpx|geojson\", \"source\" : \"history|record\", \"start\" : \"fix timestamp (s)\", \"end\" : \"fix timestamp (s)\", \"limit\" : \"fixes per page (default 1000)\", \"cursor\" : \"from the previous page\""
+                  "},"
+                  "\"sample\": ["
+                      "{"
+                          "\"format\" : \"gpx\", \"source\" : \"record\", \"start\" : 1717426073, \"end\" : 1717512473"
+                      "},"
+                      "{"
+                          "\"format\" : \"geojson\", \"limit\" : 5000, \"cursor\" : 5184"
+                      "}"
+                  "]"
+              "},"
+              "{"
+                  "\"uid\": \"nearest\","
+                  "\"info\": \"Nearest points of interest, and events when the nearest one changes\","
+                  "\"verb\": \"nearest\","
+                  "\"usage\": {"
+                      "\"latitude\": \"degrees (default: latest fix)\", \"longitude\" : \"degrees (default: latest fix)\", \"count\" : \"1 to 100 (default 1)\", \"radius\" : \"meters\", \"action\" : \"subscribe|unsubscribe|reload\""
+                  "},"
+                  "\"sample\": ["
+                      "{"
+                          "\"count\" : 5, \"radius\" : 2000"
+                      "},"
+                      "{"
+                          "\"latitude\" : 47.745, \"longitude\" : -3.366, \"count\" : 3"
+                      "},"
+                      "{"
+                          "\"action\" : \"subscribe\", \"radius\" : 500"
+                      "}"
+                  "]"
+              "},"
+              "{"
+                  "\"uid\": \"replay\","
+                  "\"info\": \"Start or follow the replay of a NMEA log on a simulated clock\","
+                  "\"verb\": \"replay\","
+                  "\"usage\": {"
+                      "\"action\": \"start\""
+                  "},"
+                  "\"sample\": ["
+                      "{"
+                          "\"action\" : \"start\""
+                      "}"
+                  "]"
+              "},"
+              "{"
+                  "\"uid\": \"stats\","
+                  "\"info\": \"get GPSd streaming state and counters\","
+                  "\"verb\": \"stats\""
+              "},"
               "{"
                   "\"uid\": \"info\","
                   "\"info\": \"get GPS binding info\","
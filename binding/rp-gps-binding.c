@@ -30,9 +30,11 @@
 #include <errno.h>
 #include <gps.h>
 #include <json-c/json.h>
+#include <limits.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,20 +45,24 @@
 #include <urcu/list.h>
 
 #include "rp-gps-binding.h"
+#include "rp-gps-shm.h"
+#include "rp-gps-trace.h"
 
+// Read a report, also copying its raw JSON line in msg when not NULL
 #if GPSD_API_MAJOR_VERSION > 6
-#define gps_read(arg) gps_read(arg, NULL, 0)
+#define GPS_READ_MESSAGE(arg, msg, len) gps_read(arg, msg, len)
+#else
+#define GPS_READ_MESSAGE(arg, msg, len) gps_read(arg)
 #endif
+#define gps_read_data(arg) GPS_READ_MESSAGE(arg, NULL, 0)
 
 // Enable workaround
 #define AGL_SPEC_802 on
 
-// Enable NaN values from gpsd, to ensure a consistant json structure
-// Disabled by default to ensure compatibility with as many clients as possible
-#define SEND_NAN_VALUES false
-
-// 60 second max between 2 GPSd connection attemps
-#define GPSD_CONNECT_MAX_DELAY 60
+// 60 second max between 2 GPSd connection attemps, the first retry is immediate
+// and the following ones start from GPSD_CONNECT_MIN_DELAY_MS
+#define GPSD_CONNECT_MAX_DELAY    60
+#define GPSD_CONNECT_MIN_DELAY_MS 100
 
 #define GPSD_POLLING_MAX_RETRIES 60
 #define GPSD_POLLING_DELAY_MS    1000
@@ -64,11 +70,46 @@
 // Define the max not used count for an event
 #define EVENT_MAX_NOT_USED 5
 
+// Flow controlled events: max unacknowledged pushes, and time after which
+// a subscriber that stopped acknowledging gets its credits back
+#define EVENT_FLOW_MAX_WINDOW     64
+#define EVENT_FLOW_ACK_TIMEOUT_S 30
+
+// Max time a request waits for a fresh fix after streaming has been resumed
+#define GPSD_WAKE_TIMEOUT_MS 2000
+
+// Without new fix for this long, data is reported as stale
+#define GPS_FIX_STALE_MS 2000
+
+// Period of the frequency events while data is stale
+#define EVENT_STALE_PERIOD_US 1000000
+
+// Frequency events fire on a grid anchored on the fix time, moved again
+// only when the fixes drift away from it by more than this
+#define EVENT_GRID_RESYNC_NS 10000000LL
+
+// Max number of threads evaluating the events of a dispatch round
+#define EVENT_MAX_SHARDS 16
+
+// Bounds of the adaptive events options
+#define EVENT_ADAPTIVE_MAX_DISTANCE 100000   // m
+#define EVENT_ADAPTIVE_MAX_INTERVAL 3600000  // ms
+
+// Max number of conditions of a composite event, reported as bits of the payload
+#define EVENT_COMPOSITE_MAX_CONDITIONS 32
+
 // Threads management
 static pthread_t MainThread;
 static pthread_t EventThread;
 static pthread_mutex_t GpsDataMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t EventListMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t GpsDataCond;  // on CLOCK_MONOTONIC, initialized by GpsInit
+
+// Dispatch thread waiting for a fix, protected by GpsDataMutex: the replay
+// only moves the simulated clock meanwhile, up to dispatch_deadline_ns
+static bool dispatch_idle;
+static long long dispatch_deadline_ns;
+static pthread_cond_t DispatchIdleCond = PTHREAD_COND_INITIALIZER;
 
 typedef struct gpsd_connection_management_thread_userdate_s
 {
@@ -83,16 +124,114 @@ typedef struct gpsd_connection_management_thread_userdate_s
 static struct event_list_node *list;
 static struct gps_data_t data;
 static bool gpsd_online;
-static int max_freq;
+
+// Demand-driven streaming, protected by GpsDataMutex
+static bool gpsd_streaming;              // is WATCH currently enabled on the GPSd socket ?
+static unsigned int gpsd_idle_timeout;   // in s, 0 to keep streaming forever
+static struct timespec gpsd_last_demand; // last time someone needed gps data
+static struct timespec gpsd_wake_time;   // when streaming has been resumed
+static bool gpsd_wake_pending;           // waiting for the first fix since resume
+static unsigned int gpsd_watch_flags;    // WATCH flags currently enabled
+
+static struct timespec gpsd_lost_time;   // when the GPSd connection has been lost
+static bool gpsd_reconnect_pending;      // waiting for the first fix since connection loss
+
+static struct
+{
+    unsigned int idle_count;       // number of times streaming has been disabled
+    unsigned int wake_count;       // number of times streaming has been resumed
+    long last_wake_latency_us;     // resume to first fix latency, last occurrence
+    long max_wake_latency_us;      // resume to first fix latency, worst occurrence
+    unsigned int reconnect_count;  // number of times the connection has been lost
+    long last_reconnect_us;        // connection loss to first fix delay, last occurrence
+    long max_reconnect_us;         // connection loss to first fix delay, worst occurrence
+} gpsd_stats;
+
+// Dispatch round, evaluated by every shard against the same fix
+typedef struct event_round
+{
+    gps_fix_snapshot_t fix;
+    bool new_fix;
+    bool stale_notify;  // the data just became stale
+    long long grid_ns;  // time on the frequency grid
+    long long grid_offset_ns;
+    gps_projected_t proj;  // projections of the fix, computed once per fix
+    afb_data_t payload[GPS_PROJ_VARIANTS];  // for each set of projections, marshalled
+                                            // on first use and shared by all the shards
+    bool expired;        // some events have nobody listening anymore
+    long long deadline_ns[EVENT_MAX_SHARDS];  // next frequency tick of each shard
+} event_round_t;
+
+// Shard workers, the dispatch thread itself evaluating shard 0
+static unsigned int dispatch_threads = 1;
+static unsigned int shard_next;  // shard of the next event, protected by EventListMutex
+static struct cds_list_head shard_lists[EVENT_MAX_SHARDS];  // events of each shard, see below
+// New events, queued under EventListMutex and moved to their shard list between rounds
+static CDS_LIST_HEAD(shard_incoming);
+static bool shard_incoming_queued;
+static pthread_mutex_t ShardMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ShardStartCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ShardDoneCond = PTHREAD_COND_INITIALIZER;
+static event_round_t *shard_round;       // round being evaluated
+static unsigned long shard_round_count;  // rounds started so far
+static unsigned int shard_pending;       // workers still evaluating the round
+
+// Projections needed by the events, bits of gps_proj_enum
+static unsigned int projection_mask;
+
+// Expired events left in the list while pinned, purged after a later round
+static bool purge_deferred;
+
+static struct
+{
+    unsigned long rounds;  // dispatch rounds with a fix
+    long long busy_ns;     // time spent in these rounds
+    long long max_round_ns;
+} dispatch_stats;
 
 // Supported values for each condition type
 static int supported_freq[5] = {1, 10, 20, 50, 100};
 static int supported_movement[6] = {1, 10, 100, 300, 500, 1000};
 static int supported_speed[6] = {20, 30, 50, 90, 110, 130};
+static const char *supported_raw_class[REPORT_CLASS_COUNT] = {"TPV", "SKY", "PPS"};
+
+// Raw report passthrough, one protected event per report class
+static event_list_node *raw_nodes[REPORT_CLASS_COUNT];
+static unsigned int raw_class_mask;  // bit set for each class having listeners
+static unsigned int raw_generation[REPORT_CLASS_COUNT];  // bumped on each subscription
+
+// Raw lines are read into reusable buffers, held by the binder until pushed
+#define GPSD_RAW_POOL_SIZE 8
+typedef struct gpsd_raw_slot
+{
+    bool busy;
+    char text[GPS_JSON_RESPONSE_MAX];
+} gpsd_raw_slot_t;
+static gpsd_raw_slot_t gpsd_raw_pool[GPSD_RAW_POOL_SIZE];
+
+// Private events, flow controlled or composite
+static unsigned int stream_last_id;
+static unsigned int session_last_id;  // sessions owning private events
+static struct
+{
+    unsigned long conflated;  // payloads replaced by a newer one before delivery
+    unsigned long dropped;    // payloads never delivered
+    unsigned long resets;     // credits given back after EVENT_FLOW_ACK_TIMEOUT
+} flow_totals;
+static struct
+{
+    unsigned long pushes;     // pushes of the composite events
+    unsigned long triggered;  // conditions having triggered these pushes
+} composite_totals;
+
+// Incremented with each new fix, protected by GpsDataMutex
+static unsigned long gps_fix_seq;
+
+// Latest fix, kept across connection losses, protected by GpsDataMutex
+static gps_fix_snapshot_t gps_last_fix;
+static struct timespec gps_last_fix_time;  // when it has been received
 
 #define MSECS_TO_USECS(x) (x * 1000)
-#define HZ_TO_USECS(x)    (1000000 / x)
-#define ARRAY_SIZE(x)     (sizeof(x) / sizeof((x)[0]))
 
 /* Function:  ValueIsInArray
  * --------------------
@@ -116,6 +255,53 @@ int ValueIsInArray(int value, int *array, int array_size)
     return 0;
 }
 
+/* Function:  TimespecDiffUs
+ * -------------------------
+ * Compute the elapsed time between two timestamps.
+ *
+ * from: oldest timestamp
+ * to:   newest timestamp
+ *
+ * returns: elapsed time in microseconds
+ */
+static long TimespecDiffUs(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+/* Function:  TimespecToNs
+ * -----------------------
+ * Convert a timestamp to nanoseconds.
+ *
+ * ts: timestamp
+ *
+ * returns: timestamp in nanoseconds
+ */
+static long long TimespecToNs(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/* Function:  RawClassFromName
+ * ---------------------------
+ * Find a GPSd report class from its name.
+ *
+ * name: class name as sent by GPSd (ex: "TPV")
+ *
+ * returns: the report class
+ *          -1 if not supported
+ */
+static int RawClassFromName(const char *name)
+{
+    int i;
+    for (i = 0; i < REPORT_CLASS_COUNT; i++) {
+        if (!strcasecmp(name, supported_raw_class[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 /* Function:  GetDistanceInMeters
  * ------------------------------
  * Calculation of the distance between two GPS
@@ -151,62 +337,137 @@ double GetDistanceInMeters(double lat1, double long1, double lat2, double long2)
     return ans;
 }
 
-/* Function:  UpdateMaxFreq
- * ------------------------
- * Browse the event list, find the event with the
- * highest operating frequency and fill the global
- * variable max_freq accordingly
+/* Function:  GpsFixTimestamp
+ * --------------------------
+ * Get the timestamp of a fix as a double,
+ * whatever the libgps API version.
  *
- * returns: nothing
+ * gps: gps data holding the fix
+ *
+ * returns: fix timestamp in seconds
  */
-void UpdateMaxFreq()
+double GpsFixTimestamp(const struct gps_data_t *gps)
 {
-    pthread_mutex_lock(&EventListMutex);
-    event_list_node *list_cpy = list;
-    pthread_mutex_unlock(&EventListMutex);
-
-    event_list_node *tmp_node =
-        cds_list_entry(list_cpy->list_head.next, event_list_node, list_head);
-    int tmp_freq = 0;
+// Support the change from timestamp_t (double) to timespec struct (done with API 9.0)
+#if GPSD_API_MAJOR_VERSION > 8
+    return (double)gps->fix.time.tv_sec + ((double)gps->fix.time.tv_nsec / 1000000000);
+#else
+    return gps->fix.time;
+#endif
+}
 
-    // Find the highest operating frequency in the event list
-    while (tmp_node != list_cpy) {
-        if (tmp_node->condition_type == FREQUENCY) {
-            if (tmp_node->condition_value.freq > tmp_freq) {
-                tmp_freq = tmp_node->condition_value.freq;
-            }
-        }
+/* Function:  ExpressionFromJson
+ * -----------------------------
+ * Compile the expression of an "expression" condition
+ * and read its options.
+ *
+ * jcondition : Json oject containing the event information.
+ * expr : where to store the compiled expression, the caller owns it
+ * debounce : where to store the debounce option (ms)
+ * hysteresis : where to store the hysteresis option (ms)
+ *
+ * returns: -1 if failed
+ *          0 if well compiled
+ */
+static int ExpressionFromJson(json_object *jcondition,
+                              gps_expr_t **expr,
+                              int *debounce,
+                              int *hysteresis)
+{
+    struct json_object *json_value;
+    const char *error = NULL;
 
-        tmp_node = cds_list_entry(tmp_node->list_head.next, event_list_node, list_head);
+    *debounce = *hysteresis = 0;
+    if (json_object_object_get_ex(jcondition, "debounce", &json_value)) {
+        if (!json_object_is_type(json_value, json_type_int))
+            return -1;
+        *debounce = json_object_get_int(json_value);
+    }
+    if (json_object_object_get_ex(jcondition, "hysteresis", &json_value)) {
+        if (!json_object_is_type(json_value, json_type_int))
+            return -1;
+        *hysteresis = json_object_get_int(json_value);
     }
+    if (*debounce < 0 || *hysteresis < 0)
+        return -1;
+
+    if (!json_object_object_get_ex(jcondition, "value", &json_value) ||
+        !json_object_is_type(json_value, json_type_string))
+        return -1;
 
-    // Apply the new highest frequency
-    if (max_freq != tmp_freq) {
-        max_freq = tmp_freq;
-        AFB_INFO("New max freq %d Hz", max_freq);
+    *expr = GpsExprCompile(json_object_get_string(json_value), &error);
+    if (!*expr) {
+        AFB_ERROR("Invalid expression \"%s\": %s.", json_object_get_string(json_value), error);
+        return -1;
     }
+    return 0;
 }
 
-/* Function:  AddDoubleToJson
- * --------------------------
- * Add a double to a JsonObject
- * It handle double Nan value and
- * the SEND_NAN_VALUES option.
+/* Function:  ExpressionEventName
+ * ------------------------------
+ * Name the event of an expression after its bytecode, so that
+ * identical expressions share the same event.
  *
- * data : double to add
- * jdata : json_object to add to
- * key : json key
+ * returns: -1 if failed
+ *          0 if name well generated
+ */
+static int ExpressionEventName(const gps_expr_t *expr,
+                               int debounce,
+                               int hysteresis,
+                               char *event_name,
+                               size_t size)
+{
+    int len = snprintf(event_name, size, "gps_data_expr_%016llx_%d_%d",
+                       (unsigned long long)GpsExprHash(expr), debounce, hysteresis);
+    return len < 0 || (size_t)len >= size ? -1 : 0;
+}
+
+/* Function:  AdaptiveFromJson
+ * ---------------------------
+ * Read the distance and the options of an "adaptive" condition.
  *
- * returns: nothing
+ * jcondition : Json oject containing the event information.
+ * node : event whose condition_value.adaptive is filled
+ *
+ * returns: -1 if failed
+ *          0 if well read
  */
-static void AddDoubleToJson(double data, json_object *jdata, char *key)
+static int AdaptiveFromJson(json_object *jcondition, event_list_node *node)
 {
-    json_object *JsonValue = NULL;
+    typeof(node->condition_value.adaptive) *adaptive = &node->condition_value.adaptive;
+    struct json_object *json_value;
+
+    memset(adaptive, 0, sizeof(*adaptive));
+    if (!json_object_object_get_ex(jcondition, "value", &json_value) ||
+        !json_object_is_type(json_value, json_type_int))
+        return -1;
+    adaptive->distance = json_object_get_int(json_value);
+
+    if (json_object_object_get_ex(jcondition, "min_interval", &json_value)) {
+        if (!json_object_is_type(json_value, json_type_int))
+            return -1;
+        adaptive->min_interval = json_object_get_int(json_value);
+    }
+    if (json_object_object_get_ex(jcondition, "max_interval", &json_value)) {
+        if (!json_object_is_type(json_value, json_type_int))
+            return -1;
+        adaptive->max_interval = json_object_get_int(json_value);
+    }
+    if (json_object_object_get_ex(jcondition, "heading", &json_value)) {
+        if (!json_object_is_type(json_value, json_type_int))
+            return -1;
+        adaptive->heading = json_object_get_int(json_value);
+    }
 
-    if (!isnan(data) || SEND_NAN_VALUES) {
-        JsonValue = json_object_new_double(data);
-        json_object_object_add(jdata, key, JsonValue);
+    if (adaptive->distance < 1 || adaptive->distance > EVENT_ADAPTIVE_MAX_DISTANCE ||
+        adaptive->min_interval < 0 || adaptive->min_interval > EVENT_ADAPTIVE_MAX_INTERVAL ||
+        adaptive->max_interval < 0 || adaptive->max_interval > EVENT_ADAPTIVE_MAX_INTERVAL ||
+        (adaptive->max_interval && adaptive->max_interval < adaptive->min_interval) ||
+        adaptive->heading < 0 || adaptive->heading > 180) {
+        AFB_ERROR("Unsupported adaptive condition.");
+        return -1;
     }
+    return 0;
 }
 
 /* Function:  EventJsonToName
@@ -215,14 +476,15 @@ static void AddDoubleToJson(double data, json_object *jdata, char *key)
  * information about it (condition type, value ...).
  *
  * jcondition : Json oject containing the event information.
- * result : Storing string for the event name. The caller owns the allocated string.
+ * result : where to store the event name, NULL to only check jcondition
+ * size : size of result, at most EVENT_NAME_MAX is needed
  *
  * returns: -1 if failed
  *          0 if name well generated
  */
-int EventJsonToName(json_object *jcondition, char **result)
+int EventJsonToName(json_object *jcondition, char *result, size_t size)
 {
-    char *event_name;
+    char event_name[EVENT_NAME_MAX];
 
     // Verification of the json structure
     struct json_object *json_data_type;
@@ -250,66 +512,147 @@ int EventJsonToName(json_object *jcondition, char **result)
             if (!json_object_is_type(json_condition_value, json_type_int))
                 return -1;
             int value = json_object_get_int(json_condition_value);
-            if (asprintf(&event_name, "gps_data_freq_%d", value) == -1)
-                return -1;
+            snprintf(event_name, sizeof(event_name), "gps_data_freq_%d", value);
         }
         else if (!strcasecmp(type, "movement")) {
             if (!json_object_is_type(json_condition_value, json_type_int))
                 return -1;
             int value = json_object_get_int(json_condition_value);
-            if (asprintf(&event_name, "gps_data_movement_%d", value) == -1)
-                return -1;
+            snprintf(event_name, sizeof(event_name), "gps_data_movement_%d", value);
         }
         else if (!strcasecmp(type, "max_speed")) {
             if (!json_object_is_type(json_condition_value, json_type_int))
                 return -1;
             int value = json_object_get_int(json_condition_value);
-            if (asprintf(&event_name, "gps_data_speed_%d", value) == -1)
+            snprintf(event_name, sizeof(event_name), "gps_data_speed_%d", value);
+        }
+        else if (!strcasecmp(type, "adaptive")) {
+            event_list_node node;
+            if (AdaptiveFromJson(jcondition, &node) < 0)
+                return -1;
+            snprintf(event_name, sizeof(event_name), "gps_data_adaptive_%d_%d_%d_%d",
+                     node.condition_value.adaptive.distance,
+                     node.condition_value.adaptive.min_interval,
+                     node.condition_value.adaptive.max_interval,
+                     node.condition_value.adaptive.heading);
+        }
+        else if (!strcasecmp(type, "expression")) {
+            gps_expr_t *expr;
+            int debounce, hysteresis;
+            if (ExpressionFromJson(jcondition, &expr, &debounce, &hysteresis) < 0)
+                return -1;
+            int ret =
+                ExpressionEventName(expr, debounce, hysteresis, event_name, sizeof(event_name));
+            GpsExprFree(expr);
+            if (ret < 0)
+                return -1;
+        }
+        else if (!strcasecmp(type, "composite")) {
+            // Private to the subscriber, the stream id is added once created
+            size_t count = json_object_is_type(json_condition_value, json_type_array)
+                               ? json_object_array_length(json_condition_value)
+                               : 0;
+            if (count < 1 || count > EVENT_COMPOSITE_MAX_CONDITIONS)
                 return -1;
+            snprintf(event_name, sizeof(event_name), "gps_data_composite");
         }
         else {
             AFB_ERROR("Unsupported event type.");
             return -1;
         }
+
+        // Events with projected coordinates are not shared with the plain ones
+        unsigned int projections;
+        json_object *json_projection = NULL;
+        json_object_object_get_ex(jcondition, "projection", &json_projection);
+        if (GpsProjMaskFromJson(json_projection, &projections) < 0) {
+            AFB_ERROR("Unsupported projection.");
+            return -1;
+        }
+        if (GpsProjName(projections, event_name, sizeof(event_name)) < 0)
+            return -1;
+    }
+    else if (!strcasecmp(data_type, "gpsd_raw")) {
+        if (strcasecmp(type, "class")) {
+            AFB_ERROR("Unsupported event type.");
+            return -1;
+        }
+        if (!json_object_is_type(json_condition_value, json_type_string))
+            return -1;
+        int value = RawClassFromName(json_object_get_string(json_condition_value));
+        if (value < 0)
+            return -1;
+        snprintf(event_name, sizeof(event_name), "gpsd_raw_%s", supported_raw_class[value]);
     }
     else {
         AFB_ERROR("Unsupported data type.");
         return -1;
     }
 
-    if (result != NULL)
-        *result = event_name;
-    else
-        free(event_name);
+    if (result != NULL && snprintf(result, size, "%s", event_name) >= (int)size)
+        return -1;
 
     return 0;
 }
 
-/* Function:  EventListAdd
- * -----------------------
- * Add an event to the event list.
+/* Function:  EventFlowFree
+ * ------------------------
+ * Release the flow control state of a private event,
+ * a pending payload is counted as dropped.
  *
- * jcondition : Json oject containing the event information.
- * is_protected : true : if the event has to be protected from deletion
- *                 false : if not
- * node : where to store the pointer to the created event
+ * returns: nothing
+ */
+static void EventFlowFree(event_flow_t *flow)
+{
+    if (!flow)
+        return;
+
+    if (flow->pending) {
+        afb_data_unref(flow->pending);
+        __atomic_add_fetch(&flow_totals.dropped, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_destroy(&flow->mutex);
+    free(flow);
+}
+
+/* Function:  EventNodeFree
+ * ------------------------
+ * Release an event node and what it owns.
  *
- * returns: -1 if failed
- *          0 if event well created
+ * returns: nothing
  */
-int EventListAdd(json_object *jcondition,
-                 bool is_protected,
-                 event_list_node **node,
-                 afb_req_t request)
+static void EventNodeFree(event_list_node *node)
 {
-    event_list_node *newEvent = malloc(sizeof(event_list_node));
-    CDS_INIT_LIST_HEAD(&newEvent->list_head);
-    if (!newEvent) {
-        AFB_ERROR("Allocation error.");
-        return -1;
+    unsigned int i;
+
+    if (node->condition_type == EXPRESSION)
+        GpsExprFree(node->condition_value.expression.expr);
+    if (node->condition_type == COMPOSITE && node->condition_value.composite.conditions) {
+        for (i = 0; i < node->condition_value.composite.count; i++) {
+            event_list_node *condition = &node->condition_value.composite.conditions[i];
+            if (condition->condition_type == EXPRESSION)
+                GpsExprFree(condition->condition_value.expression.expr);
+        }
+        free(node->condition_value.composite.conditions);
     }
+    EventFlowFree(node->flow);
+    if (node->event)
+        afb_event_unref(node->event);
+    GpsRtNodeRelease(node);
+}
 
-    char *event_name;
+/* Function:  EventConditionFromJson
+ * ---------------------------------
+ * Read the condition of an event: its type, its value and options.
+ *
+ * jcondition : Json oject containing the event information.
+ * node : event whose condition_type, condition_value and last_value are filled
+ *
+ * returns: -1 if failed
+ *          0 if well read
+ */
+static int EventConditionFromJson(json_object *jcondition, event_list_node *node)
+{
     json_object *json_condition_type;
     if (!json_object_object_get_ex(jcondition, "condition", &json_condition_type))
         return -1;
@@ -321,576 +664,2552 @@ int EventListAdd(json_object *jcondition,
     if (!json_object_object_get_ex(jcondition, "value", &json_value))
         return -1;
 
-    // Create the new event
     if (!strcasecmp(type, "frequency")) {
         if (!json_object_is_type(json_value, json_type_int))
             return -1;
         int value = json_object_get_int(json_value);
 
-        if (ValueIsInArray(value, supported_freq, ARRAY_SIZE(supported_freq))) {
-            if (asprintf(&event_name, "gps_data_freq_%d", value) > 0) {
-                afb_api_t api = afb_req_get_api(request);
-                if (afb_api_new_event(api, event_name, &newEvent->event) < 0) {
-                    free(event_name);
-                    return -1;
-                }
-                free(event_name);
-                newEvent->is_protected = is_protected;
-                newEvent->not_used_count = 0;
-                newEvent->condition_type = FREQUENCY;
-                newEvent->condition_value.freq = value;
-                clock_gettime(CLOCK_MONOTONIC, &newEvent->last_value.freq_last_send);
-            }
-            else
-                return -1;
-        }
-        else {
+        if (!ValueIsInArray(value, supported_freq, ARRAY_SIZE(supported_freq))) {
             AFB_ERROR("Unsupported frequency.");
             return -1;
         }
+        node->condition_type = FREQUENCY;
+        node->condition_value.freq = value;
+        node->last_value.freq_last_slot = -1;
     }
     else if (!strcasecmp(type, "movement")) {
         if (!json_object_is_type(json_value, json_type_int))
             return -1;
         int value = json_object_get_int(json_value);
 
-        if (ValueIsInArray(value, supported_movement, ARRAY_SIZE(supported_movement))) {
-            if (asprintf(&event_name, "gps_data_movement_%d", value) > 0) {
-                afb_api_t api = afb_req_get_api(request);
-                if (afb_api_new_event(api, event_name, &newEvent->event) < 0) {
-                    free(event_name);
-                    return -1;
-                }
-                free(event_name);
-                newEvent->is_protected = is_protected;
-                newEvent->not_used_count = 0;
-                newEvent->condition_type = MOVEMENT;
-                newEvent->condition_value.movement_range = value;
-                newEvent->last_value.movement_last_lat_lon.latitude = 0.0;
-                newEvent->last_value.movement_last_lat_lon.longitude = 0.0;
-            }
-            else
-                return -1;
-        }
-        else {
+        if (!ValueIsInArray(value, supported_movement, ARRAY_SIZE(supported_movement))) {
             AFB_ERROR("Unsupported movement range.");
             return -1;
         }
+        node->condition_type = MOVEMENT;
+        node->condition_value.movement_range = value;
+        node->last_value.movement_last_lat_lon.latitude = 0.0;
+        node->last_value.movement_last_lat_lon.longitude = 0.0;
     }
     else if (!strcasecmp(type, "max_speed")) {
         if (!json_object_is_type(json_value, json_type_int))
             return -1;
         int value = json_object_get_int(json_value);
 
-        if (ValueIsInArray(value, supported_speed, ARRAY_SIZE(supported_speed))) {
-            if (asprintf(&event_name, "gps_data_speed_%d", value) > 0) {
-                afb_api_t api = afb_req_get_api(request);
-                if (afb_api_new_event(api, event_name, &newEvent->event) < 0) {
-                    free(event_name);
-                    return -1;
-                }
-                free(event_name);
-                newEvent->is_protected = is_protected;
-                newEvent->not_used_count = 0;
-                newEvent->condition_type = MAX_SPEED;
-                newEvent->condition_value.max_speed = value;
-                newEvent->last_value.above_speed = false;
-            }
-            else
-                return -1;
-        }
-        else {
+        if (!ValueIsInArray(value, supported_speed, ARRAY_SIZE(supported_speed))) {
             AFB_ERROR("Unsupported max speed.");
             return -1;
         }
+        node->condition_type = MAX_SPEED;
+        node->condition_value.max_speed = value;
+        node->last_value.above_speed = false;
+    }
+    else if (!strcasecmp(type, "expression")) {
+        gps_expr_t *expr;
+        int debounce, hysteresis;
+
+        if (ExpressionFromJson(jcondition, &expr, &debounce, &hysteresis) < 0)
+            return -1;
+        node->condition_type = EXPRESSION;
+        node->condition_value.expression.expr = expr;
+        node->condition_value.expression.debounce = debounce;
+        node->condition_value.expression.hysteresis = hysteresis;
+    }
+    else if (!strcasecmp(type, "adaptive")) {
+        if (AdaptiveFromJson(jcondition, node) < 0)
+            return -1;
+        node->condition_type = ADAPTIVE;
+        memset(&node->last_value.adaptive, 0, sizeof(node->last_value.adaptive));
+    }
+    else if (!strcasecmp(type, "class")) {
+        if (!json_object_is_type(json_value, json_type_string))
+            return -1;
+        int value = RawClassFromName(json_object_get_string(json_value));
+
+        if (value < 0) {
+            AFB_ERROR("Unsupported report class.");
+            return -1;
+        }
+        node->condition_type = RAW_CLASS;
+        node->condition_value.raw_class = value;
     }
     else {
         AFB_ERROR("Unsupported event type.");
         return -1;
     }
-
-    // Add NewEvent to the list
-    pthread_mutex_lock(&EventListMutex);
-    cds_list_add_tail(&newEvent->list_head, &list->list_head);
-    pthread_mutex_unlock(&EventListMutex);
-
-    if (node != NULL)
-        *node = newEvent;
-
-    AFB_INFO("Event %s well created.", afb_event_name(newEvent->event));
     return 0;
 }
 
-/* Function:  EventListFind
- * ------------------------
- * Find an event in the list.
+/* Function:  CompositeFromJson
+ * ----------------------------
+ * Read the conditions of a "composite" event, any of the gps_data
+ * conditions but another composite one.
  *
- * jcondition : Json oject containing the event information.
- * found_node : where to store the pointer to the found event
+ * jconditions : Json array of the conditions
+ * node : event whose condition_value.composite is filled
  *
- * returns: false if failed
- *          true  if event found
+ * returns: -1 if failed
+ *          0 if well read
  */
-bool EventListFind(json_object *jcondition, event_list_node **found_node)
+static int CompositeFromJson(json_object *jconditions, event_list_node *node)
 {
-    event_list_node *iterator;
-    bool found = false;
+    typeof(node->condition_value.composite) *composite = &node->condition_value.composite;
+    unsigned int i;
 
-    // Generate the name of the event we are looking for
-    char *event_name = NULL;
-    if (EventJsonToName(jcondition, &event_name) == -1) {
-        free(event_name);
-        return false;
+    if (!json_object_is_type(jconditions, json_type_array))
+        return -1;
+    size_t count = json_object_array_length(jconditions);
+    if (count < 1 || count > EVENT_COMPOSITE_MAX_CONDITIONS) {
+        AFB_ERROR("Unsupported composite condition.");
+        return -1;
     }
 
-    // Browse the event list for an event with this name
-    pthread_mutex_lock(&EventListMutex);
-    cds_list_for_each_entry(iterator, &list->list_head, list_head)
-    {
-        if (strcmp(event_name, afb_event_name(iterator->event)))
-            continue;
+    composite->conditions = calloc(count, sizeof(event_list_node));
+    if (!composite->conditions)
+        return -1;
 
-        if (found_node != NULL)
-            *found_node = iterator;
-        found = true;
-        break;
+    // count only covers the conditions read so far, released on error
+    for (i = 0; i < count; i++) {
+        event_list_node *condition = &composite->conditions[i];
+        json_object *json_condition_type;
+
+        json_object *jcondition = json_object_array_get_idx(jconditions, i);
+        if (!json_object_object_get_ex(jcondition, "condition", &json_condition_type) ||
+            !json_object_is_type(json_condition_type, json_type_string) ||
+            !strcasecmp(json_object_get_string(json_condition_type), "composite") ||
+            EventConditionFromJson(jcondition, condition) < 0)
+            return -1;
+        composite->count++;
+        if (condition->condition_type == RAW_CLASS) {
+            AFB_ERROR("Unsupported composite condition.");
+            return -1;
+        }
+        // Distances are measured in the frame of the event
+        condition->projections = node->projections;
     }
-    pthread_mutex_unlock(&EventListMutex);
-    free(event_name);
-    return found;
+    return 0;
 }
 
-/* Function:  EventListDeleteByNode
- * --------------------------------
- * Delete an event in the list.
+/* Function:  EventSessionId
+ * -------------------------
+ * Identify the session of a request, numbered on its first
+ * private subscription, so that only the subscriber of a
+ * private event can acknowledge it or unsubscribe from it.
  *
- * node : pointer to the event to delete
+ * request : Request from the client
  *
- * returns: false if not found
- *          true  if the event has been found and deleted
+ * returns: id of the session, 0 if failed
  */
-bool EventListDeleteByNode(event_list_node **node)
+static unsigned int EventSessionId(afb_req_t request)
 {
-    event_list_node *iterator, *tmp;
-    event_list_node *cpy_node = *node;
-    bool deleted = false;
-    pthread_mutex_lock(&EventListMutex);
-    cds_list_for_each_entry_safe(iterator, tmp, &list->list_head, list_head)
-    {
-        if (strcmp(afb_event_name(cpy_node->event), afb_event_name(iterator->event)))
-            continue;
+    void *value = NULL;
 
-        // Delete the event
-        cds_list_del(&iterator->list_head);
-        deleted = true;
-
-        free(iterator);
+    if (afb_req_context_get(request, &value) >= 0 && value)
+        return (unsigned int)(uintptr_t)value;
 
-        *node = NULL;
-        break;
+    unsigned int id = __atomic_add_fetch(&session_last_id, 1, __ATOMIC_RELAXED);
+    if (afb_req_context_set(request, (void *)(uintptr_t)id, NULL, NULL) < 0) {
+        AFB_ERROR("Cannot identify the session.");
+        return 0;
     }
-    pthread_mutex_unlock(&EventListMutex);
-    return deleted;
+    return id;
 }
 
-/* Function:  JsonDataCompletion
- * -----------------------------
- * Marcheling of gps data in a Json object
+/* Function:  EventListAdd
+ * -----------------------
+ * Add an event to the event list.
+ * With a "window" option, the event is private to the subscriber
+ * and its delivery is flow controlled (see EventFlowPush).
+ * A composite event is private too, pushed once for all its conditions.
+ * The created event counts one subscriber, the client creating it.
  *
- * jdata : Json object where to temporary store data
+ * jcondition : Json oject containing the event information.
+ * is_protected : true : if the event has to be protected from deletion
+ *                 false : if not
+ * node : where to store the pointer to the created event
  *
- * returns: NULL if mode fix unavailable
- *          Json object containing gps data
+ * returns: -1 if failed
+ *          0 if event well created
  */
-static json_object *JsonDataCompletion(json_object *jdata)
+int EventListAdd(json_object *jcondition,
+                 bool is_protected,
+                 event_list_node **node,
+                 afb_req_t request)
 {
-    json_object *JsonValue = NULL;
-
-    if (data.fix.mode < 2) {
-        json_object_put(jdata);
-        return NULL;
-    }
+    char event_name[EVENT_NAME_MAX];
+    int window = 0;
 
-    JsonValue = json_object_new_int(data.satellites_visible);
-    json_object_object_add(jdata, "visible satellites", JsonValue);
+    json_object *json_condition_type;
+    if (!json_object_object_get_ex(jcondition, "condition", &json_condition_type))
+        return -1;
+    if (!json_object_is_type(json_condition_type, json_type_string))
+        return -1;
+    const char *type = json_object_get_string(json_condition_type);
+
+    struct json_object *json_value;
+    if (json_object_object_get_ex(jcondition, "window", &json_value)) {
+        if (!json_object_is_type(json_value, json_type_int))
+            return -1;
+        window = json_object_get_int(json_value);
+        if (window < 1 || window > EVENT_FLOW_MAX_WINDOW) {
+            AFB_ERROR("Unsupported window.");
+            return -1;
+        }
+    }
+
+    if (!json_object_object_get_ex(jcondition, "value", &json_value))
+        return -1;
+
+    event_list_node *newEvent = GpsRtNodeAlloc();
+    if (!newEvent) {
+        AFB_ERROR("Allocation error.");
+        return -1;
+    }
+    CDS_INIT_LIST_HEAD(&newEvent->list_head);
+    CDS_INIT_LIST_HEAD(&newEvent->shard_head);
+    newEvent->is_protected = is_protected;
+    newEvent->not_used_count = 0;
+    newEvent->subscribers = 1;  // its creator, about to subscribe
+
+    json_object *json_projection = NULL;
+    json_object_object_get_ex(jcondition, "projection", &json_projection);
+    if (GpsProjMaskFromJson(json_projection, &newEvent->projections) < 0)
+        goto error;
+
+    // Create the new event
+    if (!strcasecmp(type, "composite")) {
+        newEvent->condition_type = COMPOSITE;
+        if (CompositeFromJson(json_value, newEvent) < 0)
+            goto error;
+    }
+    else if (EventConditionFromJson(jcondition, newEvent) < 0)
+        goto error;
+
+    if (newEvent->condition_type == RAW_CLASS) {
+        if (window) {
+            AFB_ERROR("Unsupported report class.");
+            goto error;
+        }
+        // Pushed from the polling thread, never deleted
+        newEvent->is_protected = true;
+    }
+
+    if (EventJsonToName(jcondition, event_name, sizeof(event_name)) < 0)
+        goto error;
+
+    // Flow controlled and composite events are private, name them after their stream id
+    if (window || newEvent->condition_type == COMPOSITE) {
+        if (window) {
+            newEvent->flow = calloc(1, sizeof(event_flow_t));
+            if (!newEvent->flow)
+                goto error;
+            pthread_mutex_init(&newEvent->flow->mutex, NULL);
+            newEvent->flow->window = window;
+        }
+        newEvent->stream = __atomic_add_fetch(&stream_last_id, 1, __ATOMIC_RELAXED);
+        newEvent->owner = EventSessionId(request);
+        if (!newEvent->owner)
+            goto error;
+        size_t len = strlen(event_name);
+        if (snprintf(event_name + len, sizeof(event_name) - len, "_s%u", newEvent->stream) >=
+            (int)(sizeof(event_name) - len))
+            goto error;
+    }
+
+    afb_api_t api = afb_req_get_api(request);
+    if (afb_api_new_event(api, event_name, &newEvent->event) < 0)
+        goto error;
+
+    if (newEvent->condition_type == RAW_CLASS)
+        raw_nodes[newEvent->condition_value.raw_class] = newEvent;
+
+    // Add NewEvent to the list, spreading the events over the shards
+    pthread_mutex_lock(&EventListMutex);
+    newEvent->shard = shard_next++ % dispatch_threads;
+    cds_list_add_tail(&newEvent->list_head, &list->list_head);
+    cds_list_add_tail(&newEvent->shard_head, &shard_incoming);
+    __atomic_store_n(&shard_incoming_queued, true, __ATOMIC_RELEASE);
+    __atomic_or_fetch(&projection_mask, newEvent->projections, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&EventListMutex);
+
+    if (node != NULL)
+        *node = newEvent;
+
+    AFB_DEBUG("Event %s well created.", afb_event_name(newEvent->event));
+    return 0;
+
+error:
+    EventNodeFree(newEvent);
+    return -1;
+}
+
+/* Function:  EventNodeHold
+ * ------------------------
+ * Count one more subscriber, unless the event has expired.
+ *
+ * returns: false if the event has expired
+ */
+static bool EventNodeHold(event_list_node *node)
+{
+    int count = __atomic_load_n(&node->subscribers, __ATOMIC_ACQUIRE);
+
+    do {
+        if (count < 0)
+            return false;
+    } while (!__atomic_compare_exchange_n(&node->subscribers, &count, count + 1, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return true;
+}
+
+/* Function:  EventNodeRelease
+ * ---------------------------
+ * Count one subscriber less, once unsubscribed or if subscribing failed.
+ *
+ * returns: nothing
+ */
+static void EventNodeRelease(event_list_node *node)
+{
+    int count = __atomic_load_n(&node->subscribers, __ATOMIC_ACQUIRE);
+
+    do {
+        if (count <= 0)
+            return;
+    } while (!__atomic_compare_exchange_n(&node->subscribers, &count, count - 1, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+/* Function:  EventNodeExpire
+ * --------------------------
+ * Mark an unprotected event as expired, to be deleted at the end of the
+ * dispatch round, unless a client subscribed since it was found unused.
+ *
+ * node : event to expire
+ * subscribers : subscriber count seen when the event was found unused
+ *
+ * returns: true if the event has expired
+ */
+static bool EventNodeExpire(event_list_node *node, int subscribers)
+{
+    if (node->is_protected || subscribers < 0)
+        return false;
+    if (!__atomic_compare_exchange_n(&node->subscribers, &subscribers, -1, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return false;
+    node->expired = true;
+    return true;
+}
+
+/* Function:  EventListFindStream
+ * ------------------------------
+ * Find a private event, flow controlled or composite, by its stream id.
+ * EventListMutex must be held by the caller.
+ *
+ * id : stream id
+ * owner : session of the request, see EventSessionId
+ *
+ * returns: the event, NULL if not found or subscribed by another session
+ */
+static event_list_node *EventListFindStream(unsigned int id, unsigned int owner)
+{
+    event_list_node *iterator;
+
+    cds_list_for_each_entry(iterator, &list->list_head, list_head)
+    {
+        // Shared events have no stream id
+        if (id && iterator->stream == id)
+            return owner && iterator->owner == owner ? iterator : NULL;
+    }
+    return NULL;
+}
+
+/* Function:  EventListFind
+ * ------------------------
+ * Find an event in the list, skipping the expired ones.
+ *
+ * jcondition : Json oject containing the event information.
+ * hold : true to count one more subscriber, released by EventNodeRelease
+ * found_node : where to store the pointer to the found event
+ *
+ * returns: false if failed
+ *          true  if event found
+ */
+bool EventListFind(json_object *jcondition, bool hold, event_list_node **found_node)
+{
+    event_list_node *iterator;
+    bool found = false;
+
+    // Generate the name of the event we are looking for
+    char event_name[EVENT_NAME_MAX];
+    if (EventJsonToName(jcondition, event_name, sizeof(event_name)) == -1)
+        return false;
+
+    // Browse the event list for an event with this name
+    pthread_mutex_lock(&EventListMutex);
+    cds_list_for_each_entry(iterator, &list->list_head, list_head)
+    {
+        if (strcmp(event_name, afb_event_name(iterator->event)))
+            continue;
+        if (hold ? !EventNodeHold(iterator) : __atomic_load_n(&iterator->subscribers,
+                                                              __ATOMIC_ACQUIRE) < 0)
+            continue;
+
+        if (found_node != NULL)
+            *found_node = iterator;
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&EventListMutex);
+    return found;
+}
+
+/* Function:  EventListPurge
+ * -------------------------
+ * Delete the events nobody listens to anymore,
+ * and stop computing the projections they needed.
+ * The pinned ones are deleted by a later purge, once unpinned.
+ *
+ * returns: nothing
+ */
+void EventListPurge()
+{
+    event_list_node *iterator, *tmp;
+    unsigned int projections = 0;
+    bool deferred = false;
+
+    pthread_mutex_lock(&EventListMutex);
+    cds_list_for_each_entry_safe(iterator, tmp, &list->list_head, list_head)
+    {
+        if (!iterator->expired) {
+            projections |= iterator->projections;
+            continue;
+        }
+        if (__atomic_load_n(&iterator->pins, __ATOMIC_ACQUIRE) > 0) {
+            deferred = true;
+            continue;
+        }
+
+        cds_list_del(&iterator->list_head);
+        cds_list_del(&iterator->shard_head);
+        EventNodeFree(iterator);
+    }
+    __atomic_store_n(&projection_mask, projections, __ATOMIC_RELAXED);
+    __atomic_store_n(&purge_deferred, deferred, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&EventListMutex);
+}
+
+/* Function:  EventFlowSent
+ * ------------------------
+ * Account for a push on a flow controlled event, consuming one credit
+ * if it has been delivered.
+ * The flow mutex must be held by the caller.
+ *
+ * ret : afb_event_push result
+ *
+ * returns: ret
+ */
+static int EventFlowSent(event_flow_t *flow, int ret)
+{
+    if (ret > 0) {
+        if (flow->outstanding++ == 0)
+            GpsClockGetTime(&flow->last_ack);
+        flow->pushed++;
+    }
+    return ret;
+}
+
+/* Function:  EventFlowSend
+ * ------------------------
+ * Push a payload on a flow controlled event, consuming one credit.
+ * The flow mutex must be held by the caller.
+ *
+ * payload : data to push, the caller reference is given away
+ *
+ * returns: afb_event_push result
+ */
+static int EventFlowSend(event_flow_t *flow, afb_event_t event, afb_data_t payload)
+{
+    return EventFlowSent(flow, afb_event_push(event, 1, &payload));
+}
+
+/* Function:  EventFlowPush
+ * ------------------------
+ * Push gps data on a flow controlled event.
+ * While the subscriber has no credit left, or while "ack" is sending
+ * the pending payload, only the latest payload is kept, replacing
+ * (conflating) the previous one; it is sent as soon as a credit
+ * is given back by "ack".
+ *
+ * payload : gps data, a reference is taken
+ *
+ * returns: afb_event_push result, 1 if kept for later
+ */
+static int EventFlowPush(event_flow_t *flow, afb_event_t event, afb_data_t payload)
+{
+    int ret = 1;
+
+    pthread_mutex_lock(&flow->mutex);
+
+    // Subscriber silent for too long, it may be gone: probe it again
+    if (flow->outstanding >= flow->window) {
+        struct timespec now;
+        GpsClockGetTime(&now);
+        if (now.tv_sec - flow->last_ack.tv_sec >= EVENT_FLOW_ACK_TIMEOUT_S) {
+            flow->outstanding = 0;
+            flow->resets++;
+            __atomic_add_fetch(&flow_totals.resets, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (flow->outstanding < flow->window && !flow->sending) {
+        // Pending payload is older than this one
+        if (flow->pending) {
+            afb_data_unref(flow->pending);
+            flow->pending = NULL;
+            flow->conflated++;
+            __atomic_add_fetch(&flow_totals.conflated, 1, __ATOMIC_RELAXED);
+        }
+        ret = EventFlowSend(flow, event, afb_data_addref(payload));
+    }
+    else {
+        if (flow->pending) {
+            afb_data_unref(flow->pending);
+            flow->conflated++;
+            __atomic_add_fetch(&flow_totals.conflated, 1, __ATOMIC_RELAXED);
+        }
+        flow->pending = afb_data_addref(payload);
+    }
+
+    pthread_mutex_unlock(&flow->mutex);
+    return ret;
+}
+
+/* Function:  EventNodePush
+ * ------------------------
+ * Push gps data to the listeners of an event.
+ * If an unprotected event is not used anymore, it is marked
+ * as expired, to be deleted at the end of the dispatch round.
+ *
+ * tmp : event to push
+ * payload : gps data, shared by all the events of a dispatch round,
+ *           a reference is taken
+ *
+ * returns: true if the event has been pushed (or queued)
+ *          false if nobody is listening
+ */
+static bool EventNodePush(event_list_node *tmp, afb_data_t payload)
+{
+    struct timespec start, end;
+    int pushed;
+
+    bool traced = GPS_TRACE_ACTIVE(event_push);
+    if (traced)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (tmp->flow) {
+        pushed = EventFlowPush(tmp->flow, tmp->event, payload);
+    }
+    else {
+        afb_data_t data = afb_data_addref(payload);
+        pushed = afb_event_push(tmp->event, 1, &data);
+    }
+
+    if (traced) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        GPS_TRACE(event_push, afb_event_name(tmp->event),
+                  TimespecToNs(&end) - TimespecToNs(&start), pushed != 0);
+    }
+
+    if (pushed != 0) {
+        // Event well pushed
+        if (tmp->not_used_count)
+            tmp->not_used_count = 0;
+        return true;
+    }
+
+    if (!tmp->is_protected) {
+        // If an unprotected event is not used anymore, delete it
+        tmp->not_used_count++;
+        if (tmp->not_used_count >= EVENT_MAX_NOT_USED)
+            EventNodeExpire(tmp, __atomic_load_n(&tmp->subscribers, __ATOMIC_ACQUIRE));
+    }
+    return false;
+}
+
+/* Function:  GpsTrackPointFromData
+ * ---------------------------------
+ * Get the fix GPSd just sent in the form it is stored.
+ * GpsDataMutex must be held by the caller.
+ *
+ * point : receives the fix
+ *
+ * returns: nothing
+ */
+static void GpsTrackPointFromData(gps_track_point_t *point)
+{
+    point->time = GpsFixTimestamp(&data);
+    point->latitude = data.fix.latitude;
+    point->longitude = data.fix.longitude;
+    point->altitude = data.fix.mode == MODE_3D ? data.fix.altitude : NAN;
+    point->speed = data.fix.speed;
+}
+
+/* Function:  GpsFixUpdate
+ * -----------------------
+ * Keep a copy of the fix GPSd just sent.
+ * GpsDataMutex must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void GpsFixUpdate()
+{
+    gps_fix_snapshot_t *fix = &gps_last_fix;
+
+    fix->seq = gps_fix_seq;
+    fix->mode = data.fix.mode;
+    fix->satellites_visible = data.satellites_visible;
+    fix->satellites_used = data.satellites_used;
+    fix->time = GpsFixTimestamp(&data);
+    fix->latitude = data.fix.latitude;
+    fix->longitude = data.fix.longitude;
+    fix->altitude = data.fix.mode == MODE_3D ? data.fix.altitude : NAN;
+    fix->speed = data.fix.speed;
+    fix->climb = data.fix.mode == MODE_3D ? data.fix.climb : NAN;
+    fix->track = data.fix.track;
+    fix->epx = data.fix.epx;
+    fix->epy = data.fix.epy;
+    fix->epv = data.fix.epv;
+    fix->eps = data.fix.eps;
+    fix->epc = data.fix.epc;
+    fix->epd = data.fix.epd;
+    fix->ept = data.fix.ept;
+    GpsClockGetTime(&gps_last_fix_time);
+}
+
+/* Function:  GpsFixSnapshot
+ * -------------------------
+ * Copy the latest fix, telling whether it is stale.
+ * GpsDataMutex must be held by the caller.
+ *
+ * fix : where to store the copy
+ *
+ * returns: nothing
+ */
+static void GpsFixSnapshot(gps_fix_snapshot_t *fix)
+{
+    struct timespec now;
+
+    *fix = gps_last_fix;
+    GpsClockGetTime(&now);
+    long age_us = TimespecDiffUs(&gps_last_fix_time, &now);
+    fix->age = age_us / 1000000.0;
+    fix->stale = !gpsd_online || age_us > MSECS_TO_USECS(GPS_FIX_STALE_MS);
+}
+
+/* Function:  ExpressionIsDue
+ * --------------------------
+ * Evaluate an expression event against a new fix.
+ * The event is due once the expression has been true for
+ * the debounce time, and then only once until it has been
+ * false for the hysteresis time.
+ *
+ * node : expression event
+ * fix : new fix
+ *
+ * returns: true if the event has to be pushed
+ */
+static bool ExpressionIsDue(event_list_node *node, const gps_fix_snapshot_t *fix)
+{
+    gps_expr_t *expr = node->condition_value.expression.expr;
+    typeof(node->last_value.expression) *state = &node->last_value.expression;
+
+    // delta() is relative to the first fix until the first push
+    if (!state->refs_valid) {
+        GpsExprCapture(expr, fix, state->refs);
+        state->refs_valid = true;
+        state->since = fix->time;
+    }
+
+    bool value = GpsExprEval(expr, fix, state->refs);
+    if (value != state->state) {
+        state->state = value;
+        state->since = fix->time;
+    }
+
+    double held_ms = (fix->time - state->since) * 1000;
+    if (value)
+        return !state->fired && held_ms >= node->condition_value.expression.debounce;
+
+    if (state->fired && held_ms >= node->condition_value.expression.hysteresis)
+        state->fired = false;
+    return false;
+}
+
+/* Function:  AdaptiveIsDue
+ * ------------------------
+ * Evaluate an adaptive event against a new fix: due after the
+ * distance has been traveled or the heading has changed enough,
+ * but not before the min interval, and anyway after the max one.
+ * The intervals are measured on the fix time.
+ *
+ * node : adaptive event
+ * fix : new fix
+ * distance : distance from the position of the last push, in m
+ *
+ * returns: true if the event has to be pushed
+ */
+static bool AdaptiveIsDue(const event_list_node *node,
+                          const gps_fix_snapshot_t *fix,
+                          double distance)
+{
+    const typeof(node->condition_value.adaptive) *adaptive = &node->condition_value.adaptive;
+    const typeof(node->last_value.adaptive) *last = &node->last_value.adaptive;
+
+    if (!last->pushed)
+        return true;
+
+    double elapsed_ms = (fix->time - last->time) * 1000;
+    if (adaptive->max_interval && elapsed_ms >= adaptive->max_interval)
+        return true;
+    if (elapsed_ms < adaptive->min_interval)
+        return false;
+
+    if (distance >= adaptive->distance)
+        return true;
+    // A NaN heading (not moving) never counts as a change
+    return adaptive->heading &&
+           fabs(remainder(fix->track - last->track, 360.0)) >= adaptive->heading;
+}
+
+/* Function:  GpsdWatchFlags
+ * -------------------------
+ * Compute the WATCH flags to send to GPSd.
+ * Only JSON reports are requested: no NMEA, raw or timing reports
+ * as none of them is consumed, PPS only if someone listens to them.
+ *
+ * returns: flags to use with gps_stream
+ */
+static unsigned int GpsdWatchFlags()
+{
+    unsigned int flags = WATCH_ENABLE | WATCH_JSON;
+
+    if (__atomic_load_n(&raw_class_mask, __ATOMIC_RELAXED) & (1u << REPORT_PPS))
+        flags |= WATCH_PPS;
+
+    return flags;
+}
+
+/* Function:  GpsdWatchUpdate
+ * --------------------------
+ * Update the streaming if the needed reports changed.
+ * GpsDataMutex must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void GpsdWatchUpdate()
+{
+    unsigned int flags = GpsdWatchFlags();
+
+    if (!gpsd_online || !gpsd_streaming || GpsReplayEnabled())
+        return;
+
+    if (flags != gpsd_watch_flags && gps_stream(&data, flags, NULL) == 0)
+        gpsd_watch_flags = flags;
+}
+
+/* Function:  GpsdRawMaskUpdate
+ * ----------------------------
+ * Start copying the lines of a raw class on subscription,
+ * stop once its last subscriber has unsubscribed.
+ * Both are decided under EventListMutex, so that the last
+ * (un)subscription wins.
+ *
+ * node : raw event
+ * subscribed : true after a subscription, false after an unsubscription
+ *
+ * returns: nothing
+ */
+static void GpsdRawMaskUpdate(event_list_node *node, bool subscribed)
+{
+    enum gpsd_report_class_enum raw_class = node->condition_value.raw_class;
+
+    pthread_mutex_lock(&EventListMutex);
+    if (subscribed) {
+        __atomic_add_fetch(&raw_generation[raw_class], 1, __ATOMIC_RELEASE);
+        __atomic_or_fetch(&raw_class_mask, 1u << raw_class, __ATOMIC_RELAXED);
+    }
+    else if (__atomic_load_n(&node->subscribers, __ATOMIC_ACQUIRE) <= 0) {
+        __atomic_and_fetch(&raw_class_mask, ~(1u << raw_class), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&EventListMutex);
+}
+
+/* Function:  GpsdStreamDemand
+ * ---------------------------
+ * Notify that someone needs gps data, resume the
+ * GPSd streaming if it was disabled for being idle,
+ * or update it if the needed reports changed.
+ * GpsDataMutex must be held by the caller.
+ *
+ * returns: true if streaming has just been resumed
+ *          false if it was already running (or GPSd is offline)
+ */
+static bool GpsdStreamDemand()
+{
+    unsigned int flags = GpsdWatchFlags();
+
+    GpsClockGetTime(&gpsd_last_demand);
+
+    // A replay has no GPSd socket to stream from
+    if (!gpsd_online || GpsReplayEnabled())
+        return false;
+
+    if (gpsd_streaming) {
+        GpsdWatchUpdate();
+        return false;
+    }
+
+    if (gps_stream(&data, flags, NULL) == -1) {
+        AFB_ERROR("Cannot resume GPSd streaming (errno: %d, \"%s\").", errno, gps_errstr(errno));
+        return false;
+    }
+
+    gpsd_streaming = true;
+    gpsd_watch_flags = flags;
+    gpsd_wake_pending = true;
+    gpsd_wake_time = gpsd_last_demand;
+    gpsd_stats.wake_count++;
+    AFB_INFO("GPSd streaming resumed");
+    return true;
+}
+
+/* Function:  GpsdWaitFreshFix
+ * ---------------------------
+ * Wait for the first fix received after a streaming resume,
+ * at most GPSD_WAKE_TIMEOUT_MS.
+ * GpsDataMutex must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void GpsdWaitFreshFix()
+{
+    long long deadline_ns = GpsClockNowNs() + GPSD_WAKE_TIMEOUT_MS * 1000000LL;
+
+    while (gpsd_wake_pending) {
+        if (GpsClockTimedWait(&GpsDataCond, &GpsDataMutex, deadline_ns) == ETIMEDOUT) {
+            AFB_WARNING("No fresh fix received %d ms after streaming resume",
+                        GPSD_WAKE_TIMEOUT_MS);
+            break;
+        }
+    }
+}
+
+/* Function:  GpsdStreamIdleCheck
+ * ------------------------------
+ * Disable the GPSd streaming when nobody has been listening
+ * for gpsd_idle_timeout seconds. The socket is kept open so
+ * that the streaming can be resumed by GpsdStreamDemand.
+ * Besides the events, the trip and POI subscribers, the shared
+ * memory segment and the track recording need the fixes.
+ *
+ * returns: nothing
+ */
+static void GpsdStreamIdleCheck()
+{
+    if (!gpsd_idle_timeout)
+        return;
+
+    event_list_node *iterator;
+    bool listening = __atomic_load_n(&raw_class_mask, __ATOMIC_RELAXED) != 0 ||
+                     TripListening() || GpsPoiListening() || GpsShmEnabled() ||
+                     GpsRecordEnabled();
+
+    // Raw events are never deleted, only their listeners matter,
+    // the other ones expire once nobody is subscribed anymore
+    if (!listening) {
+        pthread_mutex_lock(&EventListMutex);
+        cds_list_for_each_entry(iterator, &list->list_head, list_head)
+        {
+            if (iterator->condition_type != RAW_CLASS &&
+                __atomic_load_n(&iterator->subscribers, __ATOMIC_ACQUIRE) >= 0) {
+                listening = true;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&EventListMutex);
+    }
+
+    pthread_mutex_lock(&GpsDataMutex);
+    if (listening) {
+        GpsClockGetTime(&gpsd_last_demand);
+    }
+    else if (gpsd_streaming) {
+        struct timespec now;
+        GpsClockGetTime(&now);
+        if (TimespecDiffUs(&gpsd_last_demand, &now) >= (long)gpsd_idle_timeout * 1000000) {
+            gps_stream(&data, WATCH_DISABLE, NULL);
+            gpsd_streaming = false;
+            gpsd_stats.idle_count++;
+            AFB_INFO("Nobody listening for %u s, GPSd streaming disabled", gpsd_idle_timeout);
+        }
+    }
+    pthread_mutex_unlock(&GpsDataMutex);
+}
+
+/* Function:  GetGpsData
+ * ---------------------
+ * Callback for "gps-data" verb.
+ * It builds the gps date json structure and returns it.
+ *
+ * request : Request from the afb client.
+ *
+ * returns: nothing
+ * Error code 1 : the fix is not good enough to be reliable
+ */
+static void GetGpsData(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    gps_fix_snapshot_t fix;
+    gps_projected_t proj = {.done = 0};
+    unsigned int projections = 0;
+    afb_data_t payload = NULL;
+    afb_data_t result;
+
+    // Projected coordinates can be asked for
+    if (argc > 0 && afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) == 0) {
+        json_object *json_projection = NULL;
+        json_object_object_get_ex((json_object *)afb_data_ro_pointer(result), "projection",
+                                  &json_projection);
+        if (GpsProjMaskFromJson(json_projection, &projections) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Unsupported projection");
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&GpsDataMutex);
+    if (GpsdStreamDemand())
+        GpsdWaitFreshFix();
+    GpsFixSnapshot(&fix);
+    pthread_mutex_unlock(&GpsDataMutex);
+
+    if (fix.mode >= 2) {
+        GpsProjCompute(&fix, projections, &proj);
+        payload = GpsPayloadCreate(&fix, &proj, projections, 0);
+    }
+
+    if (payload) {
+        afb_req_reply(request, 0, 1, &payload);
+    }
+    else {
+        afb_req_reply_string(request, AFB_USER_ERRNO(1), "not enough data to be reliable\n");
+    }
+}
+
+/* Function:  Subscribe
+ * --------------------
+ * Callback for "subscribe" verb.
+ * Subscribe a client to a dynamic event.
+ * Create the asked event if not found in the event list.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void Subscribe(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+
+    if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             "failed to convert argument to JSON_C");
+        return;
+    }
+
+    json_object *json_request = (json_object *)afb_data_ro_pointer(result);
+    if (!json_request) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             "failed to get pointer to argument");
+        return;
+    }
+
+    event_list_node *event_to_subscribe;
+    json_object *json_condition = NULL;
+    json_object_object_get_ex(json_request, "condition", &json_condition);
+    bool is_private = json_object_object_get_ex(json_request, "window", NULL) ||
+                      !strcasecmp(json_object_get_string(json_condition) ?: "", "composite");
+    bool created = false;
+
+    if (!EventJsonToName(json_request, NULL, 0)) {
+        // Flow controlled and composite events are never shared
+        if (is_private || !EventListFind(json_request, true, &event_to_subscribe)) {
+            if (EventListAdd(json_request, false, &event_to_subscribe, request)) {
+                afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Event creation failed");
+                return;
+            }
+            created = true;
+        }
+
+        if (afb_req_subscribe(request, event_to_subscribe->event) == 0) {
+            GPS_TRACE(subscribe, afb_event_name(event_to_subscribe->event), (int)created,
+                      (int)is_private);
+            if (event_to_subscribe->condition_type == RAW_CLASS)
+                GpsdRawMaskUpdate(event_to_subscribe, true);
+            pthread_mutex_lock(&GpsDataMutex);
+            GpsdStreamDemand();
+            pthread_mutex_unlock(&GpsDataMutex);
+            if (event_to_subscribe->stream) {
+                // The stream id is needed to acknowledge and unsubscribe
+                json_object *JsonStream = json_object_new_object();
+                json_object_object_add(JsonStream, "stream",
+                                       json_object_new_int64(event_to_subscribe->stream));
+                if (event_to_subscribe->flow)
+                    json_object_object_add(JsonStream, "window",
+                                           json_object_new_int(event_to_subscribe->flow->window));
+                json_object_object_add(JsonStream, "event",
+                                       json_object_new_string(
+                                           afb_event_name(event_to_subscribe->event)));
+                afb_req_reply_json_c_hold(request, 0, JsonStream);
+            }
+            else {
+                afb_data_addref(result);
+                afb_req_reply(request, 0, 1, &result);
+            }
+        }
+
+        else {
+            EventNodeRelease(event_to_subscribe);
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Subscription error");
+        }
+    }
+    else
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             "Request isn't well formated, please see readme");
+
+    return;
+}
+
+/* Function:  Unsubscribe
+ * ----------------------
+ * Callback for "unsubscribe" verb.
+ * Unsubscribe a client to a dynamic event.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void Unsubscribe(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+
+    if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             "failed to convert argument to JSON_C");
+        return;
+    }
+
+    json_object *json_request = (json_object *)afb_data_ro_pointer(result);
+    if (!json_request) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             "failed to get pointer to argument");
+        return;
+    }
+    event_list_node *event_to_unsubscribe;
+    json_object *json_stream;
+
+    // Private events: for flow controlled ones, drop what is pending and give the
+    // credits back, so that the next pushes find out nobody is listening anymore
+    if (json_object_object_get_ex(json_request, "stream", &json_stream)) {
+        int ret = -1;
+        if (!json_object_is_type(json_stream, json_type_int)) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Request isn't well formated");
+            return;
+        }
+        unsigned int owner = EventSessionId(request);
+        pthread_mutex_lock(&EventListMutex);
+        event_to_unsubscribe = EventListFindStream(json_object_get_int(json_stream), owner);
+        if (event_to_unsubscribe) {
+            event_flow_t *flow = event_to_unsubscribe->flow;
+            ret = afb_req_unsubscribe(request, event_to_unsubscribe->event);
+            if (ret == 0) {
+                GPS_TRACE(unsubscribe, afb_event_name(event_to_unsubscribe->event));
+                EventNodeRelease(event_to_unsubscribe);
+            }
+            if (flow) {
+                pthread_mutex_lock(&flow->mutex);
+                flow->outstanding = 0;
+                if (flow->pending) {
+                    afb_data_unref(flow->pending);
+                    flow->pending = NULL;
+                    __atomic_add_fetch(&flow_totals.dropped, 1, __ATOMIC_RELAXED);
+                }
+                pthread_mutex_unlock(&flow->mutex);
+            }
+        }
+        pthread_mutex_unlock(&EventListMutex);
+
+        if (ret == 0) {
+            afb_data_addref(result);
+            afb_req_reply(request, 0, 1, &result);
+        }
+        else
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Stream does not exist");
+        return;
+    }
+
+    if (!EventJsonToName(json_request, NULL, 0)) {
+        if (EventListFind(json_request, false, &event_to_unsubscribe)) {
+            // Event was found in list
+            if (afb_req_unsubscribe(request, event_to_unsubscribe->event) == 0) {
+                // Unsubscribe successfully, keep the event until the next dispatch round
+                GPS_TRACE(unsubscribe, afb_event_name(event_to_unsubscribe->event));
+                EventNodeRelease(event_to_unsubscribe);
+                if (event_to_unsubscribe->condition_type == RAW_CLASS) {
+                    GpsdRawMaskUpdate(event_to_unsubscribe, false);
+                    pthread_mutex_lock(&GpsDataMutex);
+                    GpsdWatchUpdate();
+                    pthread_mutex_unlock(&GpsDataMutex);
+                }
+
+                afb_data_addref(result);
+                afb_req_reply(request, 0, 1, &result);
+            }
+            else
+                afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Unsubscription error");
+        }
+        else
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Event does not exist");
+    }
+    else
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Request isn't well formated");
+
+    return;
+}
+
+/* Function:  EventFlowToJson
+ * --------------------------
+ * Marshal the delivery counters of a flow controlled event.
+ * The flow mutex must be held by the caller.
+ *
+ * returns: Json object containing the counters
+ */
+static json_object *EventFlowToJson(event_list_node *node)
+{
+    event_flow_t *flow = node->flow;
+    json_object *JsonFlow = json_object_new_object();
+
+    json_object_object_add(JsonFlow, "stream", json_object_new_int64(node->stream));
+    json_object_object_add(JsonFlow, "event", json_object_new_string(afb_event_name(node->event)));
+    json_object_object_add(JsonFlow, "window", json_object_new_int(flow->window));
+    json_object_object_add(JsonFlow, "outstanding", json_object_new_int(flow->outstanding));
+    json_object_object_add(JsonFlow, "pending", json_object_new_boolean(flow->pending != NULL));
+    json_object_object_add(JsonFlow, "pushed", json_object_new_int64(flow->pushed));
+    json_object_object_add(JsonFlow, "conflated", json_object_new_int64(flow->conflated));
+    json_object_object_add(JsonFlow, "resets", json_object_new_int64(flow->resets));
+
+    return JsonFlow;
+}
+
+/* Function:  Ack
+ * --------------
+ * Callback for "ack" verb.
+ * Acknowledge events received on a flow controlled stream,
+ * giving back as many credits. The pending payload, if any,
+ * is sent right away.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void Ack(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+    json_object *json_value;
+    int count = 1;
+
+    if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             "failed to convert argument to JSON_C");
+        return;
+    }
+
+    json_object *json_request = (json_object *)afb_data_ro_pointer(result);
+    if (!json_object_object_get_ex(json_request, "stream", &json_value) ||
+        !json_object_is_type(json_value, json_type_int)) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Request isn't well formated");
+        return;
+    }
+    unsigned int id = json_object_get_int(json_value);
+
+    if (json_object_object_get_ex(json_request, "count", &json_value)) {
+        if (json_object_is_type(json_value, json_type_int))
+            count = json_object_get_int(json_value);
+        else
+            count = 0;
+        if (count < 1) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid count");
+            return;
+        }
+    }
+
+    // Pinned, the event is not deleted meanwhile, even if it expires,
+    // without keeping the list locked
+    unsigned int owner = EventSessionId(request);
+    pthread_mutex_lock(&EventListMutex);
+    event_list_node *node = EventListFindStream(id, owner);
+    const char *error = NULL;
+    if (!node || __atomic_load_n(&node->subscribers, __ATOMIC_ACQUIRE) < 0)
+        error = "Stream does not exist";
+    else if (!node->flow)
+        error = "Stream is not flow controlled";
+    else
+        __atomic_add_fetch(&node->pins, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&EventListMutex);
+    if (error) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, error);
+        return;
+    }
+
+    event_flow_t *flow = node->flow;
+    pthread_mutex_lock(&flow->mutex);
+    flow->outstanding = count < flow->outstanding ? flow->outstanding - count : 0;
+    GpsClockGetTime(&flow->last_ack);
+
+    // Pushed unlocked, newer payloads being conflated meanwhile to keep the order
+    while (flow->pending && flow->outstanding < flow->window && !flow->sending) {
+        afb_data_t pending = flow->pending;
+        flow->pending = NULL;
+        flow->sending = true;
+        pthread_mutex_unlock(&flow->mutex);
+        int ret = afb_event_push(node->event, 1, &pending);
+        pthread_mutex_lock(&flow->mutex);
+        flow->sending = false;
+        if (EventFlowSent(flow, ret) <= 0)
+            break;
+    }
+    json_object *JsonFlow = EventFlowToJson(node);
+    pthread_mutex_unlock(&flow->mutex);
+    __atomic_sub_fetch(&node->pins, 1, __ATOMIC_RELEASE);
+
+    afb_req_reply_json_c_hold(request, 0, JsonFlow);
+}
+
+/* Function:  GetStats
+ * --------------------
+ * Callback for "stats" verb.
+ * Report the GPSd streaming state and the delivery counters.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void GetStats(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    json_object *JsonStats = json_object_new_object();
+
+    pthread_mutex_lock(&GpsDataMutex);
+    json_object_object_add(JsonStats, "online", json_object_new_boolean(gpsd_online));
+    json_object_object_add(JsonStats, "streaming", json_object_new_boolean(gpsd_streaming));
+    json_object_object_add(JsonStats, "fixes", json_object_new_int64(gps_fix_seq));
+    json_object_object_add(JsonStats, "idle timeout", json_object_new_int(gpsd_idle_timeout));
+    json_object_object_add(JsonStats, "idle count", json_object_new_int(gpsd_stats.idle_count));
+    json_object_object_add(JsonStats, "wake count", json_object_new_int(gpsd_stats.wake_count));
+    json_object_object_add(JsonStats, "last wake latency",
+                           json_object_new_double(gpsd_stats.last_wake_latency_us / 1000.0));
+    json_object_object_add(JsonStats, "max wake latency",
+                           json_object_new_double(gpsd_stats.max_wake_latency_us / 1000.0));
+    json_object_object_add(JsonStats, "reconnect count",
+                           json_object_new_int(gpsd_stats.reconnect_count));
+    json_object_object_add(JsonStats, "last reconnect time",
+                           json_object_new_double(gpsd_stats.last_reconnect_us / 1000.0));
+    json_object_object_add(JsonStats, "max reconnect time",
+                           json_object_new_double(gpsd_stats.max_reconnect_us / 1000.0));
+    pthread_mutex_unlock(&GpsDataMutex);
+
+    // Delivery of the flow controlled events
+    event_list_node *iterator;
+    json_object *JsonStreams = json_object_new_array();
+    pthread_mutex_lock(&EventListMutex);
+    cds_list_for_each_entry(iterator, &list->list_head, list_head)
+    {
+        if (!iterator->flow)
+            continue;
+        pthread_mutex_lock(&iterator->flow->mutex);
+        json_object_array_add(JsonStreams, EventFlowToJson(iterator));
+        pthread_mutex_unlock(&iterator->flow->mutex);
+    }
+    pthread_mutex_unlock(&EventListMutex);
+    json_object_object_add(JsonStats, "streams", JsonStreams);
+    json_object_object_add(
+        JsonStats, "conflated",
+        json_object_new_int64(__atomic_load_n(&flow_totals.conflated, __ATOMIC_RELAXED)));
+    json_object_object_add(
+        JsonStats, "dropped",
+        json_object_new_int64(__atomic_load_n(&flow_totals.dropped, __ATOMIC_RELAXED)));
+    json_object_object_add(
+        JsonStats, "credit resets",
+        json_object_new_int64(__atomic_load_n(&flow_totals.resets, __ATOMIC_RELAXED)));
+    json_object_object_add(
+        JsonStats, "composite pushes",
+        json_object_new_int64(__atomic_load_n(&composite_totals.pushes, __ATOMIC_RELAXED)));
+    json_object_object_add(
+        JsonStats, "composite triggered",
+        json_object_new_int64(__atomic_load_n(&composite_totals.triggered, __ATOMIC_RELAXED)));
+    json_object_object_add(JsonStats, "rt", GpsRtToJson());
+    json_object_object_add(JsonStats, "history", GpsHistoryToJson());
+    json_object_object_add(JsonStats, "record", GpsRecordToJson());
+    json_object_object_add(JsonStats, "export", GpsExportToJson());
+    json_object_object_add(JsonStats, "poi", GpsPoiToJson());
+    json_object_object_add(JsonStats, "replay", GpsReplayToJson());
+
+    unsigned long rounds = __atomic_load_n(&dispatch_stats.rounds, __ATOMIC_RELAXED);
+    long long busy_ns = __atomic_load_n(&dispatch_stats.busy_ns, __ATOMIC_RELAXED);
+    json_object *JsonDispatch = json_object_new_object();
+    json_object_object_add(JsonDispatch, "threads", json_object_new_int(dispatch_threads));
+    json_object_object_add(JsonDispatch, "rounds", json_object_new_int64(rounds));
+    json_object_object_add(JsonDispatch, "mean round time",
+                           json_object_new_double(rounds ? busy_ns / 1e6 / rounds : 0.0));
+    json_object_object_add(
+        JsonDispatch, "max round time",
+        json_object_new_double(
+            __atomic_load_n(&dispatch_stats.max_round_ns, __ATOMIC_RELAXED) / 1e6));
+    json_object_object_add(JsonStats, "dispatch", JsonDispatch);
+
+    afb_req_reply_json_c_hold(request, 0, JsonStats);
+}
+
+/* Function:  Trip
+ * ----------------
+ * Callback for "trip" verb.
+ * Get, (re)start, delete or (un)subscribe to trip statistics.
+ * Without name nor action, returns all the trips.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void Trip(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+    json_object *json_request = NULL;
+    json_object *json_name = NULL;
+    json_object *json_action = NULL;
+
+    if (argc > 0) {
+        if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                                 "failed to convert argument to JSON_C");
+            return;
+        }
+        json_request = (json_object *)afb_data_ro_pointer(result);
+    }
+
+    bool has_name = json_object_object_get_ex(json_request, "name", &json_name);
+    bool has_action = json_object_object_get_ex(json_request, "action", &json_action);
+    if (!has_name && !has_action) {
+        afb_req_reply_json_c_hold(request, 0, TripGet(NULL));
+        return;
+    }
+
+    if ((has_name && !json_object_is_type(json_name, json_type_string)) ||
+        (has_action && !json_object_is_type(json_action, json_type_string))) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Request isn't well formated");
+        return;
+    }
+
+    const char *name = json_name ? json_object_get_string(json_name) : TRIP_DEFAULT_NAME;
+    const char *action = json_action ? json_object_get_string(json_action) : "get";
+
+    if (!TripNameValid(name)) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid name");
+        return;
+    }
+
+    if (!strcasecmp(action, "start")) {
+        if (TripStart(name) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Trip creation failed");
+            return;
+        }
+    }
+    else if (!strcasecmp(action, "reset")) {
+        if (!TripReset(name)) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Trip does not exist");
+            return;
+        }
+    }
+    else if (!strcasecmp(action, "delete")) {
+        if (!TripDelete(name))
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Trip does not exist");
+        else
+            afb_req_reply(request, 0, 0, NULL);
+        return;
+    }
+    else if (!strcasecmp(action, "subscribe") || !strcasecmp(action, "unsubscribe")) {
+        if (TripSubscribe(request, name, !strcasecmp(action, "subscribe")) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Subscription error");
+            return;
+        }
+        pthread_mutex_lock(&GpsDataMutex);
+        GpsdStreamDemand();
+        pthread_mutex_unlock(&GpsDataMutex);
+    }
+    else if (strcasecmp(action, "get")) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Unsupported action");
+        return;
+    }
+
+    json_object *JsonTrip = TripGet(name);
+    if (JsonTrip)
+        afb_req_reply_json_c_hold(request, 0, JsonTrip);
+    else
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Trip does not exist");
+}
+
+/* Function:  EnuOrigin
+ * --------------------
+ * Callback for "enu-origin" verb.
+ * Get the origin of the ENU frame, or move it to the given
+ * position or to the latest fix.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void EnuOrigin(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+    json_object *json_request = NULL;
+    json_object *json_current = NULL;
+    json_object *json_latitude = NULL;
+    json_object *json_longitude = NULL;
+    json_object *json_altitude = NULL;
+
+    if (argc > 0) {
+        if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                                 "failed to convert argument to JSON_C");
+            return;
+        }
+        json_request = (json_object *)afb_data_ro_pointer(result);
+    }
+
+    json_object_object_get_ex(json_request, "current", &json_current);
+    json_object_object_get_ex(json_request, "latitude", &json_latitude);
+    json_object_object_get_ex(json_request, "longitude", &json_longitude);
+    json_object_object_get_ex(json_request, "altitude", &json_altitude);
+
+    if (json_object_get_boolean(json_current)) {
+        gps_fix_snapshot_t fix;
+        pthread_mutex_lock(&GpsDataMutex);
+        GpsFixSnapshot(&fix);
+        pthread_mutex_unlock(&GpsDataMutex);
+
+        if (fix.mode < 2) {
+            afb_req_reply_string(request, AFB_USER_ERRNO(1), "not enough data to be reliable\n");
+            return;
+        }
+        GpsProjSetOrigin(fix.latitude, fix.longitude, isnan(fix.altitude) ? 0 : fix.altitude);
+    }
+    else if (json_latitude || json_longitude) {
+        if (!json_object_is_type(json_latitude, json_type_double) &&
+            !json_object_is_type(json_latitude, json_type_int)) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid latitude");
+            return;
+        }
+        if (!json_object_is_type(json_longitude, json_type_double) &&
+            !json_object_is_type(json_longitude, json_type_int)) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid longitude");
+            return;
+        }
+        if (GpsProjSetOrigin(json_object_get_double(json_latitude),
+                             json_object_get_double(json_longitude),
+                             json_altitude ? json_object_get_double(json_altitude) : 0) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Origin out of range");
+            return;
+        }
+    }
+
+    afb_req_reply_json_c_hold(request, 0, GpsProjOriginToJson());
+}
+
+/* Function:  JsonGetNumber
+ * ------------------------
+ * Read an optional number member of a request.
+ *
+ * json : request
+ * key : name of the member
+ * value : receives the number, left untouched if absent
+ *
+ * returns: -1 if not a number
+ *          0 if absent
+ *          1 if read
+ */
+static int JsonGetNumber(json_object *json, const char *key, double *value)
+{
+    json_object *json_value = NULL;
+
+    if (!json_object_object_get_ex(json, key, &json_value))
+        return 0;
+    if (!json_object_is_type(json_value, json_type_double) &&
+        !json_object_is_type(json_value, json_type_int))
+        return -1;
+    *value = json_object_get_double(json_value);
+    return 1;
+}
+
+/* Function:  History
+ * -------------------
+ * Callback for "history" verb.
+ * Get the recorded fixes of a time window, optionally only those
+ * within a radius or a bounding box, and simplified.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void History(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+    json_object *json_request = NULL;
+    json_object *json_bbox = NULL;
+    gps_history_query_t query = {.start = -INFINITY, .end = INFINITY};
+    int has_latitude, has_longitude, has_radius;
+    size_t i;
+
+    if (argc > 0) {
+        if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                                 "failed to convert argument to JSON_C");
+            return;
+        }
+        json_request = (json_object *)afb_data_ro_pointer(result);
+    }
+
+    if (JsonGetNumber(json_request, "start", &query.start) < 0 ||
+        JsonGetNumber(json_request, "end", &query.end) < 0 ||
+        JsonGetNumber(json_request, "last", &query.last) < 0 || query.last < 0) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid time window");
+        return;
+    }
+
+    has_latitude = JsonGetNumber(json_request, "latitude", &query.latitude);
+    has_longitude = JsonGetNumber(json_request, "longitude", &query.longitude);
+    has_radius = JsonGetNumber(json_request, "radius", &query.radius);
+    if (has_latitude || has_longitude || has_radius) {
+        if (has_latitude != 1 || has_longitude != 1 || has_radius != 1 ||
+            fabs(query.latitude) > 90 || fabs(query.longitude) > 180 || !(query.radius > 0)) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid radius");
+            return;
+        }
+        query.area = HISTORY_AREA_RADIUS;
+    }
+
+    if (json_object_object_get_ex(json_request, "bbox", &json_bbox)) {
+        double bbox[4];
+        bool valid = query.area == HISTORY_AREA_NONE &&
+                     json_object_is_type(json_bbox, json_type_array) &&
+                     json_object_array_length(json_bbox) == 4;
+        for (i = 0; valid && i < 4; i++) {
+            json_object *json_value = json_object_array_get_idx(json_bbox, i);
+            valid = json_object_is_type(json_value, json_type_double) ||
+                    json_object_is_type(json_value, json_type_int);
+            bbox[i] = json_object_get_double(json_value);
+        }
+        // [south, west, north, east], west > east crossing the antimeridian
+        if (!valid || bbox[0] > bbox[2] || fabs(bbox[0]) > 90 || fabs(bbox[2]) > 90 ||
+            fabs(bbox[1]) > 180 || fabs(bbox[3]) > 180) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid bounding box");
+            return;
+        }
+        query.south = bbox[0];
+        query.west = bbox[1];
+        query.north = bbox[2];
+        query.east = bbox[3];
+        query.area = HISTORY_AREA_BBOX;
+    }
+
+    if (JsonGetNumber(json_request, "tolerance", &query.tolerance) < 0 || query.tolerance < 0) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid tolerance");
+        return;
+    }
+
+    // Querying the history is a demand for it to be fed
+    pthread_mutex_lock(&GpsDataMutex);
+    GpsdStreamDemand();
+    pthread_mutex_unlock(&GpsDataMutex);
+
+    json_object *JsonHistory = GpsHistoryQuery(&query);
+    if (JsonHistory)
+        afb_req_reply_json_c_hold(request, 0, JsonHistory);
+    else
+        afb_req_reply_string(request, AFB_ERRNO_INTERNAL_ERROR, "History query failed");
+}
+
+/* Function:  Export
+ * -----------------
+ * Callback for "export" verb.
+ * Replies a page of a GPX or GeoJSON document of the stored fixes,
+ * with the cursor of the next page.
+ *
+ * request : format, source, time window, cursor and page size
+ *
+ * returns: nothing
+ */
+static void Export(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+    json_object *json_request = NULL;
+    json_object *json_value = NULL;
+    gps_export_query_t query = {
+        .start = -INFINITY, .end = INFINITY, .limit = GPS_EXPORT_DEFAULT_LIMIT};
+    json_object *JsonPage = NULL;
+    double limit = query.limit;
+
+    if (argc > 0) {
+        if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                                 "failed to convert argument to JSON_C");
+            return;
+        }
+        json_request = (json_object *)afb_data_ro_pointer(result);
+    }
+
+    if (json_object_object_get_ex(json_request, "format", &json_value)) {
+        // Anything but a string is invalid, null included
+        const char *format = "";
+        if (json_object_is_type(json_value, json_type_string))
+            format = json_object_get_string(json_value);
+        if (!strcasecmp(format, "gpx"))
+            query.format = EXPORT_FORMAT_GPX;
+        else if (!strcasecmp(format, "geojson"))
+            query.format = EXPORT_FORMAT_GEOJSON;
+        else {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid format");
+            return;
+        }
+    }
+
+    if (json_object_object_get_ex(json_request, "source", &json_value)) {
+        // Anything but a string is invalid, null included
+        const char *source = "";
+        if (json_object_is_type(json_value, json_type_string))
+            source = json_object_get_string(json_value);
+        if (!strcasecmp(source, "history"))
+            query.source = EXPORT_SOURCE_HISTORY;
+        else if (!strcasecmp(source, "record"))
+            query.source = EXPORT_SOURCE_RECORD;
+        else {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid source");
+            return;
+        }
+    }
+    if (query.source == EXPORT_SOURCE_RECORD && !GpsRecordEnabled()) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Recording is disabled");
+        return;
+    }
+
+    if (JsonGetNumber(json_request, "start", &query.start) < 0 ||
+        JsonGetNumber(json_request, "end", &query.end) < 0 || query.start > query.end) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid time window");
+        return;
+    }
+
+    if (JsonGetNumber(json_request, "limit", &limit) < 0 || limit < 1 ||
+        limit > GPS_EXPORT_MAX_LIMIT) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid limit");
+        return;
+    }
+    query.limit = (unsigned int)limit;
+
+    if (json_object_object_get_ex(json_request, "cursor", &json_value)) {
+        if (!json_object_is_type(json_value, json_type_int) ||
+            json_object_get_int64(json_value) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid cursor");
+            return;
+        }
+        query.cursor = json_object_get_int64(json_value);
+        query.resume = true;
+    }
+
+    int ret = GpsExportPage(&query, &JsonPage);
+    if (ret == 0)
+        afb_req_reply_json_c_hold(request, 0, JsonPage);
+    else if (ret == -1)
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             query.resume ? "Invalid or expired cursor" : "Cannot read the track");
+    else
+        afb_req_reply_string(request, AFB_ERRNO_INTERNAL_ERROR, "Export failed");
+}
+
+/* Function:  Nearest
+ * ------------------
+ * Callback for "nearest" verb.
+ * Get the nearest POIs of a position, or of the latest fix by default,
+ * (un)subscribe to the changes of the nearest POI, or reload the POI file.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void Nearest(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+    json_object *json_request = NULL;
+    json_object *json_action = NULL;
+    double latitude = NAN, longitude = NAN, radius = INFINITY, count = 1;
+    int has_latitude, has_longitude;
+
+    if (argc > 0) {
+        if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                                 "failed to convert argument to JSON_C");
+            return;
+        }
+        json_request = (json_object *)afb_data_ro_pointer(result);
+    }
+
+    if (JsonGetNumber(json_request, "radius", &radius) < 0 || !(radius > 0)) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid radius");
+        return;
+    }
+
+    if (json_object_object_get_ex(json_request, "action", &json_action)) {
+        const char *action = "";
+        if (json_object_is_type(json_action, json_type_string))
+            action = json_object_get_string(json_action);
+        if (!strcasecmp(action, "reload")) {
+            if (GpsPoiReload() < 0)
+                afb_req_reply_string(request, AFB_ERRNO_INTERNAL_ERROR,
+                                     "POI file could not be loaded");
+            else
+                afb_req_reply_json_c_hold(request, 0, GpsPoiToJson());
+        }
+        else if (!strcasecmp(action, "subscribe") || !strcasecmp(action, "unsubscribe")) {
+            // One event per radius, shared by its subscribers
+            if (radius < 1 || radius > GPS_POI_MAX_RADIUS ||
+                GpsPoiSubscribe(request, (int)radius, !strcasecmp(action, "subscribe")) < 0) {
+                afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Subscription error");
+                return;
+            }
+            pthread_mutex_lock(&GpsDataMutex);
+            GpsdStreamDemand();
+            pthread_mutex_unlock(&GpsDataMutex);
+            afb_req_reply(request, 0, 0, NULL);
+        }
+        else {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid action");
+        }
+        return;
+    }
+
+    has_latitude = JsonGetNumber(json_request, "latitude", &latitude);
+    has_longitude = JsonGetNumber(json_request, "longitude", &longitude);
+    if (has_latitude || has_longitude) {
+        if (has_latitude != 1 || has_longitude != 1 || fabs(latitude) > 90 ||
+            fabs(longitude) > 180) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid position");
+            return;
+        }
+    }
+    else {
+        gps_fix_snapshot_t fix;
+        pthread_mutex_lock(&GpsDataMutex);
+        GpsFixSnapshot(&fix);
+        pthread_mutex_unlock(&GpsDataMutex);
+
+        if (fix.mode < 2) {
+            afb_req_reply_string(request, AFB_USER_ERRNO(1), "not enough data to be reliable\n");
+            return;
+        }
+        latitude = fix.latitude;
+        longitude = fix.longitude;
+    }
+
+    if (JsonGetNumber(json_request, "count", &count) < 0 || count < 1 ||
+        count > GPS_POI_MAX_NEAREST) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Invalid count");
+        return;
+    }
+
+    json_object *JsonNearest = json_object_new_object();
+    json_object_object_add(JsonNearest, "pois",
+                           GpsPoiNearest(latitude, longitude, radius, (unsigned int)count));
+    afb_req_reply_json_c_hold(request, 0, JsonNearest);
+}
+
+/* Function:  Replay
+ * -----------------
+ * Callback for "replay" verb.
+ * Get the state of the NMEA log replay, or start it.
+ *
+ * request : Request from the client
+ *
+ * returns: nothing
+ */
+static void Replay(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    afb_data_t result;
+    json_object *json_request = NULL;
+    json_object *json_action = NULL;
+
+    if (argc > 0) {
+        if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                                 "failed to convert argument to JSON_C");
+            return;
+        }
+        json_request = (json_object *)afb_data_ro_pointer(result);
+    }
+
+    if (json_object_object_get_ex(json_request, "action", &json_action)) {
+        if (!json_object_is_type(json_action, json_type_string) ||
+            strcasecmp(json_object_get_string(json_action), "start")) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Unsupported action");
+            return;
+        }
+        if (GpsReplayStart() < 0) {
+            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                                 GpsReplayEnabled() ? "Replay already started"
+                                                    : "Replay is disabled");
+            return;
+        }
+    }
+
+    afb_req_reply_json_c_hold(request, 0, GpsReplayToJson());
+}
+
+extern const char *info_verbS;
+
+/* Function:  infoVerb
+ * ----------------------
+ * Callback for "infoVerb" verb.
+ *
+ * request :
+ *
+ * returns:
+ */
+static void infoVerb(afb_req_t request, unsigned argc, afb_data_t const argv[])
+{
+    enum json_tokener_error jerr;
+
+    json_object *infoArgsJ = json_tokener_parse_verbose(info_verbS, &jerr);
+    if (infoArgsJ == NULL || jerr != json_tokener_success) {
+        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
+                             "failure while packing info() verb arguments");
+        return;
+    }
+    afb_req_reply_json_c_hold(request, 0, infoArgsJ);
+
+    return;
+}
+
+/* Function:  GpsdRawAlloc
+ * ------------------------
+ * Get a buffer to read a raw GPSd line into.
+ * A pooled buffer is used if one is free.
+ *
+ * returns: a buffer of GPS_JSON_RESPONSE_MAX bytes, released by GpsdRawRelease
+ *          NULL if failed
+ */
+static char *GpsdRawAlloc()
+{
+    unsigned int i;
+
+    for (i = 0; i < GPSD_RAW_POOL_SIZE; i++) {
+        if (!__atomic_test_and_set(&gpsd_raw_pool[i].busy, __ATOMIC_ACQUIRE))
+            return gpsd_raw_pool[i].text;
+    }
+
+    // Every buffer is still held by the binder
+    GpsRtPoolMiss();
+    return malloc(GPS_JSON_RESPONSE_MAX);
+}
+
+/* Function:  GpsdRawRelease
+ * --------------------------
+ * Release a buffer got from GpsdRawAlloc,
+ * called by the binder once a raw report is not used anymore.
+ *
+ * returns: nothing
+ */
+static void GpsdRawRelease(void *closure)
+{
+    uintptr_t text = (uintptr_t)closure;
+    uintptr_t pool = (uintptr_t)gpsd_raw_pool;
+
+    if (text < pool || text >= pool + sizeof(gpsd_raw_pool)) {
+        free(closure);
+        return;
+    }
+    __atomic_clear(&gpsd_raw_pool[(text - pool) / sizeof(gpsd_raw_slot_t)].busy,
+                   __ATOMIC_RELEASE);
+}
+
+/* Function:  GpsdRawPush
+ * ----------------------
+ * Forward a raw GPSd report to the listeners of its class.
+ * The line is handed to afb as is, shared read-only by all
+ * the subscribers, and released once the last one is done.
+ * Only the "class" member, always sent first by GPSd, is looked at.
+ *
+ * message : JSON line as read from GPSd, from GpsdRawAlloc, ownership is taken
+ *
+ * returns: nothing
+ */
+static void GpsdRawPush(char *message)
+{
+    static const char prefix[] = "{\"class\":\"";
+    int raw_class = -1;
+    int i;
+
+    if (!strncmp(message, prefix, sizeof(prefix) - 1)) {
+        const char *name = message + sizeof(prefix) - 1;
+        for (i = 0; i < REPORT_CLASS_COUNT; i++) {
+            if (!strncmp(name, supported_raw_class[i], 3) && name[3] == '"') {
+                raw_class = i;
+                break;
+            }
+        }
+    }
+
+    if (raw_class < 0 ||
+        !(__atomic_load_n(&raw_class_mask, __ATOMIC_RELAXED) & (1u << raw_class))) {
+        GpsdRawRelease(message);
+        return;
+    }
+
+    // Strip the line ending in place
+    size_t len = strlen(message);
+    while (len > 0 && (message[len - 1] == '\n' || message[len - 1] == '\r'))
+        message[--len] = '\0';
+
+    afb_data_t raw;
+    if (afb_create_data_raw(&raw, AFB_PREDEFINED_TYPE_JSON, message, len + 1, GpsdRawRelease,
+                            message) < 0) {
+        AFB_ERROR("Cannot wrap raw %s report", supported_raw_class[raw_class]);
+        return;
+    }
+
+    unsigned int generation = __atomic_load_n(&raw_generation[raw_class], __ATOMIC_ACQUIRE);
+    if (afb_event_push(raw_nodes[raw_class]->event, 1, &raw) != 0)
+        return;
+
+    // Nobody listening anymore (clients may leave without unsubscribing),
+    // stop copying the lines of this class unless someone subscribed meanwhile
+    pthread_mutex_lock(&EventListMutex);
+    if (__atomic_load_n(&raw_generation[raw_class], __ATOMIC_ACQUIRE) == generation)
+        __atomic_and_fetch(&raw_class_mask, ~(1u << raw_class), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&EventListMutex);
+
+    pthread_mutex_lock(&GpsDataMutex);
+    GpsdWatchUpdate();
+    pthread_mutex_unlock(&GpsDataMutex);
+}
+
+/* Function:  GpsFixPublish
+ * ------------------------
+ * Publish the fix just read into data: to the dispatch thread,
+ * the shared memory and the trips.
+ * GpsDataMutex must be held by the caller.
+ *
+ * point : receives the fix, for GpsFixNotify
+ *
+ * returns: nothing
+ */
+static void GpsFixPublish(gps_track_point_t *point)
+{
+    gps_fix_seq++;
+    GpsFixUpdate();
+    GPS_TRACE(fix_published, gps_fix_seq, (long long)(gps_last_fix.time * 1000));
+    GpsShmPublish(&data);
+    TripUpdate(&data);
+    GpsTrackPointFromData(point);
+    dispatch_idle = false;
+    pthread_cond_broadcast(&GpsDataCond);
+}
+
+/* Function:  GpsFixNotify
+ * -----------------------
+ * Hand a published fix to the consumers that may block or
+ * wait for a lock, so must not be called with the gps data locked.
+ *
+ * point : the fix
+ *
+ * returns: nothing
+ */
+static void GpsFixNotify(const gps_track_point_t *point)
+{
+    GpsHistoryAppend(point);
+    TripPushChanged();
+    GpsRecordAppend(point);
+    GpsPoiUpdate(point->latitude, point->longitude);
+}
+
+/* Function:  GpsdPolling
+ * ----------------------
+ * Store gps data as long as the GPSd connection is sustainable.
+ *
+ * returns: nothing
+ */
+static void *GpsdPolling(void *ptr)
+{
+    int tries = 0;
+
+    while (tries < GPSD_POLLING_MAX_RETRIES) {
+        GpsdStreamIdleCheck();
+
+        if (!gps_waiting(&data, MSECS_TO_USECS(GPSD_POLLING_DELAY_MS))) {
+            // GPSd is silent on purpose while streaming is disabled
+            if (gpsd_streaming)
+                tries++;
+            continue;
+        }
+        // Only keep the raw line if someone is listening to raw reports
+        char *message = NULL;
+        if (__atomic_load_n(&raw_class_mask, __ATOMIC_RELAXED)) {
+            message = GpsdRawAlloc();
+            if (message)
+                message[0] = '\0';
+        }
+
+        gps_track_point_t point;
+        pthread_mutex_lock(&GpsDataMutex);
+        if (GPS_READ_MESSAGE(&data, message, message ? GPS_JSON_RESPONSE_MAX : 0) == -1) {
+            AFB_ERROR("Cannot read from GPS daemon (errno: %d, \"%s\").\n", errno,
+                      gps_errstr(errno));
+            pthread_mutex_unlock(&GpsDataMutex);
+            if (message)
+                GpsdRawRelease(message);
+            break;
+        }
+
+        bool new_fix = data.fix.mode >= MODE_2D && (data.set & LATLON_SET);
+        GPS_TRACE(gps_read, gps_fix_seq + new_fix, data.fix.mode, (int)new_fix);
+
+        if (new_fix)
+            GpsFixPublish(&point);
+
+        // First fix since streaming resume
+        if (gpsd_wake_pending && new_fix) {
+            struct timespec now;
+            GpsClockGetTime(&now);
+            gpsd_stats.last_wake_latency_us = TimespecDiffUs(&gpsd_wake_time, &now);
+            if (gpsd_stats.last_wake_latency_us > gpsd_stats.max_wake_latency_us)
+                gpsd_stats.max_wake_latency_us = gpsd_stats.last_wake_latency_us;
+            gpsd_wake_pending = false;
+        }
+
+        // First fix since connection loss
+        if (gpsd_reconnect_pending && new_fix) {
+            gpsd_stats.last_reconnect_us = TimespecDiffUs(&gpsd_lost_time, &gps_last_fix_time);
+            if (gpsd_stats.last_reconnect_us > gpsd_stats.max_reconnect_us)
+                gpsd_stats.max_reconnect_us = gpsd_stats.last_reconnect_us;
+            gpsd_reconnect_pending = false;
+            GPS_TRACE(reconnect, gpsd_stats.reconnect_count, gpsd_stats.last_reconnect_us);
+        }
+        pthread_mutex_unlock(&GpsDataMutex);
+
+        if (message)
+            GpsdRawPush(message);
+
+        if (new_fix)
+            GpsFixNotify(&point);
+    }
 
-    JsonValue = json_object_new_int(data.satellites_used);
-    json_object_object_add(jdata, "used satellites", JsonValue);
+    AFB_INFO("GPSd connection lost, closing.\n");
+    pthread_mutex_lock(&GpsDataMutex);
+    gpsd_online = false;
+    gpsd_streaming = false;
+    gpsd_wake_pending = false;
+    GpsClockGetTime(&gpsd_lost_time);
+    gpsd_reconnect_pending = true;
+    gpsd_stats.reconnect_count++;
+    GPS_TRACE(gpsd_lost, gpsd_stats.reconnect_count);
+    // Let the dispatch thread report the data as stale right away
+    pthread_cond_broadcast(&GpsDataCond);
+    pthread_mutex_unlock(&GpsDataMutex);
+    gps_stream(&data, WATCH_DISABLE, NULL);
+    gps_close(&data);
 
-    JsonValue = json_object_new_int(data.fix.mode);
-    json_object_object_add(jdata, "mode", JsonValue);
+    return NULL;
+}
 
-    AddDoubleToJson(data.fix.latitude, jdata, "latitude");
-    AddDoubleToJson(data.fix.epy, jdata, "latitude error");
-    AddDoubleToJson(data.fix.longitude, jdata, "longitude");
-    AddDoubleToJson(data.fix.epx, jdata, "longitude error");
-    AddDoubleToJson(data.fix.speed, jdata, "speed");
-    AddDoubleToJson(data.fix.eps, jdata, "speed error");
+/* Function:  EventWaitFix
+ * -----------------------
+ * Wait for a fix newer than the given one, or for the GPSd
+ * connection state to change, at most until deadline_ns.
+ *
+ * seq : sequence number of the latest fix already handled
+ * online : connection state already handled
+ * deadline_ns : time of the binding clock to wake up at, in nanoseconds
+ *
+ * returns: nothing
+ */
+static void EventWaitFix(unsigned long seq, bool online, long long deadline_ns)
+{
+    pthread_mutex_lock(&GpsDataMutex);
+    while (gps_fix_seq == seq && gpsd_online == online) {
+        // The simulated clock only moves while the dispatch is idle
+        dispatch_idle = true;
+        dispatch_deadline_ns = deadline_ns;
+        pthread_cond_broadcast(&DispatchIdleCond);
+        if (GpsClockTimedWait(&GpsDataCond, &GpsDataMutex, deadline_ns) == ETIMEDOUT)
+            break;
+    }
+    dispatch_idle = false;
+    pthread_mutex_unlock(&GpsDataMutex);
+}
 
-    if (data.fix.mode == MODE_3D) {
-        AddDoubleToJson(data.fix.altitude, jdata, "altitude");
-        AddDoubleToJson(data.fix.epv, jdata, "altitude error");
-        AddDoubleToJson(data.fix.climb, jdata, "climb");
-        AddDoubleToJson(data.fix.epc, jdata, "climb error");
+/* Function:  EventRoundPush
+ * -------------------------
+ * Push the payload of a dispatch round to an event,
+ * marshalling it first if no shard needed it yet.
+ * The payload of a composite event lists the conditions
+ * that triggered it, so it is its own.
+ *
+ * round : dispatch round
+ * node : event to push
+ * triggered : conditions of a composite event that triggered the push,
+ *             as bits of their indexes, 0 for any other event
+ *
+ * returns: true if the event has been pushed
+ */
+static bool EventRoundPush(event_round_t *round, event_list_node *node, uint32_t triggered)
+{
+    afb_data_t *variant = &round->payload[node->projections];
+    afb_data_t payload;
+    bool pushed;
+
+    if (triggered) {
+        payload = GpsPayloadCreate(&round->fix, &round->proj, node->projections, triggered);
+        if (!payload)
+            return false;
+        pushed = EventNodePush(node, payload);
+        afb_data_unref(payload);
+    }
+    else {
+        payload = __atomic_load_n(variant, __ATOMIC_ACQUIRE);
+        if (!payload) {
+            afb_data_t created =
+                GpsPayloadCreate(&round->fix, &round->proj, node->projections, 0);
+            if (!created)
+                return false;
+            // Another shard may have been faster
+            if (__atomic_compare_exchange_n(variant, &payload, created, false, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE))
+                payload = created;
+            else
+                afb_data_unref(created);
+        }
+        pushed = EventNodePush(node, payload);
     }
 
-    AddDoubleToJson(data.fix.track, jdata, "heading (true north)");
-    AddDoubleToJson(data.fix.epd, jdata, "heading error");
-
-// Support the change from timestamp_t (double) to timespec struct (done with API 9.0)
-#if GPSD_API_MAJOR_VERSION > 8
-    double timestamp_converted =
-        (double)data.fix.time.tv_sec + ((double)data.fix.time.tv_nsec / 1000000000);
-    JsonValue = json_object_new_double(timestamp_converted);
-#else
-    JsonValue = json_object_new_double(data.fix.time);
-#endif
+    if (!pushed && node->expired)
+        __atomic_store_n(&round->expired, true, __ATOMIC_RELAXED);
+    return pushed;
+}
 
-    json_object_object_add(jdata, "timestamp", JsonValue);
+/* Function:  EventRoundDistance
+ * -------------------------------
+ * Distance from a previous position to the fix of a round, measured
+ * in the first projected frame of the event if any, along the great
+ * circle otherwise.
+ *
+ * round : dispatch round
+ * projections : projections of the event
+ * latitude, longitude : previous position
+ * projected : projections of the previous position
+ *
+ * returns: the distance, in m
+ */
+static double EventRoundDistance(const event_round_t *round,
+                                 unsigned int projections,
+                                 double latitude,
+                                 double longitude,
+                                 const gps_projected_t *projected)
+{
+    double distance = NAN;
+
+    if (projections)
+        distance = GpsProjDistance(__builtin_ctz(projections), projected, &round->proj);
+    if (isnan(distance))
+        distance = GetDistanceInMeters(latitude, longitude, round->fix.latitude,
+                                       round->fix.longitude);
+    return distance;
+}
 
-    AddDoubleToJson(data.fix.ept, jdata, "timestamp error");
+/* Function:  EventConditionIsDue
+ * ------------------------------
+ * Evaluate the condition of an event against the fix of a round,
+ * updating what does not depend on the push (frequency slot, once
+ * per fix evaluations). What a push changes is left to
+ * EventConditionPushed.
+ *
+ * round : dispatch round
+ * node : event, or condition of a composite event
+ * shard : shard evaluating it, whose next frequency tick is updated
+ *
+ * returns: true if the event has to be pushed
+ */
+static bool EventConditionIsDue(event_round_t *round, event_list_node *node, unsigned int shard)
+{
+    const gps_fix_snapshot_t *fix = &round->fix;
+
+    if (node->condition_type == FREQUENCY) {
+        long long period_ns = 1000000000LL / node->condition_value.freq;
+        if (fix->stale && period_ns < EVENT_STALE_PERIOD_US * 1000LL)
+            period_ns = EVENT_STALE_PERIOD_US * 1000LL;
+
+        // A new period of the grid has begun, update it even if not pushed
+        long long slot = round->grid_ns / period_ns;
+        bool due = slot != node->last_value.freq_last_slot;
+        node->last_value.freq_last_slot = slot;
+
+        long long next_ns = round->grid_offset_ns + (slot + 1) * period_ns;
+        if (next_ns < round->deadline_ns[shard])
+            round->deadline_ns[shard] = next_ns;
+        return due;
+    }
+    else if (fix->stale) {
+        return round->stale_notify && node->condition_type != RAW_CLASS;
+    }
+    else if (node->condition_type == MOVEMENT) {
+        double distance =
+            EventRoundDistance(round, node->projections,
+                               node->last_value.movement_last_lat_lon.latitude,
+                               node->last_value.movement_last_lat_lon.longitude,
+                               &node->last_value.movement_last_lat_lon.projected);
+
+        // Distance is higher than the event trigger
+        return distance > node->condition_value.movement_range;
+    }
+    else if (node->condition_type == MAX_SPEED) {
+        // Speed is higher than the event trigger, and wasn't last time
+        if ((fix->speed * 3.6) > (double)(node->condition_value.max_speed))
+            return !node->last_value.above_speed;
 
-    return jdata;
+        // Speed isn't higher than trigger
+        node->last_value.above_speed = false;
+        return false;
+    }
+    else if (node->condition_type == EXPRESSION) {
+        // Expressions are evaluated once per fix
+        if (round->new_fix && node->last_value.expression.seq != fix->seq) {
+            node->last_value.expression.seq = fix->seq;
+            return ExpressionIsDue(node, fix);
+        }
+    }
+    else if (node->condition_type == ADAPTIVE) {
+        typeof(node->last_value.adaptive) *last = &node->last_value.adaptive;
+
+        // Adaptive events are evaluated once per fix
+        if (round->new_fix && last->seq != fix->seq) {
+            last->seq = fix->seq;
+            double distance = last->pushed
+                                  ? EventRoundDistance(round, node->projections, last->latitude,
+                                                       last->longitude, &last->projected)
+                                  : 0;
+            return AdaptiveIsDue(node, fix, distance);
+        }
+    }
+    return false;
 }
 
-/* Function:  GetGpsData
- * ---------------------
- * Callback for "gps-data" verb.
- * It builds the gps date json structure and returns it.
+/* Function:  EventConditionPushed
+ * -------------------------------
+ * Record that an event due (see EventConditionIsDue) has been
+ * pushed, its next evaluations being relative to this fix.
+ * Pushes telling the data became stale are not recorded.
  *
- * request : Request from the afb client.
+ * round : dispatch round
+ * node : event, or condition of a composite event
  *
  * returns: nothing
- * Error code 1 : JsonData does not have enough data to be reliable
  */
-static void GetGpsData(afb_req_t request, unsigned argc, afb_data_t const argv[])
+static void EventConditionPushed(event_round_t *round, event_list_node *node)
 {
-    json_object *JsonData = NULL;
+    const gps_fix_snapshot_t *fix = &round->fix;
 
-    pthread_mutex_lock(&GpsDataMutex);
-    JsonData = JsonDataCompletion(json_object_new_object());
-    pthread_mutex_unlock(&GpsDataMutex);
+    if (fix->stale)
+        return;
 
-    if (JsonData) {
-        afb_req_reply_json_c_hold(request, 0, JsonData);
+    if (node->condition_type == MOVEMENT) {
+        node->last_value.movement_last_lat_lon.latitude = fix->latitude;
+        node->last_value.movement_last_lat_lon.longitude = fix->longitude;
+        node->last_value.movement_last_lat_lon.projected = round->proj;
     }
-    else {
-        afb_req_reply_string(request, AFB_USER_ERRNO(1), "not enough data to be reliable\n");
+    else if (node->condition_type == MAX_SPEED) {
+        node->last_value.above_speed = true;
+    }
+    else if (node->condition_type == EXPRESSION) {
+        node->last_value.expression.fired = true;
+        GpsExprCapture(node->condition_value.expression.expr, fix,
+                       node->last_value.expression.refs);
+    }
+    else if (node->condition_type == ADAPTIVE) {
+        typeof(node->last_value.adaptive) *last = &node->last_value.adaptive;
+
+        last->pushed = true;
+        last->time = fix->time;
+        last->latitude = fix->latitude;
+        last->longitude = fix->longitude;
+        last->track = fix->track;
+        last->projected = round->proj;
     }
 }
 
-/* Function:  Subscribe
- * --------------------
- * Callback for "subscribe" verb.
- * Subscribe a client to a dynamic event.
- * Create the asked event if not found in the event list.
+/* Function:  EventCompositeDispatch
+ * ---------------------------------
+ * Evaluate every condition of a composite event against the fix
+ * of a round, and push it once if any of them is due, telling
+ * which ones.
  *
- * request : Request from the client
+ * round : dispatch round
+ * node : composite event
+ * shard : shard evaluating it
  *
  * returns: nothing
  */
-static void Subscribe(afb_req_t request, unsigned argc, afb_data_t const argv[])
+static void EventCompositeDispatch(event_round_t *round, event_list_node *node, unsigned int shard)
 {
-    afb_data_t result;
+    typeof(node->condition_value.composite) *composite = &node->condition_value.composite;
+    uint32_t triggered = 0;
+    unsigned int i;
 
-    if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
-        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
-                             "failed to convert argument to JSON_C");
-        return;
+    for (i = 0; i < composite->count; i++) {
+        if (EventConditionIsDue(round, &composite->conditions[i], shard))
+            triggered |= 1u << i;
     }
-
-    json_object *json_request = (json_object *)afb_data_ro_pointer(result);
-    if (!json_request) {
-        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
-                             "failed to get pointer to argument");
+    if (!triggered || !EventRoundPush(round, node, triggered))
         return;
-    }
 
-    event_list_node *event_to_subscribe;
+    for (i = 0; i < composite->count; i++) {
+        if (triggered & (1u << i))
+            EventConditionPushed(round, &composite->conditions[i]);
+    }
+    __atomic_add_fetch(&composite_totals.pushes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&composite_totals.triggered, __builtin_popcount(triggered),
+                       __ATOMIC_RELAXED);
+}
 
-    if (!EventJsonToName(json_request, NULL)) {
-        if (!EventListFind(json_request, &event_to_subscribe)) {
-            AFB_INFO("Event not found.");
-            if (!EventListAdd(json_request, false, &event_to_subscribe, request)) {
-                AFB_INFO("Event %s added.", afb_event_name(event_to_subscribe->event));
-                UpdateMaxFreq();
-            }
-            else {
-                afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Event creation failed");
-                return;
-            }
-        }
+/* Function:  EventShardSplice
+ * ---------------------------
+ * Move the new events to the list of their shard.
+ * Called by the dispatch thread between rounds, the shard lists being
+ * only modified while no shard walks them, here and by EventListPurge.
+ *
+ * returns: nothing
+ */
+static void EventShardSplice()
+{
+    event_list_node *iterator, *tmp;
 
-        if (afb_req_subscribe(request, event_to_subscribe->event) == 0) {
-            AFB_INFO("Subscribed to event %s.", afb_event_name(event_to_subscribe->event));
-            afb_data_addref(result);
-            afb_req_reply(request, 0, 1, &result);
-        }
+    if (!__atomic_load_n(&shard_incoming_queued, __ATOMIC_ACQUIRE))
+        return;
 
-        else
-            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Subscription error");
+    pthread_mutex_lock(&EventListMutex);
+    cds_list_for_each_entry_safe(iterator, tmp, &shard_incoming, shard_head)
+    {
+        cds_list_del(&iterator->shard_head);
+        cds_list_add_tail(&iterator->shard_head, &shard_lists[iterator->shard]);
     }
-    else
-        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
-                             "Request isn't well formated, please see readme");
-
-    return;
+    __atomic_store_n(&shard_incoming_queued, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&EventListMutex);
 }
 
-/* Function:  Unsubscribe
- * ----------------------
- * Callback for "unsubscribe" verb.
- * Unsubscribe a client to a dynamic event.
+/* Function:  EventDispatchShard
+ * -----------------------------
+ * Evaluate the events of a shard against the fix of a round,
+ * and push them if due. Shards only write to their own events,
+ * walking their own list, the lists themselves being only modified
+ * between rounds (see EventShardSplice).
  *
- * request : Request from the client
+ * round : dispatch round
+ * shard : shard to evaluate
  *
  * returns: nothing
  */
-static void Unsubscribe(afb_req_t request, unsigned argc, afb_data_t const argv[])
+static void EventDispatchShard(event_round_t *round, unsigned int shard)
 {
-    afb_data_t result;
-
-    if (afb_req_param_convert(request, 0, AFB_PREDEFINED_TYPE_JSON_C, &result) < 0) {
-        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
-                             "failed to convert argument to JSON_C");
-        return;
-    }
+    event_list_node *tmp;
 
-    json_object *json_request = (json_object *)afb_data_ro_pointer(result);
-    if (!json_request) {
-        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
-                             "failed to get pointer to argument");
-        return;
-    }
-    event_list_node *event_to_unsubscribe;
+    round->deadline_ns[shard] = LLONG_MAX;
 
-    if (!EventJsonToName(json_request, NULL)) {
-        if (EventListFind(json_request, &event_to_unsubscribe)) {
-            // Event was found in list
-            if (afb_req_unsubscribe(request, event_to_unsubscribe->event) == 0) {
-                // Unsubscribe successfully, keep the event for another hypothetical client
+    // Browsing list
+    cds_list_for_each_entry(tmp, &shard_lists[shard], shard_head)
+    {
+        if (tmp->expired)
+            continue;
 
-                afb_data_addref(result);
-                afb_req_reply(request, 0, 1, &result);
-            }
-            else
-                afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Unsubscription error");
+        // Nobody subscribed anymore: no need to wait for pushes to fail
+        if (__atomic_load_n(&tmp->subscribers, __ATOMIC_ACQUIRE) == 0 && EventNodeExpire(tmp, 0)) {
+            __atomic_store_n(&round->expired, true, __ATOMIC_RELAXED);
+            continue;
         }
-        else
-            afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Event does not exist");
-    }
-    else
-        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "Request isn't well formated");
 
-    return;
+        if (tmp->condition_type == COMPOSITE)
+            EventCompositeDispatch(round, tmp, shard);
+        else if (EventConditionIsDue(round, tmp, shard) && EventRoundPush(round, tmp, 0))
+            EventConditionPushed(round, tmp);
+    }
 }
 
-extern const char *info_verbS;
-
-/* Function:  infoVerb
- * ----------------------
- * Callback for "infoVerb" verb.
+/* Function:  EventShardThread
+ * ---------------------------
+ * Worker evaluating one shard of each dispatch round.
  *
- * request :
+ * arg : shard of the worker
  *
- * returns:
+ * returns: nothing
  */
-static void infoVerb(afb_req_t request, unsigned argc, afb_data_t const argv[])
+static void *EventShardThread(void *arg)
 {
-    enum json_tokener_error jerr;
+    unsigned int shard = (unsigned int)(uintptr_t)arg;
+    unsigned long seen = 0;
 
-    json_object *infoArgsJ = json_tokener_parse_verbose(info_verbS, &jerr);
-    if (infoArgsJ == NULL || jerr != json_tokener_success) {
-        afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST,
-                             "failure while packing info() verb arguments");
-        return;
-    }
-    afb_req_reply_json_c_hold(request, 0, infoArgsJ);
+    GpsRtThreadSetup(RT_THREAD_SHARD);
 
-    return;
+    while (true) {
+        pthread_mutex_lock(&ShardMutex);
+        while (shard_round_count == seen)
+            pthread_cond_wait(&ShardStartCond, &ShardMutex);
+        seen = shard_round_count;
+        event_round_t *round = shard_round;
+        pthread_mutex_unlock(&ShardMutex);
+
+        EventDispatchShard(round, shard);
+
+        pthread_mutex_lock(&ShardMutex);
+        if (--shard_pending == 0)
+            pthread_cond_signal(&ShardDoneCond);
+        pthread_mutex_unlock(&ShardMutex);
+    }
+    return NULL;
 }
 
-/* Function:  GpsdPolling
- * ----------------------
- * Store gps data as long as the GPSd connection is sustainable.
+/* Function:  EventDispatchRound
+ * -----------------------------
+ * Evaluate every shard against the fix of a round, the calling
+ * thread taking shard 0 while the workers take the others.
+ *
+ * round : dispatch round
  *
  * returns: nothing
  */
-static void *GpsdPolling(void *ptr)
+static void EventDispatchRound(event_round_t *round)
 {
-    int tries = 0;
-
-    while (tries < GPSD_POLLING_MAX_RETRIES) {
-        if (!gps_waiting(&data, MSECS_TO_USECS(GPSD_POLLING_DELAY_MS))) {
-            tries++;
-            continue;
-        }
-        pthread_mutex_lock(&GpsDataMutex);
-        if (gps_read(&data) == -1) {
-            AFB_ERROR("Cannot read from GPS daemon (errno: %d, \"%s\").\n", errno,
-                      gps_errstr(errno));
-            pthread_mutex_unlock(&GpsDataMutex);
-            break;
-        }
-        pthread_mutex_unlock(&GpsDataMutex);
+    if (dispatch_threads > 1) {
+        pthread_mutex_lock(&ShardMutex);
+        shard_round = round;
+        shard_round_count++;
+        shard_pending = dispatch_threads - 1;
+        pthread_cond_broadcast(&ShardStartCond);
+        pthread_mutex_unlock(&ShardMutex);
     }
 
-    AFB_INFO("GPSd connection lost, closing.\n");
-    gpsd_online = false;
-    gps_stream(&data, WATCH_DISABLE, NULL);
-    gps_close(&data);
+    EventDispatchShard(round, 0);
 
-    return NULL;
+    if (dispatch_threads > 1) {
+        pthread_mutex_lock(&ShardMutex);
+        while (shard_pending)
+            pthread_cond_wait(&ShardDoneCond, &ShardMutex);
+        pthread_mutex_unlock(&ShardMutex);
+    }
 }
 
 /* Function:  EventManagementThread
  * --------------------------------
- * Thread browsing the list and sending events to clients
- * as long as the connection with GPSd is sustainable.
+ * Thread browsing the list and sending events to clients.
+ * It runs on each new fix, and on the ticks of the subscribed
+ * frequencies. Those ticks lie on a grid anchored on the fix
+ * time, so a lower frequency fires on a subset of the ticks of
+ * a higher one and every event due at a tick shares one payload.
+ * The events may be spread over several shards, evaluated in
+ * parallel (RPGPS_DISPATCH_THREADS).
+ * It survives GPSd connection losses: meanwhile the latest fix
+ * is sent flagged as stale, once to the conditional events and
+ * every second to the frequency ones.
  *
  * returns: nothing
  */
 static void *EventManagementThread(void *arg)
 {
+    event_round_t round = {.fix = {.seq = 0}};
+    bool was_stale = false;
+    bool online = false;
+    bool grid_anchored = false;
+    long long deadline_ns = 0;
+    unsigned int i;
+
     AFB_INFO("Event management thread online !");
+    GpsRtThreadSetup(RT_THREAD_DISPATCH);
 
-    while (gpsd_online) {
-        // Start from the head of the list
-        pthread_mutex_lock(&EventListMutex);
-        event_list_node *list_cpy = list;
-        pthread_mutex_unlock(&EventListMutex);
+    while (true) {
+        EventWaitFix(round.fix.seq, online, deadline_ns);
 
         pthread_mutex_lock(&GpsDataMutex);
-        json_object *jdata = JsonDataCompletion(json_object_new_object());
+        unsigned long last_seq = round.fix.seq;
+        online = gpsd_online;
+        GpsFixSnapshot(&round.fix);
         pthread_mutex_unlock(&GpsDataMutex);
 
-        if (!jdata)
+        // The cost of the round is measured on the real clock, even when simulated
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long long now_ns = GpsClockNowNs();
+
+        // Wait 1s if no frequency related event have been found
+        deadline_ns = now_ns + 1000000000LL;
+
+        if (round.fix.mode < 2)
             continue;
 
-        event_list_node *tmp = cds_list_entry(list_cpy->list_head.next, event_list_node, list_head);
-        event_list_node *next = tmp;
+        round.new_fix = round.fix.seq != last_seq;
 
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-
-        bool found_freq_event = false;
-
-        // Browsing list
-        while (tmp != list_cpy) {
-            next = cds_list_entry(tmp->list_head.next, event_list_node, list_head);
-
-            if (tmp->condition_type == FREQUENCY) {
-                found_freq_event = true;
-                long accum_us = (now.tv_sec - tmp->last_value.freq_last_send.tv_sec) * 1000000 +
-                                (now.tv_nsec - tmp->last_value.freq_last_send.tv_nsec) / 1000;
-
-                // Enough time has passed
-                if (accum_us > HZ_TO_USECS(tmp->condition_value.freq)) {
-                    json_object_get(jdata);
-                    afb_data_t data = afb_data_json_c_hold(jdata);
-                    if (afb_event_push(tmp->event, 1, &data) == 0) {
-                        if (!tmp->is_protected) {
-                            // If an unprotected event is not used anymore, delete it
-                            tmp->not_used_count++;
-                            if (tmp->not_used_count >= EVENT_MAX_NOT_USED) {
-                                if (EventListDeleteByNode(&tmp)) {
-                                    UpdateMaxFreq();
-                                }
-                            }
-                        }
-                    }
-                    // Event well pushed
-                    else {
-                        if (tmp->not_used_count)
-                            tmp->not_used_count = 0;
-                    }
-                    // Update time from last check even if not pushed
-                    if (tmp)
-                        tmp->last_value.freq_last_send = now;
-                }
-            }
-            else if (tmp->condition_type == MOVEMENT) {
-                struct json_object *json_latitude, *json_longitude;
-                json_object_object_get_ex(jdata, "latitude", &json_latitude);
-                json_object_object_get_ex(jdata, "longitude", &json_longitude);
-                double latitude = json_object_get_double(json_latitude);
-                double longitude = json_object_get_double(json_longitude);
-
-                // Distance is higher than the event trigger
-                if (GetDistanceInMeters(tmp->last_value.movement_last_lat_lon.latitude,
-                                        tmp->last_value.movement_last_lat_lon.longitude, latitude,
-                                        longitude) > tmp->condition_value.movement_range) {
-                    // Event push return an error
-                    json_object_get(jdata);
-                    afb_data_t data = afb_data_json_c_hold(jdata);
-                    if (afb_event_push(tmp->event, 1, &data) == 0) {
-                        if (!tmp->is_protected) {
-                            // If an unprotected event is not used anymore, delete it
-                            tmp->not_used_count++;
-                            if (tmp->not_used_count >= EVENT_MAX_NOT_USED) {
-                                EventListDeleteByNode(&tmp);
-                            }
-                        }
-                    }
-                    // Event well pushed
-                    else {
-                        if (tmp->not_used_count)
-                            tmp->not_used_count = 0;
-                        tmp->last_value.movement_last_lat_lon.latitude = latitude;
-                        tmp->last_value.movement_last_lat_lon.longitude = longitude;
-                    }
-                }
-            }
-            else if (tmp->condition_type == MAX_SPEED) {
-                struct json_object *json_speed;
-                json_object_object_get_ex(jdata, "speed", &json_speed);
-                double speed = json_object_get_double(json_speed);
-
-                // Speed is higher than the event trigger
-                if ((speed * 3.6) > (double)(tmp->condition_value.max_speed)) {
-                    // Speed wasn't higher than trigger last time
-                    if (!tmp->last_value.above_speed) {
-                        // Event push return an error
-                        json_object_get(jdata);
-                        afb_data_t data = afb_data_json_c_hold(jdata);
-                        if (afb_event_push(tmp->event, 1, &data) == 0) {
-                            if (!tmp->is_protected) {
-                                // If an unprotected event is not used anymore, delete it
-                                tmp->not_used_count++;
-                                if (tmp->not_used_count >= EVENT_MAX_NOT_USED) {
-                                    EventListDeleteByNode(&tmp);
-                                }
-                            }
-                        }
-                        // Event well pushed
-                        else {
-                            if (tmp->not_used_count)
-                                tmp->not_used_count = 0;
-                            tmp->last_value.above_speed = true;
-                        }
-                    }
-                }
-                // Speed isn't higher than trigger
-                else {
-                    tmp->last_value.above_speed = false;
-                }
+        // Anchor the grid on the time the fix has been received, minus its timestamp
+        if (round.new_fix && !isnan(round.fix.time)) {
+            long long offset_ns =
+                now_ns - (long long)(round.fix.age * 1e9) - (long long)(round.fix.time * 1e9);
+            if (!grid_anchored || llabs(offset_ns - round.grid_offset_ns) > EVENT_GRID_RESYNC_NS) {
+                round.grid_offset_ns = offset_ns;
+                grid_anchored = true;
             }
+        }
+        round.grid_ns = now_ns - round.grid_offset_ns;
 
-            tmp = next;
+        // Conditional events only hear about the data becoming stale once
+        round.stale_notify = round.fix.stale && !was_stale;
+        was_stale = round.fix.stale;
+
+        // Projections are computed once per fix, for the events needing them
+        if (round.new_fix)
+            round.proj.done = 0;
+        GpsProjCompute(&round.fix, __atomic_load_n(&projection_mask, __ATOMIC_RELAXED),
+                       &round.proj);
+
+        memset(round.payload, 0, sizeof(round.payload));
+        round.expired = false;
+
+        EventShardSplice();
+        EventDispatchRound(&round);
+
+        for (i = 0; i < GPS_PROJ_VARIANTS; i++) {
+            if (round.payload[i])
+                afb_data_unref(round.payload[i]);
         }
+        if (round.expired || __atomic_load_n(&purge_deferred, __ATOMIC_RELAXED))
+            EventListPurge();
 
-        json_object_put(jdata);
+        for (i = 0; i < dispatch_threads; i++) {
+            if (round.deadline_ns[i] < deadline_ns)
+                deadline_ns = round.deadline_ns[i];
+        }
 
-        // Wait 1s if no frequency related event have been found
-        // Be sure that max_freq has been populated (to avoid synchronisation problem, causing a 0s
-        // waiting time)
-        if (found_freq_event && (max_freq > 0))
-            usleep(HZ_TO_USECS(max_freq));
-        else
-            sleep(1);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long long round_ns = TimespecToNs(&end) - TimespecToNs(&start);
+        __atomic_add_fetch(&dispatch_stats.rounds, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&dispatch_stats.busy_ns, round_ns, __ATOMIC_RELAXED);
+        if (round_ns > dispatch_stats.max_round_ns)
+            __atomic_store_n(&dispatch_stats.max_round_ns, round_ns, __ATOMIC_RELAXED);
     }
-    AFB_INFO("Event management thread offline !");
-    pthread_exit(NULL);
+    return NULL;
 }
 
 /* Function:  GpsdConnectionManagementThread
@@ -905,25 +3224,30 @@ static void *GpsdConnectionManagementThread(void *arg)
 {
     gpsd_connection_management_thread_userdata_t *userdata = arg;
 
+    GpsRtThreadSetup(RT_THREAD_POLLING);
+
     // Exit condition, if any, occurs in connection loop
     while (true) {
         int ret = -1;
-        unsigned int delay = 1;
+        unsigned int delay_ms = 0;
 
-        // Try to open GPSd connection
+        // Try to open GPSd connection, retrying once right away
         // Retry forever if max_retries <= 0
         while (ret != 0 &&
                (userdata->max_retries <= 0 || userdata->nb_retries++ < userdata->max_retries)) {
             ret = gps_open(userdata->host, userdata->port, userdata->gps_data);
             if (ret != 0) {
-                AFB_NOTICE(
-                    "GPSd not available yet (errno: %d, \"%s\"). Wait for %.2d seconds before "
-                    "retry...",
-                    errno, gps_errstr(errno), delay);
-                sleep(delay);
-                delay *= 2;
-                if (delay > GPSD_CONNECT_MAX_DELAY) {
-                    delay = GPSD_CONNECT_MAX_DELAY;
+                // Nothing to wait for before the immediate retry
+                if (delay_ms) {
+                    AFB_NOTICE(
+                        "GPSd not available yet (errno: %d, \"%s\"). Wait for %u ms before "
+                        "retry...",
+                        errno, gps_errstr(errno), delay_ms);
+                    usleep(MSECS_TO_USECS(delay_ms));
+                }
+                delay_ms = delay_ms ? delay_ms * 2 : GPSD_CONNECT_MIN_DELAY_MS;
+                if (delay_ms > GPSD_CONNECT_MAX_DELAY * 1000) {
+                    delay_ms = GPSD_CONNECT_MAX_DELAY * 1000;
                 }
             }
         }
@@ -934,32 +3258,105 @@ static void *GpsdConnectionManagementThread(void *arg)
             return &userdata->result;  // aka thread_exit()
         }
 
-        gps_stream(userdata->gps_data, WATCH_ENABLE | WATCH_JSON, NULL);
+        unsigned int watch_flags = GpsdWatchFlags();
+        gps_stream(userdata->gps_data, watch_flags, NULL);
 #ifdef AGL_SPEC_802
         int tries = 5;
         // Due to the gpsd.socket race condition need to loop until initial event
         do {
-            gps_read(userdata->gps_data);
+            gps_read_data(userdata->gps_data);
         } while (!gps_waiting(userdata->gps_data, MSECS_TO_USECS(1000)) && tries--);
 #endif
         AFB_INFO("Connected to GPSd");
 
+        pthread_mutex_lock(&GpsDataMutex);
         gpsd_online = true;
+        gpsd_streaming = true;
+        gpsd_watch_flags = watch_flags;
+        GpsClockGetTime(&gpsd_last_demand);
+        pthread_cond_broadcast(&GpsDataCond);
+        pthread_mutex_unlock(&GpsDataMutex);
         userdata->nb_retries = 0;  // Reset counter for next try
 
-        // Launch the event management thread
-        ret = pthread_create(&EventThread, NULL, &EventManagementThread, NULL);
-        if (ret != 0) {
-            AFB_ERROR("Could not create thread for event handling...");
-        }
-
-        pthread_detach(EventThread);
-
         // GpsdPolling returns if GPSd connection's lost
         GpsdPolling(NULL);
     }
 }
 
+/* Function:  ReplayAdvance
+ * -------------------------
+ * Move the simulated clock up to a time, through each deadline of
+ * the dispatch thread, waiting for it to be done with every round.
+ * GpsDataMutex must be held by the caller.
+ *
+ * now_ns : new time, in nanoseconds
+ *
+ * returns: nothing
+ */
+static void ReplayAdvance(long long now_ns)
+{
+    while (true) {
+        while (!dispatch_idle)
+            pthread_cond_wait(&DispatchIdleCond, &GpsDataMutex);
+        if (dispatch_deadline_ns > now_ns)
+            break;
+        GpsClockAdvance(dispatch_deadline_ns);
+        dispatch_idle = false;
+        pthread_cond_broadcast(&GpsDataCond);
+    }
+    GpsClockAdvance(now_ns);
+}
+
+/* Function:  ReplayThread
+ * -----------------------
+ * Thread publishing the fixes of a NMEA log in place of GPSd,
+ * once started by the "replay" verb. The simulated clock jumps to
+ * the first fix, then goes from a fix to the next as soon as the
+ * dispatch is done, so the events are the ones it would push live.
+ *
+ * returns: nothing
+ */
+static void *ReplayThread(void *arg)
+{
+    struct gps_data_t replayed = {0};
+    gps_track_point_t point;
+    long long fix_ns;
+    int ret;
+
+    GpsRtThreadSetup(RT_THREAD_POLLING);
+    GpsReplayWaitStart();
+
+    pthread_mutex_lock(&GpsDataMutex);
+    gpsd_online = true;
+    gpsd_streaming = true;
+    pthread_cond_broadcast(&GpsDataCond);
+    pthread_mutex_unlock(&GpsDataMutex);
+
+    while ((ret = GpsReplayNext(&replayed, &fix_ns)) > 0) {
+        pthread_mutex_lock(&GpsDataMutex);
+        if (gps_fix_seq == 0)
+            GpsClockAdvance(fix_ns);
+        else
+            ReplayAdvance(fix_ns);
+        data.set = replayed.set;
+        data.fix = replayed.fix;
+        data.satellites_used = replayed.satellites_used;
+        data.satellites_visible = replayed.satellites_visible;
+        GpsFixPublish(&point);
+        pthread_mutex_unlock(&GpsDataMutex);
+
+        GpsFixNotify(&point);
+    }
+
+    // Done once the last fix has been dispatched
+    pthread_mutex_lock(&GpsDataMutex);
+    while (!dispatch_idle)
+        pthread_cond_wait(&DispatchIdleCond, &GpsDataMutex);
+    pthread_mutex_unlock(&GpsDataMutex);
+    GpsReplayDone(ret < 0);
+    return NULL;
+}
+
 /* Function:  GpsInit
  * ------------------
  * Initialize the connection to GSPd and start the main thread.
@@ -969,8 +3366,44 @@ static void *GpsdConnectionManagementThread(void *arg)
  */
 static int GpsInit()
 {
+    unsigned int shard;
     int ret;
 
+    // Real-time mode has to preallocate before anything else
+    if (GpsRtInit() < 0)
+        return -1;
+
+    // Fix waits use absolute deadlines, immune to wall clock changes
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&GpsDataCond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (GpsHistoryInit() < 0)
+        return -1;
+
+    // NMEA log replayed on a simulated clock, instead of connecting to GPSd
+    const char *replay_path = getenv("RPGPS_REPLAY_PATH");
+    if (replay_path && replay_path[0] != '\0') {
+        if (GpsReplayOpen(replay_path) < 0)
+            return -1;
+        GpsClockSimulate(0);
+    }
+
+    // Fixes recorded to a track file (unset to disable)
+    const char *record_path = getenv("RPGPS_RECORD_PATH");
+    if (record_path && record_path[0] != '\0' && GpsRecordOpen(record_path) < 0)
+        AFB_WARNING("Fixes won't be recorded");
+
+    // Points of interest of the nearest verb (unset to disable)
+    if (GpsPoiInit() < 0)
+        AFB_WARNING("POIs won't be available");
+
+    // Trip counted since the binding start
+    if (TripStart(TRIP_DEFAULT_NAME) < 0)
+        return -1;
+
     gpsd_connection_management_thread_userdata_t *userdata =
         malloc(sizeof(gpsd_connection_management_thread_userdata_t));
     if (userdata == NULL) {
@@ -984,7 +3417,48 @@ static int GpsInit()
     userdata->nb_retries = 0;
     userdata->gps_data = &data;
 
-    ret = pthread_create(&MainThread, NULL, &GpsdConnectionManagementThread, userdata);
+    // Disable GPSd streaming after this many seconds without listener (0 for never)
+    gpsd_idle_timeout = (unsigned int)atoi(getenv("RPGPS_IDLE_TIMEOUT") ?: "0");
+
+    // Shared memory segment for local readers (empty to disable). Its readers not being
+    // known, it keeps GPSd streaming: it has to be named to be published in idle mode
+    const char *shm_name = getenv("RPGPS_SHM_NAME");
+    if (!shm_name)
+        shm_name = gpsd_idle_timeout ? "" : RP_GPS_SHM_DEFAULT_NAME;
+    if (shm_name[0] != '\0' && GpsShmOpen(shm_name) < 0)
+        AFB_WARNING("Fixes won't be published in shared memory");
+
+    // Events evaluated in parallel by this many threads
+    int threads = atoi(getenv("RPGPS_DISPATCH_THREADS") ?: "1");
+    if (threads < 1 || threads > EVENT_MAX_SHARDS) {
+        AFB_ERROR("RPGPS_DISPATCH_THREADS must be between 1 and %d", EVENT_MAX_SHARDS);
+        return -1;
+    }
+    dispatch_threads = threads;
+    for (shard = 0; shard < EVENT_MAX_SHARDS; shard++)
+        CDS_INIT_LIST_HEAD(&shard_lists[shard]);
+    for (shard = 1; shard < dispatch_threads; shard++) {
+        pthread_t ShardThread;
+        ret = pthread_create(&ShardThread, NULL, &EventShardThread, (void *)(uintptr_t)shard);
+        if (ret != 0) {
+            AFB_ERROR("Could not create thread for event shard %u...", shard);
+            return ret;
+        }
+        pthread_detach(ShardThread);
+    }
+
+    // The event management thread outlives the GPSd connections
+    ret = pthread_create(&EventThread, NULL, &EventManagementThread, NULL);
+    if (ret != 0) {
+        AFB_ERROR("Could not create thread for event handling...");
+        return ret;
+    }
+    pthread_detach(EventThread);
+
+    if (GpsReplayEnabled())
+        ret = pthread_create(&MainThread, NULL, &ReplayThread, NULL);
+    else
+        ret = pthread_create(&MainThread, NULL, &GpsdConnectionManagementThread, userdata);
     if (ret != 0) {
         AFB_ERROR("Could not create thread for listening to GPSd socket...");
         return ret;
@@ -1005,7 +3479,6 @@ int binding_ctl(afb_api_t api, afb_ctlid_t ctlid, afb_ctlarg_t ctlarg, void *use
     switch (ctlid) {
     case afb_ctlid_Init:
         gpsd_online = false;
-        max_freq = 0;
         list = malloc(sizeof(event_list_node));
         CDS_INIT_LIST_HEAD(&list->list_head);
 
@@ -1015,6 +3488,10 @@ int binding_ctl(afb_api_t api, afb_ctlid_t ctlid, afb_ctlarg_t ctlarg, void *use
             return -1;
         }
         break;
+    case afb_ctlid_Exiting:
+        GpsShmClose();
+        GpsRecordClose();
+        break;
     default:
         break;
     }
@@ -1027,6 +3504,24 @@ static const afb_verb_t binding_verbs[] = {
     {.verb = "unsubscribe",
      .callback = Unsubscribe,
      .info = "Unsubscribe to GNSS events with conditions"},
+    {.verb = "ack", .callback = Ack, .info = "Acknowledge events of a flow controlled stream"},
+    {.verb = "trip", .callback = Trip, .info = "Get, reset or subscribe to trip statistics"},
+    {.verb = "stats", .callback = GetStats, .info = "GPSd streaming state and counters"},
+    {.verb = "enu-origin",
+     .callback = EnuOrigin,
+     .info = "Get or move the origin of the ENU frame"},
+    {.verb = "history",
+     .callback = History,
+     .info = "Recorded fixes of a time window, in an area, simplified"},
+    {.verb = "export",
+     .callback = Export,
+     .info = "GPX or GeoJSON export of the stored fixes, a page at a time"},
+    {.verb = "nearest",
+     .callback = Nearest,
+     .info = "Nearest points of interest, and events when the nearest one changes"},
+    {.verb = "replay",
+     .callback = Replay,
+     .info = "Start or follow the replay of a NMEA log on a simulated clock"},
     {.verb = "info", .callback = infoVerb, .info = "API info"},
     {
         .verb = NULL /*marker for the end of the array*/
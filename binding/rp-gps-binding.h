@@ -1,4 +1,6 @@
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <urcu/list.h>
 
@@ -7,7 +9,104 @@
 #include <afb-helpers4/afb-req-utils.h>
 #include <afb/afb-binding.h>
 
-enum condition_type_enum { FREQUENCY, MOVEMENT, MAX_SPEED };
+#include "rp-gps-track.h"
+
+enum condition_type_enum {
+    FREQUENCY,
+    MOVEMENT,
+    MAX_SPEED,
+    RAW_CLASS,
+    EXPRESSION,
+    ADAPTIVE,
+    COMPOSITE
+};
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+// Enable NaN values from gpsd, to ensure a consistant json structure
+// Disabled by default to ensure compatibility with as many clients as possible
+#define SEND_NAN_VALUES false
+
+// Max length of an event name
+#define EVENT_NAME_MAX 96
+
+// Fix fields that conditions can be evaluated against
+enum gps_field_enum {
+    FIELD_MODE,
+    FIELD_VISIBLE,
+    FIELD_USED,
+    FIELD_TIME,
+    FIELD_LATITUDE,
+    FIELD_LONGITUDE,
+    FIELD_ALTITUDE,
+    FIELD_SPEED,
+    FIELD_SPEED_KMH,
+    FIELD_CLIMB,
+    FIELD_HEADING,
+    FIELD_EPX,
+    FIELD_EPY,
+    FIELD_EPV,
+    FIELD_EPS,
+    FIELD_EPC,
+    FIELD_EPD,
+    FIELD_EPT,
+    GPS_FIELD_COUNT
+};
+
+// Copy of the latest fix, taken once per dispatch round
+typedef struct gps_fix_snapshot
+{
+    unsigned long seq;  // incremented with each new fix
+    int mode;
+    int satellites_visible;
+    int satellites_used;
+    double time;  // in s
+    double latitude;
+    double longitude;
+    double altitude;  // NaN if not a 3D fix
+    double speed;     // in m/s
+    double climb;     // NaN if not a 3D fix
+    double track;     // in degrees
+    double epx, epy, epv, eps, epc, epd, ept;
+    bool stale;  // GPSd is offline or no fix has been received for a while
+    double age;  // time since the fix has been received, in s
+} gps_fix_snapshot_t;
+
+// Metric frames a fix can be projected to
+enum gps_proj_enum { PROJ_UTM, PROJ_ENU, PROJ_ECEF, GPS_PROJ_COUNT };
+#define GPS_PROJ_BIT(proj) (1u << (proj))
+#define GPS_PROJ_VARIANTS  (1 << GPS_PROJ_COUNT)  // combinations of projections
+
+// Projected coordinates of a fix, computed on demand
+typedef struct gps_projected
+{
+    unsigned int done;  // projections computed, bits of gps_proj_enum
+    int utm_zone;       // 0 outside of the UTM latitudes
+    bool utm_north;
+    double utm_easting, utm_northing;    // in m
+    double enu_east, enu_north, enu_up;  // in m, from the ENU origin
+    double ecef_x, ecef_y, ecef_z;       // in m
+} gps_projected_t;
+
+// Compiled condition expression (rp-gps-expr.c)
+typedef struct gps_expr gps_expr_t;
+
+// GPSd report classes that can be forwarded without decoding
+enum gpsd_report_class_enum { REPORT_TPV, REPORT_SKY, REPORT_PPS, REPORT_CLASS_COUNT };
+
+// Delivery state of a flow controlled event, private to one subscriber
+typedef struct event_flow
+{
+    pthread_mutex_t mutex;
+    int window;                // max unacknowledged pushes
+    int outstanding;           // pushed but not acknowledged yet
+    afb_data_t pending;        // latest payload waiting for credit, if any
+    struct timespec last_ack;  // last acknowledgment (or first push)
+    unsigned long pushed;      // delivered payloads
+    unsigned long conflated;   // payloads replaced by a newer one before delivery
+    unsigned long resets;      // credits given back after a too long silence
+    bool sending;              // "ack" is pushing the pending payload, unlocked
+} event_flow_t;
 
 typedef struct event_list_node
 {
@@ -15,30 +114,223 @@ typedef struct event_list_node
     afb_event_t event;  // event
     bool is_protected;  // is the event protected from deletion ?
     int not_used_count;
+    bool expired;        // nobody listening anymore, deleted after the dispatch round
+    int subscribers;     // subscribed clients, -1 once expired
+    int pins;            // verbs using the event unlocked, not deleted meanwhile
+    unsigned int stream;  // stream id of a private event, given to the subscriber, 0 if shared
+    unsigned int owner;  // session of the subscriber of a private event, see EventSessionId
+    unsigned int shard;  // dispatch thread evaluating the event
+    struct cds_list_head shard_head;  // in the list of the events of its shard
+    unsigned int projections;  // projected coordinates sent, bits of gps_proj_enum
+    event_flow_t *flow;  // flow control state, NULL for shared events
     enum condition_type_enum condition_type;  // condition type of the event
     union                                     // condition value of the event
     {
         int freq;            // in hz
         int movement_range;  // in m
         int max_speed;       // in km/h
+        enum gpsd_report_class_enum raw_class;
+        struct
+        {
+            gps_expr_t *expr;
+            int debounce;    // in ms, time the expression has to stay true
+            int hysteresis;  // in ms, time it has to stay false to be armed again
+        } expression;
+        struct
+        {
+            int distance;      // in m, traveled since the last push
+            int min_interval;  // in ms, between two pushes
+            int max_interval;  // in ms, pushed anyway after it, 0 if none
+            int heading;       // in degrees, change since the last push, 0 if none
+        } adaptive;
+        struct
+        {
+            struct event_list_node *conditions;  // evaluated in turn, never in the list
+            unsigned int count;
+        } composite;
     } condition_value;
     union {
-        struct timespec freq_last_send;
+        long long freq_last_slot;  // grid period of the last send
         struct
         {
             double latitude;
             double longitude;
+            gps_projected_t projected;  // when measured in a metric frame
         } movement_last_lat_lon;
         bool above_speed;
+        struct
+        {
+            unsigned long seq;  // last evaluated fix
+            bool refs_valid;    // refs have been captured
+            bool state;         // value at last evaluation
+            bool fired;         // pushed since the expression became true
+            double since;       // fix time of the last state change
+            double refs[GPS_FIELD_COUNT];  // delta() references
+        } expression;
+        struct
+        {
+            unsigned long seq;  // last evaluated fix
+            bool pushed;        // the fields below are valid
+            double time;        // fix time of the last push
+            double latitude;
+            double longitude;
+            double track;
+            gps_projected_t projected;
+        } adaptive;
     } last_value;
 
 } event_list_node;
 
-extern void UpdateMaxFreq();
-extern int EventJsonToName(json_object *jcondition, char **result);
+extern double GetDistanceInMeters(double lat1, double long1, double lat2, double long2);
+extern int EventJsonToName(json_object *jcondition, char *result, size_t size);
 extern int EventListAdd(json_object *jcondition,
                         bool is_disposable,
                         event_list_node **node,
                         afb_req_t request);
-extern bool EventListFind(json_object *jcondition, event_list_node **found_node);
-extern bool EventListDeleteByNode(event_list_node **node);
+extern bool EventListFind(json_object *jcondition, bool hold, event_list_node **found_node);
+extern void EventListPurge();
+
+struct gps_data_t;
+extern double GpsFixTimestamp(const struct gps_data_t *gps);
+
+// Latest fix publication in shared memory (rp-gps-shm.c)
+extern int GpsShmOpen(const char *name);
+extern void GpsShmPublish(const struct gps_data_t *gps);
+extern bool GpsShmEnabled();
+extern void GpsShmClose();
+
+// Trip statistics (rp-gps-trip.c)
+#define TRIP_DEFAULT_NAME "default"
+#define TRIP_MAX_COUNT    32  // trips at once, the default one included
+#define TRIP_NAME_MAX     32  // characters of a name, also part of its event name
+extern bool TripNameValid(const char *name);
+extern void TripUpdate(const struct gps_data_t *gps);
+extern void TripPushChanged();
+extern int TripStart(const char *name);
+extern bool TripReset(const char *name);
+extern bool TripDelete(const char *name);
+extern json_object *TripGet(const char *name);
+extern int TripSubscribe(afb_req_t request, const char *name, bool subscribe);
+extern bool TripListening();
+
+extern double GpsFieldValue(const gps_fix_snapshot_t *fix, enum gps_field_enum field);
+extern gps_expr_t *GpsExprCompile(const char *text, const char **error);
+extern void GpsExprFree(gps_expr_t *expr);
+extern uint64_t GpsExprHash(const gps_expr_t *expr);
+extern void GpsExprCapture(const gps_expr_t *expr, const gps_fix_snapshot_t *fix, double *refs);
+extern bool GpsExprEval(const gps_expr_t *expr, const gps_fix_snapshot_t *fix, const double *refs);
+
+// Gps data payload (rp-gps-payload.c)
+extern int GpsPayloadPoolInit(unsigned int count);
+extern unsigned int GpsPayloadPoolFree();
+extern afb_data_t GpsPayloadCreate(const gps_fix_snapshot_t *fix,
+                                   const gps_projected_t *proj,
+                                   unsigned int projections,
+                                   uint32_t triggered);
+
+// Projected coordinates (rp-gps-proj.c)
+extern void GpsProjCompute(const gps_fix_snapshot_t *fix, unsigned int mask, gps_projected_t *proj);
+extern double GpsProjDistance(enum gps_proj_enum frame,
+                              const gps_projected_t *from,
+                              const gps_projected_t *to);
+extern int GpsProjMaskFromJson(json_object *jprojection, unsigned int *mask);
+extern int GpsProjName(unsigned int mask, char *result, size_t size);
+extern int GpsProjSetOrigin(double latitude, double longitude, double altitude);
+extern json_object *GpsProjOriginToJson();
+
+// Fix history (rp-gps-history.c)
+enum gps_history_area_enum { HISTORY_AREA_NONE, HISTORY_AREA_RADIUS, HISTORY_AREA_BBOX };
+typedef struct gps_history_query
+{
+    double start, end;  // fix timestamps, in s
+    double last;        // if > 0, window of this many seconds before the newest fix
+    enum gps_history_area_enum area;
+    double latitude, longitude, radius;  // HISTORY_AREA_RADIUS, radius in m
+    double south, west, north, east;     // HISTORY_AREA_BBOX, in degrees
+    double tolerance;  // simplification tolerance in m, 0 to get every fix
+} gps_history_query_t;
+extern int GpsHistoryInit();
+extern void GpsHistoryAppend(const gps_track_point_t *point);
+extern json_object *GpsHistoryQuery(const gps_history_query_t *query);
+extern long GpsHistoryRead(uint64_t *cursor,
+                           bool resume,
+                           double start,
+                           double end,
+                           gps_track_point_t *points,
+                           unsigned int max,
+                           bool *more);
+extern json_object *GpsHistoryToJson();
+
+// Track recording (rp-gps-record.c)
+extern int GpsRecordOpen(const char *path);
+extern void GpsRecordAppend(const gps_track_point_t *point);
+extern void GpsRecordClose();
+extern bool GpsRecordEnabled();
+extern long GpsRecordRead(uint64_t *cursor,
+                          bool resume,
+                          double start,
+                          double end,
+                          gps_track_point_t *points,
+                          unsigned int max,
+                          bool *more);
+extern json_object *GpsRecordToJson();
+
+// Track export (rp-gps-export.c)
+#define GPS_EXPORT_DEFAULT_LIMIT 1000
+#define GPS_EXPORT_MAX_LIMIT     10000
+enum gps_export_format_enum { EXPORT_FORMAT_GPX, EXPORT_FORMAT_GEOJSON };
+enum gps_export_source_enum { EXPORT_SOURCE_HISTORY, EXPORT_SOURCE_RECORD };
+typedef struct gps_export_query
+{
+    enum gps_export_format_enum format;
+    enum gps_export_source_enum source;
+    double start, end;   // fix timestamps, in s
+    bool resume;         // false for the first page
+    uint64_t cursor;     // returned by the previous page
+    unsigned int limit;  // max fixes in the page
+} gps_export_query_t;
+extern int GpsExportPage(const gps_export_query_t *query, json_object **page);
+extern json_object *GpsExportToJson();
+
+// Points of interest (rp-gps-poi.c)
+#define GPS_POI_MAX_NEAREST 100
+#define GPS_POI_MAX_RADIUS  100000  // m, of a subscription
+#define GPS_POI_MAX_WATCHES 16      // radiuses watched at once
+extern int GpsPoiInit();
+extern int GpsPoiReload();
+extern json_object *GpsPoiNearest(double latitude, double longitude, double radius, unsigned int k);
+extern void GpsPoiUpdate(double latitude, double longitude);
+extern int GpsPoiSubscribe(afb_req_t request, int radius, bool subscribe);
+extern bool GpsPoiListening();
+extern json_object *GpsPoiToJson();
+
+// Real-time mode (rp-gps-rt.c)
+enum gps_rt_thread_enum {
+    RT_THREAD_POLLING,
+    RT_THREAD_DISPATCH,
+    RT_THREAD_SHARD,
+    RT_THREAD_COUNT
+};
+extern int GpsRtInit();
+extern void GpsRtPoolMiss();
+extern event_list_node *GpsRtNodeAlloc();
+extern void GpsRtNodeRelease(event_list_node *node);
+extern void GpsRtThreadSetup(enum gps_rt_thread_enum thread);
+extern json_object *GpsRtToJson();
+
+// Clock, monotonic or simulated (rp-gps-clock.c)
+extern void GpsClockSimulate(long long start_ns);
+extern bool GpsClockSimulated();
+extern long long GpsClockNowNs();
+extern void GpsClockGetTime(struct timespec *now);
+extern void GpsClockAdvance(long long now_ns);
+extern int GpsClockTimedWait(pthread_cond_t *cond, pthread_mutex_t *mutex, long long deadline_ns);
+
+// Replay of a NMEA log on the simulated clock (rp-gps-replay.c)
+extern int GpsReplayOpen(const char *path);
+extern bool GpsReplayEnabled();
+extern int GpsReplayStart();
+extern void GpsReplayWaitStart();
+extern int GpsReplayNext(struct gps_data_t *gps, long long *time_ns);
+extern void GpsReplayDone(bool failed);
+extern json_object *GpsReplayToJson();
@@ -0,0 +1,135 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Clock of the binding: the monotonic clock, or a simulated one only moved
+ * by the replay of a NMEA log, so that the dispatch runs as fast as it can
+ * with the timings it would have had live.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "rp-gps-binding.h"
+
+// Set once, before the threads are started
+static bool clock_simulated;
+static long long clock_simulated_ns;
+
+/* Function:  GpsClockSimulate
+ * ---------------------------
+ * Switch to the simulated clock. Must be called before
+ * the threads using the clock are started.
+ *
+ * start_ns : initial time, in nanoseconds
+ *
+ * returns: nothing
+ */
+void GpsClockSimulate(long long start_ns)
+{
+    clock_simulated = true;
+    clock_simulated_ns = start_ns;
+}
+
+/* Function:  GpsClockSimulated
+ * ----------------------------
+ * returns: true if the clock is simulated
+ */
+bool GpsClockSimulated()
+{
+    return clock_simulated;
+}
+
+/* Function:  GpsClockNowNs
+ * ------------------------
+ * returns: the current time, in nanoseconds
+ */
+long long GpsClockNowNs()
+{
+    struct timespec now;
+
+    if (clock_simulated)
+        return __atomic_load_n(&clock_simulated_ns, __ATOMIC_ACQUIRE);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Function:  GpsClockGetTime
+ * --------------------------
+ * Get the current time, as clock_gettime(CLOCK_MONOTONIC) does.
+ *
+ * now : receives the time
+ *
+ * returns: nothing
+ */
+void GpsClockGetTime(struct timespec *now)
+{
+    long long now_ns = GpsClockNowNs();
+
+    now->tv_sec = now_ns / 1000000000LL;
+    now->tv_nsec = now_ns % 1000000000LL;
+}
+
+/* Function:  GpsClockAdvance
+ * --------------------------
+ * Move the simulated clock forward, never backward. Whoever waits
+ * for it with GpsClockTimedWait must then be woken up by the caller.
+ *
+ * now_ns : new time, in nanoseconds
+ *
+ * returns: nothing
+ */
+void GpsClockAdvance(long long now_ns)
+{
+    if (clock_simulated && now_ns > __atomic_load_n(&clock_simulated_ns, __ATOMIC_RELAXED))
+        __atomic_store_n(&clock_simulated_ns, now_ns, __ATOMIC_RELEASE);
+}
+
+/* Function:  GpsClockTimedWait
+ * ----------------------------
+ * Wait for a condition at most until a deadline of the clock.
+ * The condition must use CLOCK_MONOTONIC. On the simulated clock,
+ * only a broadcast can end the wait, the time being checked then.
+ *
+ * cond : condition to wait for
+ * mutex : mutex of the condition, held by the caller
+ * deadline_ns : time to wake up at, in nanoseconds
+ *
+ * returns: ETIMEDOUT if the deadline has been reached
+ *          0 otherwise
+ */
+int GpsClockTimedWait(pthread_cond_t *cond, pthread_mutex_t *mutex, long long deadline_ns)
+{
+    if (!clock_simulated) {
+        struct timespec deadline = {.tv_sec = deadline_ns / 1000000000LL,
+                                    .tv_nsec = deadline_ns % 1000000000LL};
+        return pthread_cond_timedwait(cond, mutex, &deadline);
+    }
+
+    if (GpsClockNowNs() >= deadline_ns)
+        return ETIMEDOUT;
+    pthread_cond_wait(cond, mutex);
+    return GpsClockNowNs() >= deadline_ns ? ETIMEDOUT : 0;
+}
@@ -0,0 +1,217 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Track export: GPX or GeoJSON documents of the stored fixes, built one
+ * page of bounded size at a time, the client passing back the cursor of
+ * the previous page. Memory use depends on the page size only, whatever
+ * the length of the track.
+ */
+
+#define _GNU_SOURCE
+#include <json-c/json.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rp-gps-binding.h"
+
+// Longest text of a fix, and of the document header or footer
+#define EXPORT_POINT_MAX_LEN 192
+#define EXPORT_FRAME_MAX_LEN 256
+
+static const char *export_format_names[] = {"gpx", "geojson"};
+static const char *export_source_names[] = {"history", "record"};
+
+static const char gpx_header[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<gpx version=\"1.1\" creator=\"gps-binding\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+    "<trk><trkseg>\n";
+static const char gpx_footer[] = "</trkseg></trk>\n</gpx>\n";
+static const char geojson_header[] = "{\"type\":\"FeatureCollection\",\"features\":[\n";
+static const char geojson_footer[] = "\n]}\n";
+
+static pthread_mutex_t ExportMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct
+{
+    unsigned long pages;
+    unsigned long fixes;
+    unsigned long bytes;
+    double seconds;  // spent building the pages
+} export_stats;
+
+/* Function:  ExportPointToGpx
+ * ---------------------------
+ * Write a fix as a GPX track point.
+ *
+ * returns: the number of characters written
+ */
+static int ExportPointToGpx(char *text, size_t size, const gps_track_point_t *point)
+{
+    long long ms = llround(point->time * 1000);
+    time_t seconds = (time_t)(ms / 1000 - (ms % 1000 < 0));
+    char date[32], altitude[48] = "";
+    struct tm tm;
+
+    gmtime_r(&seconds, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!isnan(point->altitude))
+        snprintf(altitude, sizeof(altitude), "<ele>%.2f</ele>", point->altitude);
+
+    return snprintf(text, size,
+                    "<trkpt lat=\"%.7f\" lon=\"%.7f\">%s<time>%s.%03lldZ</time></trkpt>\n",
+                    point->latitude, point->longitude, altitude, date, (ms % 1000 + 1000) % 1000);
+}
+
+/* Function:  ExportPointToGeoJson
+ * -------------------------------
+ * Write a fix as a GeoJSON point feature.
+ *
+ * first : true for the first feature of the document, not preceded by a comma
+ *
+ * returns: the number of characters written
+ */
+static int ExportPointToGeoJson(char *text,
+                                size_t size,
+                                const gps_track_point_t *point,
+                                bool first)
+{
+    char altitude[32] = "", speed[32] = "";
+
+    if (!isnan(point->altitude))
+        snprintf(altitude, sizeof(altitude), ",%.2f", point->altitude);
+    if (!isnan(point->speed))
+        snprintf(speed, sizeof(speed), ",\"speed\":%.2f", point->speed);
+
+    return snprintf(text, size,
+                    "%s{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\",\"coordinates\":"
+                    "[%.7f,%.7f%s]},\"properties\":{\"time\":%.3f%s}}",
+                    first ? "" : ",\n", point->longitude, point->latitude, altitude,
+                    point->time, speed);
+}
+
+/* Function:  GpsExportPage
+ * ------------------------
+ * Build a page of a GPX or GeoJSON document: the first page starts the
+ * document, the last one ends it, so that the concatenated pages make
+ * the whole document. The time window has to be the same for every page.
+ *
+ * query : format, source, time window and position in the export
+ * page : receives the Json object of the page, with the cursor of the
+ *        next page if any
+ *
+ * returns: -1 if the cursor is invalid or expired, or the track cannot be read
+ *          -2 if an allocation failed
+ *          0 if went well
+ */
+int GpsExportPage(const gps_export_query_t *query, json_object **page)
+{
+    struct timespec begin, end;
+    uint64_t cursor = query->cursor;
+    bool more = false;
+    size_t len = 0, size;
+    long count, i;
+    char *text;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    gps_track_point_t *points = malloc(query->limit * sizeof(gps_track_point_t));
+    if (!points)
+        return -2;
+
+    if (query->source == EXPORT_SOURCE_RECORD)
+        count = GpsRecordRead(&cursor, query->resume, query->start, query->end, points,
+                              query->limit, &more);
+    else
+        count = GpsHistoryRead(&cursor, query->resume, query->start, query->end, points,
+                               query->limit, &more);
+    if (count < 0) {
+        free(points);
+        return -1;
+    }
+
+    size = count * EXPORT_POINT_MAX_LEN + 2 * EXPORT_FRAME_MAX_LEN;
+    text = malloc(size);
+    if (!text) {
+        free(points);
+        return -2;
+    }
+
+    bool gpx = query->format == EXPORT_FORMAT_GPX;
+    if (!query->resume)
+        len += snprintf(text + len, size - len, "%s", gpx ? gpx_header : geojson_header);
+    for (i = 0; i < count; i++) {
+        if (gpx)
+            len += ExportPointToGpx(text + len, size - len, &points[i]);
+        else
+            len += ExportPointToGeoJson(text + len, size - len, &points[i],
+                                        !query->resume && i == 0);
+    }
+    if (!more)
+        len += snprintf(text + len, size - len, "%s", gpx ? gpx_footer : geojson_footer);
+
+    *page = json_object_new_object();
+    json_object_object_add(*page, "format",
+                           json_object_new_string(export_format_names[query->format]));
+    json_object_object_add(*page, "source",
+                           json_object_new_string(export_source_names[query->source]));
+    json_object_object_add(*page, "count", json_object_new_int64(count));
+    json_object_object_add(*page, "data", json_object_new_string_len(text, len));
+    if (more)
+        json_object_object_add(*page, "cursor", json_object_new_int64(cursor));
+    free(points);
+    free(text);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_mutex_lock(&ExportMutex);
+    export_stats.pages++;
+    export_stats.fixes += count;
+    export_stats.bytes += len;
+    export_stats.seconds += (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+    pthread_mutex_unlock(&ExportMutex);
+
+    return 0;
+}
+
+/* Function:  GpsExportToJson
+ * --------------------------
+ * Marshal the export counters, with the throughput of the pages built.
+ *
+ * returns: Json object containing the counters
+ */
+json_object *GpsExportToJson()
+{
+    json_object *JsonExport = json_object_new_object();
+
+    pthread_mutex_lock(&ExportMutex);
+    json_object_object_add(JsonExport, "pages", json_object_new_int64(export_stats.pages));
+    json_object_object_add(JsonExport, "fixes", json_object_new_int64(export_stats.fixes));
+    json_object_object_add(JsonExport, "bytes", json_object_new_int64(export_stats.bytes));
+    json_object_object_add(JsonExport, "fixes per second",
+                           json_object_new_double(export_stats.seconds > 0
+                                                      ? export_stats.fixes / export_stats.seconds
+                                                      : 0));
+    pthread_mutex_unlock(&ExportMutex);
+
+    return JsonExport;
+}
@@ -0,0 +1,592 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Condition expressions over fix fields, compiled once into a small
+ * stack machine bytecode and evaluated on each fix.
+ *
+ * Grammar:
+ *   or      := and (("or" | "||") and)*
+ *   and     := not (("and" | "&&") not)*
+ *   not     := ("not" | "!") not | compare
+ *   compare := sum (("<" | "<=" | ">" | ">=" | "==" | "!=") sum)?
+ *   sum     := product (("+" | "-") product)*
+ *   product := unary (("*" | "/") unary)*
+ *   unary   := "-" unary | primary
+ *   primary := number | field | "delta(" field ")" | "abs(" or ")" | "(" or ")"
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp-gps-binding.h"
+
+// Limits of a compiled expression
+#define EXPR_MAX_CODE    128
+#define EXPR_MAX_DEPTH   16
+#define EXPR_MAX_NESTING 64  // parentheses, abs(), unary - and not, bounding the recursion
+
+enum expr_op_enum {
+    OP_CONST,
+    OP_FIELD,
+    OP_DELTA,
+    OP_NEG,
+    OP_ABS,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_AND,
+    OP_OR,
+    OP_NOT
+};
+
+typedef struct expr_instr
+{
+    uint8_t op;     // enum expr_op_enum
+    uint8_t field;  // enum gps_field_enum, for OP_FIELD and OP_DELTA
+    double value;   // for OP_CONST
+} expr_instr;
+
+struct gps_expr
+{
+    unsigned int count;   // number of instructions
+    uint32_t delta_mask;  // fields used through delta()
+    expr_instr code[];
+};
+
+// Field names, indexed by enum gps_field_enum
+static const char *field_names[GPS_FIELD_COUNT] = {
+    "mode",  "visible", "used", "time",    "latitude", "longitude", "altitude", "speed", "speed_kmh",
+    "climb", "heading", "epx",  "epy",     "epv",      "eps",       "epc",      "epd",   "ept",
+};
+
+typedef struct expr_parser
+{
+    const char *cursor;
+    const char *error;
+    int depth;      // stack depth at this point of the code
+    int max_depth;  // deepest stack seen
+    int nesting;    // nested constructs being parsed
+    unsigned int count;
+    uint32_t delta_mask;
+    expr_instr code[EXPR_MAX_CODE];
+} expr_parser;
+
+static void ParseOr(expr_parser *p);
+
+/* Function:  GpsFieldValue
+ * ------------------------
+ * Get a field of a fix snapshot.
+ *
+ * fix : fix snapshot
+ * field : field to get
+ *
+ * returns: field value, NaN if unknown
+ */
+double GpsFieldValue(const gps_fix_snapshot_t *fix, enum gps_field_enum field)
+{
+    switch (field) {
+    case FIELD_MODE:
+        return fix->mode;
+    case FIELD_VISIBLE:
+        return fix->satellites_visible;
+    case FIELD_USED:
+        return fix->satellites_used;
+    case FIELD_TIME:
+        return fix->time;
+    case FIELD_LATITUDE:
+        return fix->latitude;
+    case FIELD_LONGITUDE:
+        return fix->longitude;
+    case FIELD_ALTITUDE:
+        return fix->altitude;
+    case FIELD_SPEED:
+        return fix->speed;
+    case FIELD_SPEED_KMH:
+        return fix->speed * 3.6;
+    case FIELD_CLIMB:
+        return fix->climb;
+    case FIELD_HEADING:
+        return fix->track;
+    case FIELD_EPX:
+        return fix->epx;
+    case FIELD_EPY:
+        return fix->epy;
+    case FIELD_EPV:
+        return fix->epv;
+    case FIELD_EPS:
+        return fix->eps;
+    case FIELD_EPC:
+        return fix->epc;
+    case FIELD_EPD:
+        return fix->epd;
+    case FIELD_EPT:
+        return fix->ept;
+    default:
+        return NAN;
+    }
+}
+
+static void SkipSpaces(expr_parser *p)
+{
+    while (isspace((unsigned char)*p->cursor))
+        p->cursor++;
+}
+
+/* Function:  Accept
+ * -----------------
+ * Consume a token if it is next in the input.
+ * Words are only matched as a whole.
+ *
+ * returns: true if the token was consumed
+ */
+static bool Accept(expr_parser *p, const char *token)
+{
+    size_t len = strlen(token);
+
+    SkipSpaces(p);
+    if (strncasecmp(p->cursor, token, len))
+        return false;
+    if (isalpha((unsigned char)token[0]) &&
+        (isalnum((unsigned char)p->cursor[len]) || p->cursor[len] == '_'))
+        return false;
+
+    p->cursor += len;
+    return true;
+}
+
+/* Function:  Nest
+ * ---------------
+ * Enter a nested construct, before recursing into it.
+ * The recursion is bounded whatever the input length.
+ *
+ * returns: false if too deeply nested, the error is set
+ */
+static bool Nest(expr_parser *p)
+{
+    if (p->nesting >= EXPR_MAX_NESTING) {
+        if (!p->error)
+            p->error = "expression too deep";
+        return false;
+    }
+    p->nesting++;
+    return true;
+}
+
+static void Emit(expr_parser *p, enum expr_op_enum op, int field, double value)
+{
+    if (p->error)
+        return;
+    if (p->count >= EXPR_MAX_CODE) {
+        p->error = "expression too long";
+        return;
+    }
+
+    // Leaves, and binary operators, change the stack depth
+    if (op == OP_CONST || op == OP_FIELD || op == OP_DELTA)
+        p->depth++;
+    else if (op != OP_NEG && op != OP_ABS && op != OP_NOT)
+        p->depth--;
+    if (p->depth > p->max_depth)
+        p->max_depth = p->depth;
+    if (p->max_depth > EXPR_MAX_DEPTH) {
+        p->error = "expression too deep";
+        return;
+    }
+
+    p->code[p->count].op = op;
+    p->code[p->count].field = field;
+    p->code[p->count].value = value;
+    p->count++;
+}
+
+static int ParseField(expr_parser *p)
+{
+    int i;
+
+    SkipSpaces(p);
+    const char *start = p->cursor;
+    while (isalnum((unsigned char)*p->cursor) || *p->cursor == '_')
+        p->cursor++;
+
+    for (i = 0; i < GPS_FIELD_COUNT; i++) {
+        if (strlen(field_names[i]) == (size_t)(p->cursor - start) &&
+            !strncasecmp(start, field_names[i], p->cursor - start))
+            return i;
+    }
+
+    if (!p->error)
+        p->error = "unknown field";
+    return -1;
+}
+
+static void ParsePrimary(expr_parser *p)
+{
+    SkipSpaces(p);
+
+    if (isdigit((unsigned char)*p->cursor) || *p->cursor == '.') {
+        char *end;
+        double value = strtod(p->cursor, &end);
+        p->cursor = end;
+        Emit(p, OP_CONST, 0, value);
+    }
+    else if (Accept(p, "delta") && Accept(p, "(")) {
+        int field = ParseField(p);
+        if (!Accept(p, ")") && !p->error)
+            p->error = "missing ')'";
+        if (field >= 0) {
+            p->delta_mask |= 1u << field;
+            Emit(p, OP_DELTA, field, 0.0);
+        }
+    }
+    else if (Accept(p, "abs") && Accept(p, "(")) {
+        if (!Nest(p))
+            return;
+        ParseOr(p);
+        p->nesting--;
+        if (!Accept(p, ")") && !p->error)
+            p->error = "missing ')'";
+        Emit(p, OP_ABS, 0, 0.0);
+    }
+    else if (Accept(p, "(")) {
+        if (!Nest(p))
+            return;
+        ParseOr(p);
+        p->nesting--;
+        if (!Accept(p, ")") && !p->error)
+            p->error = "missing ')'";
+    }
+    else if (isalpha((unsigned char)*p->cursor)) {
+        int field = ParseField(p);
+        if (field >= 0)
+            Emit(p, OP_FIELD, field, 0.0);
+    }
+    else if (!p->error) {
+        p->error = "unexpected character";
+    }
+}
+
+static void ParseUnary(expr_parser *p)
+{
+    if (Accept(p, "-")) {
+        if (!Nest(p))
+            return;
+        ParseUnary(p);
+        p->nesting--;
+        Emit(p, OP_NEG, 0, 0.0);
+    }
+    else {
+        ParsePrimary(p);
+    }
+}
+
+static void ParseProduct(expr_parser *p)
+{
+    ParseUnary(p);
+    while (!p->error) {
+        if (Accept(p, "*")) {
+            ParseUnary(p);
+            Emit(p, OP_MUL, 0, 0.0);
+        }
+        else if (Accept(p, "/")) {
+            ParseUnary(p);
+            Emit(p, OP_DIV, 0, 0.0);
+        }
+        else
+            break;
+    }
+}
+
+static void ParseSum(expr_parser *p)
+{
+    ParseProduct(p);
+    while (!p->error) {
+        if (Accept(p, "+")) {
+            ParseProduct(p);
+            Emit(p, OP_ADD, 0, 0.0);
+        }
+        else if (Accept(p, "-")) {
+            ParseProduct(p);
+            Emit(p, OP_SUB, 0, 0.0);
+        }
+        else
+            break;
+    }
+}
+
+static void ParseCompare(expr_parser *p)
+{
+    // Longest operators first
+    static const struct
+    {
+        const char *token;
+        enum expr_op_enum op;
+    } operators[] = {{"<=", OP_LE}, {">=", OP_GE}, {"==", OP_EQ}, {"!=", OP_NE},
+                     {"<", OP_LT},  {">", OP_GT}};
+    size_t i;
+
+    ParseSum(p);
+    for (i = 0; i < ARRAY_SIZE(operators); i++) {
+        if (Accept(p, operators[i].token)) {
+            ParseSum(p);
+            Emit(p, operators[i].op, 0, 0.0);
+            break;
+        }
+    }
+}
+
+static void ParseNot(expr_parser *p)
+{
+    SkipSpaces(p);
+    if (Accept(p, "not") || (p->cursor[0] == '!' && p->cursor[1] != '=' && Accept(p, "!"))) {
+        if (!Nest(p))
+            return;
+        ParseNot(p);
+        p->nesting--;
+        Emit(p, OP_NOT, 0, 0.0);
+    }
+    else {
+        ParseCompare(p);
+    }
+}
+
+static void ParseAnd(expr_parser *p)
+{
+    ParseNot(p);
+    while (!p->error && (Accept(p, "and") || Accept(p, "&&"))) {
+        ParseNot(p);
+        Emit(p, OP_AND, 0, 0.0);
+    }
+}
+
+static void ParseOr(expr_parser *p)
+{
+    ParseAnd(p);
+    while (!p->error && (Accept(p, "or") || Accept(p, "||"))) {
+        ParseAnd(p);
+        Emit(p, OP_OR, 0, 0.0);
+    }
+}
+
+/* Function:  GpsExprCompile
+ * -------------------------
+ * Compile a condition expression.
+ *
+ * text : expression source (ex: "speed_kmh > 50 and mode == 3 and epx < 10")
+ * error : where to store a static error message, may be NULL
+ *
+ * returns: the compiled expression, to be released with GpsExprFree
+ *          NULL if the expression is invalid
+ */
+gps_expr_t *GpsExprCompile(const char *text, const char **error)
+{
+    expr_parser *p = calloc(1, sizeof(expr_parser));
+    gps_expr_t *expr = NULL;
+
+    if (!p) {
+        if (error)
+            *error = "allocation error";
+        return NULL;
+    }
+
+    p->cursor = text;
+    ParseOr(p);
+    SkipSpaces(p);
+    if (!p->error && *p->cursor != '\0')
+        p->error = "unexpected trailing characters";
+
+    if (!p->error) {
+        expr = malloc(sizeof(gps_expr_t) + p->count * sizeof(expr_instr));
+        if (expr) {
+            expr->count = p->count;
+            expr->delta_mask = p->delta_mask;
+            memcpy(expr->code, p->code, p->count * sizeof(expr_instr));
+        }
+        else {
+            p->error = "allocation error";
+        }
+    }
+
+    if (error)
+        *error = p->error;
+    free(p);
+    return expr;
+}
+
+void GpsExprFree(gps_expr_t *expr)
+{
+    free(expr);
+}
+
+/* Function:  GpsExprHash
+ * ----------------------
+ * Hash a compiled expression, so that expressions only
+ * differing by their spelling share the same hash.
+ *
+ * returns: 64 bits FNV-1a hash of the bytecode
+ */
+uint64_t GpsExprHash(const gps_expr_t *expr)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    unsigned int i;
+    size_t j;
+
+    for (i = 0; i < expr->count; i++) {
+        // Hash members one by one, the struct padding is not initialized
+        unsigned char bytes[2 + sizeof(double)];
+        bytes[0] = expr->code[i].op;
+        bytes[1] = expr->code[i].field;
+        memcpy(&bytes[2], &expr->code[i].value, sizeof(double));
+        for (j = 0; j < sizeof(bytes); j++) {
+            hash ^= bytes[j];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+/* Function:  GpsExprCapture
+ * -------------------------
+ * Store the reference values used by delta().
+ *
+ * fix : fix snapshot to take the values from
+ * refs : where to store them, GPS_FIELD_COUNT values
+ *
+ * returns: nothing
+ */
+void GpsExprCapture(const gps_expr_t *expr, const gps_fix_snapshot_t *fix, double *refs)
+{
+    int i;
+
+    for (i = 0; i < GPS_FIELD_COUNT; i++) {
+        if (expr->delta_mask & (1u << i))
+            refs[i] = GpsFieldValue(fix, i);
+    }
+}
+
+/* Function:  GpsExprEval
+ * ----------------------
+ * Evaluate a compiled expression against a fix.
+ * Comparisons involving a NaN field are false.
+ *
+ * fix : fix snapshot
+ * refs : reference values for delta(), see GpsExprCapture
+ *
+ * returns: true if the expression is true (non zero)
+ */
+bool GpsExprEval(const gps_expr_t *expr, const gps_fix_snapshot_t *fix, const double *refs)
+{
+    double stack[EXPR_MAX_DEPTH];
+    int top = -1;
+    unsigned int i;
+
+    for (i = 0; i < expr->count; i++) {
+        const expr_instr *in = &expr->code[i];
+        double a, b;
+
+        switch (in->op) {
+        case OP_CONST:
+            stack[++top] = in->value;
+            continue;
+        case OP_FIELD:
+            stack[++top] = GpsFieldValue(fix, in->field);
+            continue;
+        case OP_DELTA:
+            a = GpsFieldValue(fix, in->field) - refs[in->field];
+            // Heading wraps around north
+            if (in->field == FIELD_HEADING)
+                a = remainder(a, 360.0);
+            stack[++top] = a;
+            continue;
+        case OP_NEG:
+            stack[top] = -stack[top];
+            continue;
+        case OP_ABS:
+            stack[top] = fabs(stack[top]);
+            continue;
+        case OP_NOT:
+            stack[top] = !(stack[top] != 0.0 && !isnan(stack[top]));
+            continue;
+        default:
+            break;
+        }
+
+        // Binary operators
+        b = stack[top--];
+        a = stack[top];
+        switch (in->op) {
+        case OP_ADD:
+            a = a + b;
+            break;
+        case OP_SUB:
+            a = a - b;
+            break;
+        case OP_MUL:
+            a = a * b;
+            break;
+        case OP_DIV:
+            a = a / b;
+            break;
+        case OP_LT:
+            a = a < b;
+            break;
+        case OP_LE:
+            a = a <= b;
+            break;
+        case OP_GT:
+            a = a > b;
+            break;
+        case OP_GE:
+            a = a >= b;
+            break;
+        case OP_EQ:
+            a = a == b;
+            break;
+        case OP_NE:
+            a = a != b;
+            break;
+        case OP_AND:
+            a = (a != 0.0 && !isnan(a)) && (b != 0.0 && !isnan(b));
+            break;
+        case OP_OR:
+            a = (a != 0.0 && !isnan(a)) || (b != 0.0 && !isnan(b));
+            break;
+        default:
+            a = NAN;
+            break;
+        }
+        stack[top] = a;
+    }
+
+    return top == 0 && stack[0] != 0.0 && !isnan(stack[0]);
+}
@@ -0,0 +1,897 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Fix history: the latest fixes, kept as compact track blocks in a ring,
+ * indexed by time (the ring is kept sorted) and by position (a grid of
+ * cells, each listing the runs of consecutive fixes it contains), with
+ * area queries and simplification.
+ */
+
+#define _GNU_SOURCE
+#include <json-c/json.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp-gps-binding.h"
+
+// One hour at 10 Hz
+#define HISTORY_DEFAULT_SIZE 36000
+
+// Encoded bytes reserved per fix, about twice what a steady drive takes
+#define HISTORY_FIX_BYTES 12
+
+// Grid cell size, in degrees (about 1.1 km of latitude)
+#define HISTORY_CELL_DEG 0.01
+
+// Buckets of the cell hash table, a power of 2
+#define HISTORY_BUCKETS 4096
+
+// Above this many cells, an area query scans its time window instead
+#define HISTORY_MAX_CELLS 1024
+
+// Meters per degree of latitude, on the mean earth radius used by GetDistanceInMeters
+#define HISTORY_METERS_PER_DEG (6371000.0 * M_PI / 180.0)
+
+#define HISTORY_NONE ULONG_MAX
+
+// Encoded fixes, only the newest block is still appended to
+typedef struct history_block
+{
+    unsigned long first_seq;
+    unsigned int count;
+    size_t offset;  // in the arena
+    size_t len;
+    double first_time;
+    double last_time;
+} history_block_t;
+
+// Consecutive fixes in the same grid cell
+typedef struct history_run
+{
+    uint64_t cell;
+    unsigned long first_seq;
+    unsigned long last_seq;
+    unsigned long next;  // previous run of the same bucket, HISTORY_NONE if none
+} history_run_t;
+
+// Range of fixes matched by a query
+typedef struct history_range
+{
+    unsigned long first_seq;
+    unsigned long last_seq;
+} history_range_t;
+
+// Sequential reader of the fixes
+typedef struct history_cursor
+{
+    unsigned long block;  // id of the block being decoded
+    unsigned long seq;    // seq of the next fix decoded
+    gps_track_decoder_t decoder;
+} history_cursor_t;
+
+static pthread_rwlock_t HistoryLock = PTHREAD_RWLOCK_INITIALIZER;
+
+static struct
+{
+    unsigned long size;           // max fixes, and capacity of the runs
+    uint8_t *arena;               // encoded blocks, written as a ring
+    size_t arena_size;
+    history_block_t *blocks;      // block id is at id % block_slots
+    unsigned long block_slots;
+    unsigned long first_block;    // oldest block still valid
+    unsigned long next_block;     // id of the next block
+    gps_track_encoder_t encoder;  // of the newest block
+    gps_track_point_t newest;     // latest fix appended
+    history_run_t *runs;          // run id is at id % size
+    unsigned long *buckets;       // latest run id of each bucket
+    unsigned long next_seq;       // seq of the next fix
+    unsigned long next_run;       // id of the next run
+    unsigned long resets;         // clears after the fix time went backwards
+} history;
+
+/* Function:  HistoryCellCoord
+ * ---------------------------
+ * Get the grid coordinate of a latitude or a longitude.
+ *
+ * returns: the coordinate
+ */
+static long HistoryCellCoord(double degrees)
+{
+    return (long)floor(degrees / HISTORY_CELL_DEG);
+}
+
+/* Function:  HistoryCell
+ * ----------------------
+ * Build the key of a grid cell, the longitude wrapping around.
+ *
+ * returns: the key
+ */
+static uint64_t HistoryCell(long lat, long lon)
+{
+    long lon_cells = (long)lround(360.0 / HISTORY_CELL_DEG);
+
+    lon %= lon_cells;
+    if (lon < 0)
+        lon += lon_cells;
+    return ((uint64_t)(uint32_t)lat << 32) | (uint32_t)lon;
+}
+
+/* Function:  HistoryBucket
+ * ------------------------
+ * Hash a cell key.
+ *
+ * returns: the bucket of the cell
+ */
+static unsigned int HistoryBucket(uint64_t cell)
+{
+    cell ^= cell >> 33;
+    cell *= 0xff51afd7ed558ccdULL;
+    cell ^= cell >> 33;
+    return cell & (HISTORY_BUCKETS - 1);
+}
+
+/* Function:  HistoryBlock
+ * -----------------------
+ * HistoryLock must be held by the caller.
+ *
+ * returns: the block of a valid id
+ */
+static history_block_t *HistoryBlock(unsigned long id)
+{
+    return &history.blocks[id % history.block_slots];
+}
+
+/* Function:  HistoryEmpty
+ * -----------------------
+ * HistoryLock must be held by the caller.
+ *
+ * returns: true if there is no fix
+ */
+static bool HistoryEmpty()
+{
+    return history.first_block == history.next_block;
+}
+
+/* Function:  HistoryOldest
+ * ------------------------
+ * Get the oldest fix still in the ring.
+ * HistoryLock must be held by the caller.
+ *
+ * returns: its seq, equal to history.next_seq if empty
+ */
+static unsigned long HistoryOldest()
+{
+    return HistoryEmpty() ? history.next_seq : HistoryBlock(history.first_block)->first_seq;
+}
+
+/* Function:  HistoryRunAlive
+ * --------------------------
+ * HistoryLock must be held by the caller.
+ *
+ * returns: true if the run has not been overwritten yet
+ */
+static bool HistoryRunAlive(unsigned long id)
+{
+    return id != HISTORY_NONE && id < history.next_run && history.next_run - id <= history.size;
+}
+
+/* Function:  HistoryCursorOpen
+ * ----------------------------
+ * Start reading a block.
+ * HistoryLock must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void HistoryCursorOpen(history_cursor_t *cursor, unsigned long id)
+{
+    const history_block_t *block = HistoryBlock(id);
+
+    cursor->block = id;
+    cursor->seq = block->first_seq;
+    GpsTrackDecoderInit(&cursor->decoder, history.arena + block->offset, block->len,
+                        block->count);
+}
+
+/* Function:  HistoryCursorSeek
+ * ----------------------------
+ * Move a cursor to a fix, decoding from the keyframe of its block
+ * unless the cursor is already before it in the same block.
+ * HistoryLock must be held by the caller.
+ *
+ * cursor : cursor to move, its block is HISTORY_NONE if not opened yet
+ * seq : valid seq of the fix
+ *
+ * returns: nothing
+ */
+static void HistoryCursorSeek(history_cursor_t *cursor, unsigned long seq)
+{
+    unsigned long lo = history.first_block, hi = history.next_block - 1;
+    gps_track_point_t point;
+
+    // Last block starting at or before seq
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo + 1) / 2;
+        if (HistoryBlock(mid)->first_seq <= seq)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    if (cursor->block != lo || cursor->seq > seq)
+        HistoryCursorOpen(cursor, lo);
+    while (cursor->seq < seq && GpsTrackDecode(&cursor->decoder, &point) > 0)
+        cursor->seq++;
+}
+
+/* Function:  HistoryCursorNext
+ * ----------------------------
+ * Read the fix under a cursor and move to the next one.
+ * HistoryLock must be held by the caller.
+ *
+ * returns: false after the newest fix
+ */
+static bool HistoryCursorNext(history_cursor_t *cursor, gps_track_point_t *point)
+{
+    while (GpsTrackDecode(&cursor->decoder, point) <= 0) {
+        if (cursor->block + 1 >= history.next_block)
+            return false;
+        HistoryCursorOpen(cursor, cursor->block + 1);
+    }
+    cursor->seq++;
+    return true;
+}
+
+/* Function:  HistoryLowerBound
+ * ----------------------------
+ * Binary search of the first fix at or after a time, the ring
+ * being sorted by time: among the blocks, then within one.
+ * HistoryLock must be held by the caller.
+ *
+ * time : fix timestamp, in s
+ *
+ * returns: the seq of the fix, history.next_seq if none
+ */
+static unsigned long HistoryLowerBound(double time)
+{
+    unsigned long lo = history.first_block, hi = history.next_block;
+    history_cursor_t cursor;
+    gps_track_point_t point;
+
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2;
+        if (HistoryBlock(mid)->last_time < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == history.next_block)
+        return history.next_seq;
+
+    HistoryCursorOpen(&cursor, lo);
+    while (GpsTrackDecode(&cursor.decoder, &point) > 0 && point.time < time)
+        cursor.seq++;
+    return cursor.seq;
+}
+
+/* Function:  HistoryBlockOpen
+ * ---------------------------
+ * Start a new block after the newest one, dropping the oldest blocks
+ * to make room for it: in the arena, and in the fixes count.
+ * HistoryLock must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void HistoryBlockOpen()
+{
+    size_t offset = 0;
+
+    if (!HistoryEmpty()) {
+        const history_block_t *newest = HistoryBlock(history.next_block - 1);
+        offset = newest->offset + newest->len;
+    }
+    if (offset + GPS_TRACK_BLOCK_MAX_LEN > history.arena_size)
+        offset = 0;
+
+    // The blocks written over are always the oldest ones
+    while (!HistoryEmpty()) {
+        const history_block_t *oldest = HistoryBlock(history.first_block);
+        bool overlaps = oldest->offset < offset + GPS_TRACK_BLOCK_MAX_LEN &&
+                        offset < oldest->offset + oldest->len;
+        if (!overlaps && history.next_block - history.first_block < history.block_slots &&
+            history.next_seq - oldest->first_seq + GPS_TRACK_BLOCK_POINTS <= history.size)
+            break;
+        history.first_block++;
+    }
+
+    history_block_t *block = HistoryBlock(history.next_block++);
+    block->first_seq = history.next_seq;
+    block->count = 0;
+    block->offset = offset;
+    block->len = 0;
+    GpsTrackEncoderInit(&history.encoder, history.arena + offset, GPS_TRACK_BLOCK_MAX_LEN);
+}
+
+/* Function:  GpsHistoryInit
+ * -------------------------
+ * Allocate the history, its size is read from the environment.
+ *
+ * returns: -1 if failed
+ *          0 if went well (or disabled)
+ */
+int GpsHistoryInit()
+{
+    unsigned int i;
+    long size = atol(getenv("RPGPS_HISTORY_SIZE") ?: "-1");
+
+    if (size < 0)
+        size = HISTORY_DEFAULT_SIZE;
+    if (size == 0)
+        return 0;
+    if (size < GPS_TRACK_BLOCK_POINTS)
+        size = GPS_TRACK_BLOCK_POINTS;
+
+    history.block_slots = size / GPS_TRACK_BLOCK_POINTS + 2;
+    history.arena_size = size * HISTORY_FIX_BYTES + GPS_TRACK_BLOCK_MAX_LEN;
+    history.arena = malloc(history.arena_size);
+    history.blocks = calloc(history.block_slots, sizeof(history_block_t));
+    history.runs = calloc(size, sizeof(history_run_t));
+    history.buckets = malloc(HISTORY_BUCKETS * sizeof(unsigned long));
+    if (!history.arena || !history.blocks || !history.runs || !history.buckets) {
+        AFB_ERROR("Cannot allocate a history of %ld fixes", size);
+        free(history.arena);
+        free(history.blocks);
+        free(history.runs);
+        free(history.buckets);
+        return -1;
+    }
+    for (i = 0; i < HISTORY_BUCKETS; i++)
+        history.buckets[i] = HISTORY_NONE;
+
+    history.size = size;
+    return 0;
+}
+
+/* Function:  GpsHistoryAppend
+ * ---------------------------
+ * Add a new fix to the history, in constant time.
+ * Called from the polling thread only.
+ *
+ * point : fix to add
+ *
+ * returns: nothing
+ */
+void GpsHistoryAppend(const gps_track_point_t *point)
+{
+    if (!history.size || isnan(point->time) || isnan(point->latitude) ||
+        isnan(point->longitude))
+        return;
+
+    uint64_t cell =
+        HistoryCell(HistoryCellCoord(point->latitude), HistoryCellCoord(point->longitude));
+
+    pthread_rwlock_wrlock(&HistoryLock);
+    if (!HistoryEmpty() && point->time <= history.newest.time) {
+        // Keep the ring sorted: drop repeated fixes, forget the past on a time jump back
+        if (point->time > history.newest.time - 1.0) {
+            pthread_rwlock_unlock(&HistoryLock);
+            return;
+        }
+        AFB_NOTICE("Fix time went backwards by %.1fs, clearing the history",
+                   history.newest.time - point->time);
+        history.first_block = history.next_block;
+        history.resets++;
+    }
+
+    if (HistoryEmpty() || GpsTrackEncode(&history.encoder, point) < 0) {
+        HistoryBlockOpen();
+        GpsTrackEncode(&history.encoder, point);
+    }
+    history_block_t *block = HistoryBlock(history.next_block - 1);
+    if (block->count == 0)
+        block->first_time = point->time;
+    block->last_time = point->time;
+    block->count = history.encoder.count;
+    block->len = history.encoder.len;
+
+    // Extend the current run while in the same cell, open a new one otherwise
+    unsigned long seq = history.next_seq;
+    history_run_t *run = NULL;
+    if (history.next_run > 0) {
+        run = &history.runs[(history.next_run - 1) % history.size];
+        if (run->cell != cell || run->last_seq + 1 != seq)
+            run = NULL;
+    }
+    if (run) {
+        run->last_seq = seq;
+    }
+    else {
+        unsigned int bucket = HistoryBucket(cell);
+        unsigned long id = history.next_run++;
+        run = &history.runs[id % history.size];
+        run->cell = cell;
+        run->first_seq = run->last_seq = seq;
+        run->next = history.buckets[bucket];
+        history.buckets[bucket] = id;
+    }
+
+    history.newest = *point;
+    history.next_seq++;
+    pthread_rwlock_unlock(&HistoryLock);
+}
+
+/* Function:  HistoryRangeAdd
+ * --------------------------
+ * Append a range to a growing array.
+ *
+ * returns: -1 if failed
+ *          0 if went well
+ */
+static int HistoryRangeAdd(history_range_t **ranges,
+                           size_t *count,
+                           size_t *allocated,
+                           unsigned long first_seq,
+                           unsigned long last_seq)
+{
+    if (*count == *allocated) {
+        size_t grown = *allocated ? *allocated * 2 : 64;
+        history_range_t *tmp = realloc(*ranges, grown * sizeof(history_range_t));
+        if (!tmp)
+            return -1;
+        *ranges = tmp;
+        *allocated = grown;
+    }
+    (*ranges)[*count].first_seq = first_seq;
+    (*ranges)[*count].last_seq = last_seq;
+    (*count)++;
+    return 0;
+}
+
+static int HistoryRangeCompare(const void *a, const void *b)
+{
+    const history_range_t *ra = a, *rb = b;
+
+    return ra->first_seq < rb->first_seq ? -1 : ra->first_seq > rb->first_seq;
+}
+
+/* Function:  HistoryCellRanges
+ * ----------------------------
+ * Collect the runs of the fixes of [first_seq, last_seq] that lie in
+ * the cells of an area, from the grid index.
+ * HistoryLock must be held by the caller.
+ *
+ * query : area to look into
+ * ranges, count, allocated : growing array receiving the ranges, unsorted
+ *
+ * returns: -1 if failed
+ *          0 if went well
+ */
+static int HistoryCellRanges(const gps_history_query_t *query,
+                             unsigned long first_seq,
+                             unsigned long last_seq,
+                             history_range_t **ranges,
+                             size_t *count,
+                             size_t *allocated)
+{
+    long lat, lon;
+    long lat_min = HistoryCellCoord(query->south), lat_max = HistoryCellCoord(query->north);
+    long lon_min = HistoryCellCoord(query->west);
+    long lon_max = HistoryCellCoord(query->east < query->west ? query->east + 360.0 : query->east);
+
+    for (lat = lat_min; lat <= lat_max; lat++) {
+        for (lon = lon_min; lon <= lon_max; lon++) {
+            uint64_t cell = HistoryCell(lat, lon);
+            unsigned long id = history.buckets[HistoryBucket(cell)];
+
+            // Runs of a bucket go from the newest to the oldest
+            while (HistoryRunAlive(id)) {
+                const history_run_t *run = &history.runs[id % history.size];
+                if (run->last_seq < first_seq)
+                    break;
+                if (run->cell == cell && run->first_seq <= last_seq &&
+                    HistoryRangeAdd(ranges, count, allocated,
+                                    run->first_seq > first_seq ? run->first_seq : first_seq,
+                                    run->last_seq < last_seq ? run->last_seq : last_seq) < 0)
+                    return -1;
+                id = run->next;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Function:  HistoryInArea
+ * ------------------------
+ * Check if a fix lies in the area of a query.
+ *
+ * returns: true if in, or if the query has no area
+ */
+static bool HistoryInArea(const gps_history_query_t *query, const gps_track_point_t *point)
+{
+    switch (query->area) {
+    case HISTORY_AREA_RADIUS:
+        return GetDistanceInMeters(query->latitude, query->longitude, point->latitude,
+                                   point->longitude) <= query->radius;
+    case HISTORY_AREA_BBOX:
+        if (point->latitude < query->south || point->latitude > query->north)
+            return false;
+        if (query->west <= query->east)
+            return point->longitude >= query->west && point->longitude <= query->east;
+        return point->longitude >= query->west || point->longitude <= query->east;
+    default:
+        return true;
+    }
+}
+
+/* Function:  HistorySimplify
+ * --------------------------
+ * Douglas-Peucker simplification of a segment, without recursion.
+ * Distances are measured on a local plane, which is accurate enough
+ * for the tolerances and the segment lengths involved.
+ *
+ * points : fixes of the segment
+ * count : number of fixes
+ * tolerance : max distance of a dropped fix to the simplified line, in m
+ * keep : receives the fixes to keep
+ *
+ * returns: -1 if failed
+ *          0 if went well
+ */
+static int HistorySimplify(const gps_track_point_t *points,
+                           size_t count,
+                           double tolerance,
+                           bool *keep)
+{
+    size_t *stack, top = 0, i;
+    double scale = cos(points[0].latitude * M_PI / 180.0);
+
+    memset(keep, 0, count);
+    keep[0] = keep[count - 1] = true;
+    if (count < 3)
+        return 0;
+
+    stack = malloc(2 * count * sizeof(size_t));
+    if (!stack)
+        return -1;
+    stack[top++] = 0;
+    stack[top++] = count - 1;
+
+    while (top) {
+        size_t last = stack[--top], first = stack[--top];
+        size_t farthest = first;
+        double max = tolerance;
+
+        double ax = points[first].longitude * scale, ay = points[first].latitude;
+        double dx = points[last].longitude * scale - ax, dy = points[last].latitude - ay;
+        double len2 = dx * dx + dy * dy;
+
+        for (i = first + 1; i < last; i++) {
+            double px = points[i].longitude * scale - ax, py = points[i].latitude - ay;
+            double t = len2 > 0 ? (px * dx + py * dy) / len2 : 0.0;
+            if (t < 0.0)
+                t = 0.0;
+            else if (t > 1.0)
+                t = 1.0;
+            double ex = px - t * dx, ey = py - t * dy;
+            double distance = sqrt(ex * ex + ey * ey) * HISTORY_METERS_PER_DEG;
+            if (distance > max) {
+                max = distance;
+                farthest = i;
+            }
+        }
+
+        if (farthest != first) {
+            keep[farthest] = true;
+            if (farthest - first > 1) {
+                stack[top++] = first;
+                stack[top++] = farthest;
+            }
+            if (last - farthest > 1) {
+                stack[top++] = farthest;
+                stack[top++] = last;
+            }
+        }
+    }
+    free(stack);
+    return 0;
+}
+
+/* Function:  HistorySegmentToJson
+ * -------------------------------
+ * Marshal the fixes of a segment, simplified if asked to.
+ *
+ * returns: Json array of [timestamp, latitude, longitude(, altitude)]
+ *          NULL if failed
+ */
+static json_object *HistorySegmentToJson(const gps_track_point_t *points,
+                                         size_t count,
+                                         double tolerance,
+                                         size_t *kept)
+{
+    bool *keep = NULL;
+    size_t i;
+
+    if (tolerance > 0) {
+        keep = malloc(count * sizeof(bool));
+        if (!keep || HistorySimplify(points, count, tolerance, keep) < 0) {
+            free(keep);
+            return NULL;
+        }
+    }
+
+    json_object *JsonSegment = json_object_new_array();
+    for (i = 0; i < count; i++) {
+        if (keep && !keep[i])
+            continue;
+        json_object *JsonPoint = json_object_new_array();
+        json_object_array_add(JsonPoint, json_object_new_double(points[i].time));
+        json_object_array_add(JsonPoint, json_object_new_double(points[i].latitude));
+        json_object_array_add(JsonPoint, json_object_new_double(points[i].longitude));
+        if (!isnan(points[i].altitude))
+            json_object_array_add(JsonPoint, json_object_new_double(points[i].altitude));
+        json_object_array_add(JsonSegment, JsonPoint);
+        (*kept)++;
+    }
+    free(keep);
+    return JsonSegment;
+}
+
+/* Function:  GpsHistoryQuery
+ * --------------------------
+ * Get the fixes of a time window, optionally in an area and simplified.
+ * The time window is found by binary search and the area through the
+ * grid index, so only the matching part of the history is read.
+ * Consecutive matching fixes make a segment, simplified on its own.
+ * The fixes are copied under the lock, the Json being built once
+ * it is released so that the history is not held meanwhile.
+ *
+ * query : time window, area and tolerance
+ *
+ * returns: Json object with the segments
+ *          NULL if failed
+ */
+json_object *GpsHistoryQuery(const gps_history_query_t *query)
+{
+    gps_history_query_t area = *query;
+    history_range_t *ranges = NULL, *segments = NULL;
+    gps_track_point_t *points = NULL;
+    size_t range_count = 0, range_allocated = 0, point_count = 0, point_allocated = 0;
+    size_t segment_count = 0, segment_allocated = 0, segment_first = 0;
+    size_t kept = 0, matched = 0, i;
+    unsigned long seq, previous = HISTORY_NONE;
+    history_cursor_t cursor = {.block = HISTORY_NONE};
+    gps_track_point_t point;
+    json_object *JsonSegments = json_object_new_array();
+    json_object *JsonResult;
+
+    // Bounding box of a radius, for the grid index
+    if (area.area == HISTORY_AREA_RADIUS) {
+        double dlat = area.radius / HISTORY_METERS_PER_DEG;
+        double dlon = dlat / cos(area.latitude * M_PI / 180.0);
+        area.south = fmax(area.latitude - dlat, -90.0);
+        area.north = fmin(area.latitude + dlat, 90.0);
+        if (area.north >= 90.0 || area.south <= -90.0 || !(dlon < 180.0)) {
+            area.west = -180.0;
+            area.east = 180.0;
+        }
+        else {
+            area.west = remainder(area.longitude - dlon, 360.0);
+            area.east = remainder(area.longitude + dlon, 360.0);
+        }
+    }
+
+    pthread_rwlock_rdlock(&HistoryLock);
+    if (!history.size || HistoryEmpty())
+        goto done;
+
+    // Time window, relative to the newest fix if asked so
+    double start = area.start, end = area.end;
+    if (area.last > 0) {
+        end = history.newest.time;
+        start = end - area.last;
+    }
+    unsigned long first_seq = HistoryLowerBound(start);
+    unsigned long end_seq = HistoryLowerBound(nextafter(end, INFINITY));
+    if (first_seq >= end_seq)
+        goto done;
+
+    bool indexed = false;
+    if (area.area != HISTORY_AREA_NONE) {
+        double lon_span = area.east - area.west + (area.east < area.west ? 360.0 : 0.0);
+        double cells = (HistoryCellCoord(area.north) - HistoryCellCoord(area.south) + 1) *
+                       (floor(lon_span / HISTORY_CELL_DEG) + 2);
+        indexed = cells <= HISTORY_MAX_CELLS && cells < end_seq - first_seq;
+    }
+    if (indexed) {
+        if (HistoryCellRanges(&area, first_seq, end_seq - 1, &ranges, &range_count,
+                              &range_allocated) < 0)
+            goto failed;
+        qsort(ranges, range_count, sizeof(history_range_t), HistoryRangeCompare);
+    }
+    else if (HistoryRangeAdd(&ranges, &range_count, &range_allocated, first_seq, end_seq - 1) <
+             0) {
+        goto failed;
+    }
+
+    // Ranges are sorted and disjoint, a gap between matching fixes ends a segment
+    for (i = 0; i < range_count; i++) {
+        HistoryCursorSeek(&cursor, ranges[i].first_seq);
+        for (seq = ranges[i].first_seq; seq <= ranges[i].last_seq; seq++) {
+            if (!HistoryCursorNext(&cursor, &point))
+                break;
+            if (!HistoryInArea(&area, &point))
+                continue;
+
+            // Segments are kept as ranges of indexes in points
+            if (point_count && seq != previous + 1) {
+                if (HistoryRangeAdd(&segments, &segment_count, &segment_allocated, segment_first,
+                                    point_count - 1) < 0)
+                    goto failed;
+                segment_first = point_count;
+            }
+
+            if (point_count == point_allocated) {
+                size_t grown = point_allocated ? point_allocated * 2 : 256;
+                gps_track_point_t *tmp = realloc(points, grown * sizeof(gps_track_point_t));
+                if (!tmp)
+                    goto failed;
+                points = tmp;
+                point_allocated = grown;
+            }
+            points[point_count++] = point;
+            previous = seq;
+            matched++;
+        }
+    }
+    if (point_count && HistoryRangeAdd(&segments, &segment_count, &segment_allocated,
+                                       segment_first, point_count - 1) < 0)
+        goto failed;
+
+done:
+    pthread_rwlock_unlock(&HistoryLock);
+
+    for (i = 0; i < segment_count; i++) {
+        json_object *JsonSegment =
+            HistorySegmentToJson(points + segments[i].first_seq,
+                                 segments[i].last_seq - segments[i].first_seq + 1, area.tolerance,
+                                 &kept);
+        if (!JsonSegment) {
+            AFB_ERROR("History query failed: allocation error.");
+            goto release;
+        }
+        json_object_array_add(JsonSegments, JsonSegment);
+    }
+
+    JsonResult = json_object_new_object();
+    json_object_object_add(JsonResult, "matched", json_object_new_int64(matched));
+    json_object_object_add(JsonResult, "count", json_object_new_int64(kept));
+    json_object_object_add(JsonResult, "segments", JsonSegments);
+    free(ranges);
+    free(segments);
+    free(points);
+    return JsonResult;
+
+failed:
+    pthread_rwlock_unlock(&HistoryLock);
+    AFB_ERROR("History query failed: allocation error.");
+release:
+    json_object_put(JsonSegments);
+    free(ranges);
+    free(segments);
+    free(points);
+    return NULL;
+}
+
+/* Function:  GpsHistoryRead
+ * -------------------------
+ * Read the fixes of a time window a page at a time, decoding them
+ * straight from the stored blocks.
+ *
+ * cursor : seq of the first fix to read, receives the one of the next page
+ * resume : false to start at the beginning of the window
+ * start, end : time window, fix timestamps in s
+ * points : receives the fixes
+ * max : room in points
+ * more : receives true if the window has fixes after this page
+ *
+ * returns: the number of fixes read
+ *          -1 if the cursor is no longer (or not yet) in the history
+ */
+long GpsHistoryRead(uint64_t *cursor,
+                    bool resume,
+                    double start,
+                    double end,
+                    gps_track_point_t *points,
+                    unsigned int max,
+                    bool *more)
+{
+    history_cursor_t reader = {.block = HISTORY_NONE};
+    gps_track_point_t point;
+    long count = 0;
+
+    *more = false;
+    pthread_rwlock_rdlock(&HistoryLock);
+    if (!history.size) {
+        pthread_rwlock_unlock(&HistoryLock);
+        return resume ? -1 : 0;
+    }
+
+    unsigned long seq = resume ? *cursor : HistoryLowerBound(start);
+    if (seq < HistoryOldest() || seq > history.next_seq) {
+        pthread_rwlock_unlock(&HistoryLock);
+        return -1;
+    }
+
+    if (seq < history.next_seq) {
+        HistoryCursorSeek(&reader, seq);
+        while (HistoryCursorNext(&reader, &point) && point.time <= end) {
+            if (count == max) {
+                *more = true;
+                break;
+            }
+            points[count++] = point;
+            seq++;
+        }
+    }
+    pthread_rwlock_unlock(&HistoryLock);
+
+    *cursor = seq;
+    return count;
+}
+
+/* Function:  GpsHistoryToJson
+ * ---------------------------
+ * Marshal the history state.
+ *
+ * returns: Json object containing the state
+ */
+json_object *GpsHistoryToJson()
+{
+    json_object *JsonHistory = json_object_new_object();
+    unsigned long id;
+    size_t bytes = 0;
+
+    pthread_rwlock_rdlock(&HistoryLock);
+    unsigned long count = history.next_seq - HistoryOldest();
+    unsigned long runs = history.next_run < history.size ? history.next_run : history.size;
+    for (id = history.first_block; id < history.next_block; id++)
+        bytes += HistoryBlock(id)->len;
+
+    json_object_object_add(JsonHistory, "size", json_object_new_int64(history.size));
+    json_object_object_add(JsonHistory, "count", json_object_new_int64(count));
+    json_object_object_add(JsonHistory, "bytes", json_object_new_int64(bytes));
+    json_object_object_add(JsonHistory, "runs", json_object_new_int64(runs));
+    json_object_object_add(JsonHistory, "resets", json_object_new_int64(history.resets));
+    if (count) {
+        json_object_object_add(
+            JsonHistory, "oldest",
+            json_object_new_double(HistoryBlock(history.first_block)->first_time));
+        json_object_object_add(JsonHistory, "newest",
+                               json_object_new_double(history.newest.time));
+    }
+    pthread_rwlock_unlock(&HistoryLock);
+
+    return JsonHistory;
+}
@@ -0,0 +1,328 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Gps data payload marshalling: the fix is written as JSON text straight
+ * into a pool of reusable buffers, without building a json-c tree.
+ */
+
+#define _GNU_SOURCE
+#include <gps.h>
+#include <json-c/json.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp-gps-binding.h"
+
+// Fields of the gps data payload, in marshalling order
+static const struct
+{
+    const char *key;  // quoted, followed by the separator
+    enum gps_field_enum field;
+    bool is_int;
+    bool only_3d;   // only sent with a 3D fix
+    bool keep_nan;  // sent even if NaN
+} payload_fields[] = {
+    {"\"visible satellites\":", FIELD_VISIBLE, true, false, true},
+    {"\"used satellites\":", FIELD_USED, true, false, true},
+    {"\"mode\":", FIELD_MODE, true, false, true},
+    {"\"latitude\":", FIELD_LATITUDE, false, false, false},
+    {"\"latitude error\":", FIELD_EPY, false, false, false},
+    {"\"longitude\":", FIELD_LONGITUDE, false, false, false},
+    {"\"longitude error\":", FIELD_EPX, false, false, false},
+    {"\"speed\":", FIELD_SPEED, false, false, false},
+    {"\"speed error\":", FIELD_EPS, false, false, false},
+    {"\"altitude\":", FIELD_ALTITUDE, false, true, false},
+    {"\"altitude error\":", FIELD_EPV, false, true, false},
+    {"\"climb\":", FIELD_CLIMB, false, true, false},
+    {"\"climb error\":", FIELD_EPC, false, true, false},
+    {"\"heading (true north)\":", FIELD_HEADING, false, false, false},
+    {"\"heading error\":", FIELD_EPD, false, false, false},
+    {"\"timestamp\":", FIELD_TIME, false, false, true},
+    {"\"timestamp error\":", FIELD_EPT, false, false, false},
+};
+
+// Room for every field with the longest values, and every triggered condition
+#define PAYLOAD_MAX_LEN 1664
+
+// Longest number written by PayloadPutDouble or PayloadPutInt
+#define PAYLOAD_NUMBER_MAX_LEN 32
+
+// Reusable payload buffer, busy as long as the binder holds its data
+typedef struct payload_slot
+{
+    bool busy;
+    char text[PAYLOAD_MAX_LEN];
+} payload_slot_t;
+
+static payload_slot_t *payload_pool;
+static unsigned int payload_pool_size;
+
+/* Function:  PayloadPutInt
+ * ------------------------
+ * Write an integer.
+ *
+ * p : where to write, at least PAYLOAD_NUMBER_MAX_LEN bytes
+ * value : integer to write
+ *
+ * returns: end of the written text
+ */
+static char *PayloadPutInt(char *p, int value)
+{
+    char digits[12];
+    int n = 0;
+    unsigned int u = value < 0 ? -(unsigned int)value : (unsigned int)value;
+
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (value < 0)
+        *p++ = '-';
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+/* Function:  PayloadPutDouble
+ * ---------------------------
+ * Write a double as json-c does by default: "%.17g", with a ".0"
+ * added to integral values so that they stay doubles for the clients,
+ * and NaN and infinities spelled the json-c way.
+ *
+ * p : where to write, at least PAYLOAD_NUMBER_MAX_LEN bytes
+ * value : double to write
+ *
+ * returns: end of the written text
+ */
+static char *PayloadPutDouble(char *p, double value)
+{
+    int len;
+
+    if (isnan(value))
+        return stpcpy(p, "NaN");
+    if (isinf(value))
+        return stpcpy(p, value > 0 ? "Infinity" : "-Infinity");
+
+    len = snprintf(p, PAYLOAD_NUMBER_MAX_LEN, "%.17g", value);
+    if (!memchr(p, '.', len) && !memchr(p, 'e', len)) {
+        p[len++] = '.';
+        p[len++] = '0';
+    }
+    return p + len;
+}
+
+/* Function:  PayloadPutMember
+ * ---------------------------
+ * Write a double member, after a comma, unless it is NaN.
+ *
+ * p : where to write
+ * key : quoted key, followed by the separator
+ * value : double to write
+ *
+ * returns: end of the written text
+ */
+static char *PayloadPutMember(char *p, const char *key, double value)
+{
+    if (isnan(value) && !SEND_NAN_VALUES)
+        return p;
+
+    *p++ = ',';
+    p = stpcpy(p, key);
+    return PayloadPutDouble(p, value);
+}
+
+/* Function:  PayloadEncode
+ * ------------------------
+ * Write a fix as a JSON object, with the same fields as
+ * a json-c object built from it would have, plus the asked
+ * projected coordinates, its age when it is stale and the
+ * conditions of a composite event that triggered the push.
+ *
+ * text : where to write, at least PAYLOAD_MAX_LEN bytes
+ * fix : fix to marshal
+ * proj : projections of the fix
+ * projections : projections to write, bits of gps_proj_enum
+ * triggered : indexes of the triggered conditions, as bits
+ *
+ * returns: length of the text, without the terminating zero
+ */
+static size_t PayloadEncode(char *text,
+                            const gps_fix_snapshot_t *fix,
+                            const gps_projected_t *proj,
+                            unsigned int projections,
+                            uint32_t triggered)
+{
+    char *p = text;
+    unsigned int i;
+
+    *p++ = '{';
+    for (i = 0; i < ARRAY_SIZE(payload_fields); i++) {
+        double value = GpsFieldValue(fix, payload_fields[i].field);
+
+        if (payload_fields[i].only_3d && fix->mode != MODE_3D)
+            continue;
+        if (isnan(value) && !payload_fields[i].keep_nan && !SEND_NAN_VALUES)
+            continue;
+
+        if (p[-1] != '{')
+            *p++ = ',';
+        p = stpcpy(p, payload_fields[i].key);
+        p = payload_fields[i].is_int ? PayloadPutInt(p, (int)value) : PayloadPutDouble(p, value);
+    }
+    if ((projections & GPS_PROJ_BIT(PROJ_UTM)) && proj->utm_zone) {
+        p = stpcpy(p, ",\"utm zone\":");
+        p = PayloadPutInt(p, proj->utm_zone);
+        p = stpcpy(p, ",\"utm hemisphere\":");
+        p = stpcpy(p, proj->utm_north ? "\"N\"" : "\"S\"");
+        p = PayloadPutMember(p, "\"utm easting\":", proj->utm_easting);
+        p = PayloadPutMember(p, "\"utm northing\":", proj->utm_northing);
+    }
+    if (projections & GPS_PROJ_BIT(PROJ_ENU)) {
+        p = PayloadPutMember(p, "\"enu east\":", proj->enu_east);
+        p = PayloadPutMember(p, "\"enu north\":", proj->enu_north);
+        p = PayloadPutMember(p, "\"enu up\":", proj->enu_up);
+    }
+    if (projections & GPS_PROJ_BIT(PROJ_ECEF)) {
+        p = PayloadPutMember(p, "\"ecef x\":", proj->ecef_x);
+        p = PayloadPutMember(p, "\"ecef y\":", proj->ecef_y);
+        p = PayloadPutMember(p, "\"ecef z\":", proj->ecef_z);
+    }
+    if (fix->stale) {
+        p = stpcpy(p, ",\"stale\":true,\"age\":");
+        p = PayloadPutDouble(p, fix->age);
+    }
+    if (triggered) {
+        p = stpcpy(p, ",\"triggered\":[");
+        for (i = 0; triggered; i++, triggered >>= 1) {
+            if (!(triggered & 1))
+                continue;
+            if (p[-1] != '[')
+                *p++ = ',';
+            p = PayloadPutInt(p, i);
+        }
+        *p++ = ']';
+    }
+    *p++ = '}';
+    *p = '\0';
+
+    return p - text;
+}
+
+/* Function:  GpsPayloadPoolInit
+ * -----------------------------
+ * Preallocate the payload buffers.
+ *
+ * count : number of buffers
+ *
+ * returns: -1 if failed
+ *          0 if well allocated
+ */
+int GpsPayloadPoolInit(unsigned int count)
+{
+    payload_pool = calloc(count, sizeof(payload_slot_t));
+    if (!payload_pool)
+        return -1;
+
+    payload_pool_size = count;
+    return 0;
+}
+
+/* Function:  GpsPayloadPoolFree
+ * -----------------------------
+ * Count the payload buffers not held by the binder.
+ *
+ * returns: number of free buffers
+ */
+unsigned int GpsPayloadPoolFree()
+{
+    unsigned int i, count = 0;
+
+    for (i = 0; i < payload_pool_size; i++) {
+        if (!__atomic_load_n(&payload_pool[i].busy, __ATOMIC_RELAXED))
+            count++;
+    }
+    return count;
+}
+
+/* Function:  PayloadRelease
+ * -------------------------
+ * Called by the binder once a pooled payload is not used anymore.
+ *
+ * returns: nothing
+ */
+static void PayloadRelease(void *closure)
+{
+    payload_slot_t *slot = closure;
+
+    __atomic_clear(&slot->busy, __ATOMIC_RELEASE);
+}
+
+/* Function:  GpsPayloadCreate
+ * ---------------------------
+ * Create the gps data sent to clients, as JSON text.
+ * A pooled buffer is used if one is free.
+ *
+ * fix : fix to marshal
+ * proj : projections of the fix, NULL if none is asked
+ * projections : projections to add, bits of gps_proj_enum
+ * triggered : conditions of a composite event that triggered the push,
+ *             as bits of their indexes, 0 for any other event
+ *
+ * returns: the data, the caller owns one reference
+ *          NULL if failed
+ */
+afb_data_t GpsPayloadCreate(const gps_fix_snapshot_t *fix,
+                            const gps_projected_t *proj,
+                            unsigned int projections,
+                            uint32_t triggered)
+{
+    afb_data_t data;
+    unsigned int i;
+    size_t len;
+
+    for (i = 0; i < payload_pool_size; i++) {
+        payload_slot_t *slot = &payload_pool[i];
+        if (__atomic_test_and_set(&slot->busy, __ATOMIC_ACQUIRE))
+            continue;
+
+        len = PayloadEncode(slot->text, fix, proj, projections, triggered);
+        if (afb_create_data_raw(&data, AFB_PREDEFINED_TYPE_JSON, slot->text, len + 1,
+                                PayloadRelease, slot) < 0) {
+            PayloadRelease(slot);
+            return NULL;
+        }
+        return data;
+    }
+
+    // Every buffer is still held by the binder
+    GpsRtPoolMiss();
+    char *text = malloc(PAYLOAD_MAX_LEN);
+    if (!text)
+        return NULL;
+    len = PayloadEncode(text, fix, proj, projections, triggered);
+    if (afb_create_data_raw(&data, AFB_PREDEFINED_TYPE_JSON, text, len + 1, free, text) < 0)
+        return NULL;
+    return data;
+}
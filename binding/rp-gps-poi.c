@@ -0,0 +1,760 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Points of interest: a local POI file (CSV or GeoJSON) loaded into a
+ * k-d tree of unit vectors, shared by the nearest queries and by the
+ * events pushed when the nearest POI of the vehicle changes.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <json-c/json.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <urcu/list.h>
+
+#include "rp-gps-binding.h"
+
+// Mean earth radius, the one used by GetDistanceInMeters
+#define POI_EARTH_RADIUS 6371000.0
+
+#define POI_LINE_MAX 1024
+
+typedef struct poi
+{
+    char *name;
+    double latitude;
+    double longitude;
+    double xyz[3];       // position on the unit sphere
+    unsigned char axis;  // split axis of the k-d tree node
+} poi_t;
+
+// Implicit k-d tree: the node of the range [lo, hi) is at its middle,
+// its children being the ranges on each side of it
+typedef struct poi_index
+{
+    poi_t *pois;
+    size_t count;
+    size_t allocated;
+    unsigned long skipped;  // entries of the file that could not be read
+} poi_index_t;
+
+typedef struct poi_hit
+{
+    double chord2;  // squared chord to the query, on the unit sphere
+    size_t index;
+} poi_hit_t;
+
+// Event pushed when the nearest POI within a radius changes
+typedef struct poi_watch
+{
+    struct cds_list_head list_head;
+    int radius;  // in m
+    afb_event_t event;
+    unsigned int subscribers;
+    unsigned long generation;  // of the index the nearest POI belongs to
+    long nearest;              // -1 if none within the radius
+} poi_watch_t;
+
+// Readers hold the lock while querying, a reload swaps the index
+static pthread_rwlock_t PoiLock = PTHREAD_RWLOCK_INITIALIZER;
+static poi_index_t *poi_index;
+static char *poi_path;
+static unsigned long poi_generation;  // incremented on each (re)load
+
+static pthread_mutex_t PoiWatchMutex = PTHREAD_MUTEX_INITIALIZER;
+static CDS_LIST_HEAD(poi_watches);
+
+/* Function:  PoiIndexFree
+ * -----------------------
+ * Release an index and its names.
+ *
+ * returns: nothing
+ */
+static void PoiIndexFree(poi_index_t *index)
+{
+    size_t i;
+
+    if (!index)
+        return;
+    for (i = 0; i < index->count; i++)
+        free(index->pois[i].name);
+    free(index->pois);
+    free(index);
+}
+
+/* Function:  PoiIndexAdd
+ * ----------------------
+ * Append a POI to an index not built yet.
+ *
+ * returns: -1 if failed
+ *          0 if added
+ */
+static int PoiIndexAdd(poi_index_t *index, const char *name, double latitude, double longitude)
+{
+    if (index->count == index->allocated) {
+        size_t grown = index->allocated ? index->allocated * 2 : 256;
+        poi_t *tmp = realloc(index->pois, grown * sizeof(poi_t));
+        if (!tmp)
+            return -1;
+        index->pois = tmp;
+        index->allocated = grown;
+    }
+
+    poi_t *poi = &index->pois[index->count];
+    poi->name = strdup(name);
+    if (!poi->name)
+        return -1;
+    poi->latitude = latitude;
+    poi->longitude = longitude;
+    poi->xyz[0] = cos(latitude * M_PI / 180) * cos(longitude * M_PI / 180);
+    poi->xyz[1] = cos(latitude * M_PI / 180) * sin(longitude * M_PI / 180);
+    poi->xyz[2] = sin(latitude * M_PI / 180);
+    index->count++;
+    return 0;
+}
+
+/* Function:  PoiValidPosition
+ * ---------------------------
+ * returns: true if the position is a valid one
+ */
+static bool PoiValidPosition(double latitude, double longitude)
+{
+    return fabs(latitude) <= 90 && fabs(longitude) <= 180;
+}
+
+/* Function:  PoiLoadCsv
+ * ---------------------
+ * Read a CSV file of "name,latitude,longitude" lines, the other
+ * fields being ignored. Empty lines, lines starting with '#' and
+ * a header line (the first other one) are skipped.
+ *
+ * returns: -1 if failed
+ *          0 if read
+ */
+static int PoiLoadCsv(FILE *file, poi_index_t *index)
+{
+    char line[POI_LINE_MAX];
+    bool first = true;
+
+    while (fgets(line, sizeof(line), file)) {
+        char *latitude_field, *longitude_field, *end_latitude, *end_longitude;
+        bool header = first;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        first = false;
+
+        latitude_field = strchr(line, ',');
+        longitude_field = latitude_field ? strchr(latitude_field + 1, ',') : NULL;
+        if (!longitude_field) {
+            index->skipped++;
+            continue;
+        }
+        *latitude_field++ = '\0';
+        *longitude_field++ = '\0';
+        longitude_field[strcspn(longitude_field, ",")] = '\0';
+
+        double latitude = strtod(latitude_field, &end_latitude);
+        double longitude = strtod(longitude_field, &end_longitude);
+        while (isspace((unsigned char)*end_latitude))
+            end_latitude++;
+        while (isspace((unsigned char)*end_longitude))
+            end_longitude++;
+        if (end_latitude == latitude_field || *end_latitude || end_longitude == longitude_field ||
+            *end_longitude || !PoiValidPosition(latitude, longitude)) {
+            // The header line
+            if (!header)
+                index->skipped++;
+            continue;
+        }
+
+        if (PoiIndexAdd(index, line, latitude, longitude) < 0)
+            return -1;
+    }
+    return ferror(file) ? -1 : 0;
+}
+
+/* Function:  PoiLoadGeoJson
+ * -------------------------
+ * Read the Point features of a GeoJSON FeatureCollection,
+ * named after their "name" property.
+ *
+ * returns: -1 if failed
+ *          0 if read
+ */
+static int PoiLoadGeoJson(const char *path, poi_index_t *index)
+{
+    json_object *json_root = json_object_from_file(path);
+    json_object *json_features = NULL;
+    size_t i, count;
+    int ret = 0;
+
+    if (!json_root)
+        return -1;
+    if (!json_object_object_get_ex(json_root, "features", &json_features) ||
+        !json_object_is_type(json_features, json_type_array)) {
+        json_object_put(json_root);
+        return -1;
+    }
+
+    count = json_object_array_length(json_features);
+    for (i = 0; i < count && ret == 0; i++) {
+        json_object *json_feature = json_object_array_get_idx(json_features, i);
+        json_object *json_geometry = NULL, *json_type = NULL, *json_coordinates = NULL;
+        json_object *json_properties = NULL, *json_name = NULL;
+
+        json_object_object_get_ex(json_feature, "geometry", &json_geometry);
+        json_object_object_get_ex(json_geometry, "type", &json_type);
+        json_object_object_get_ex(json_geometry, "coordinates", &json_coordinates);
+        json_object_object_get_ex(json_feature, "properties", &json_properties);
+        json_object_object_get_ex(json_properties, "name", &json_name);
+
+        // [longitude, latitude(, altitude)]
+        if (!json_type || strcmp(json_object_get_string(json_type), "Point") ||
+            !json_object_is_type(json_coordinates, json_type_array) ||
+            json_object_array_length(json_coordinates) < 2) {
+            index->skipped++;
+            continue;
+        }
+        double longitude = json_object_get_double(json_object_array_get_idx(json_coordinates, 0));
+        double latitude = json_object_get_double(json_object_array_get_idx(json_coordinates, 1));
+        if (!PoiValidPosition(latitude, longitude)) {
+            index->skipped++;
+            continue;
+        }
+
+        const char *name = json_object_is_type(json_name, json_type_string)
+                               ? json_object_get_string(json_name)
+                               : "";
+        ret = PoiIndexAdd(index, name, latitude, longitude);
+    }
+
+    json_object_put(json_root);
+    return ret;
+}
+
+/* Function:  PoiSwap
+ * ------------------
+ * returns: nothing
+ */
+static void PoiSwap(poi_t *pois, size_t a, size_t b)
+{
+    poi_t tmp = pois[a];
+    pois[a] = pois[b];
+    pois[b] = tmp;
+}
+
+/* Function:  PoiSelect
+ * --------------------
+ * Partially sort a range along an axis, so that its nth POI is the one
+ * it would be if sorted, with the lower ones before and the higher ones
+ * after it. Partitioning in three keeps duplicates linear.
+ *
+ * returns: nothing
+ */
+static void PoiSelect(poi_t *pois, size_t lo, size_t hi, size_t nth, unsigned int axis)
+{
+    while (hi - lo > 1) {
+        double pivot = pois[lo + (hi - lo) / 2].xyz[axis];
+        size_t lt = lo, i = lo, gt = hi;
+
+        // [lo, lt) < pivot, [lt, i) == pivot, [gt, hi) > pivot
+        while (i < gt) {
+            if (pois[i].xyz[axis] < pivot)
+                PoiSwap(pois, lt++, i++);
+            else if (pois[i].xyz[axis] > pivot)
+                PoiSwap(pois, i, --gt);
+            else
+                i++;
+        }
+        if (nth < lt)
+            hi = lt;
+        else if (nth >= gt)
+            lo = gt;
+        else
+            return;
+    }
+}
+
+/* Function:  PoiBuild
+ * -------------------
+ * Build the k-d tree of a range, split along its widest axis.
+ *
+ * returns: nothing
+ */
+static void PoiBuild(poi_t *pois, size_t lo, size_t hi)
+{
+    double min[3] = {INFINITY, INFINITY, INFINITY}, max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    unsigned int axis = 0, a;
+    size_t i;
+
+    if (hi - lo < 1)
+        return;
+    for (i = lo; i < hi; i++) {
+        for (a = 0; a < 3; a++) {
+            min[a] = fmin(min[a], pois[i].xyz[a]);
+            max[a] = fmax(max[a], pois[i].xyz[a]);
+        }
+    }
+    for (a = 1; a < 3; a++) {
+        if (max[a] - min[a] > max[axis] - min[axis])
+            axis = a;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+    PoiSelect(pois, lo, hi, mid, axis);
+    pois[mid].axis = axis;
+    PoiBuild(pois, lo, mid);
+    PoiBuild(pois, mid + 1, hi);
+}
+
+/* Function:  PoiLoad
+ * ------------------
+ * Load a POI file and build its index. The format is
+ * told by the first character: '{' for GeoJSON, CSV otherwise.
+ *
+ * returns: the index, NULL if failed
+ */
+static poi_index_t *PoiLoad(const char *path)
+{
+    poi_index_t *index = calloc(1, sizeof(poi_index_t));
+    FILE *file = fopen(path, "r");
+    int ret = -1, first;
+
+    if (!index || !file) {
+        AFB_ERROR("Cannot open POI file %s (errno: %d)", path, errno);
+        goto out;
+    }
+
+    do
+        first = fgetc(file);
+    while (first != EOF && isspace(first));
+    rewind(file);
+
+    if (first == '{')
+        ret = PoiLoadGeoJson(path, index);
+    else
+        ret = PoiLoadCsv(file, index);
+    if (ret < 0) {
+        AFB_ERROR("Cannot read POI file %s", path);
+        goto out;
+    }
+
+    PoiBuild(index->pois, 0, index->count);
+    AFB_NOTICE("%zu POIs loaded from %s (%lu skipped)", index->count, path, index->skipped);
+out:
+    if (file)
+        fclose(file);
+    if (ret < 0) {
+        PoiIndexFree(index);
+        return NULL;
+    }
+    return index;
+}
+
+/* Function:  PoiHitAdd
+ * --------------------
+ * Insert a POI in the hits, sorted by distance, keeping the k nearest.
+ *
+ * returns: nothing
+ */
+static void PoiHitAdd(poi_hit_t *hits,
+                      unsigned int k,
+                      unsigned int *count,
+                      double chord2,
+                      size_t index)
+{
+    unsigned int i = *count < k ? (*count)++ : k - 1;
+
+    while (i > 0 && hits[i - 1].chord2 > chord2) {
+        hits[i] = hits[i - 1];
+        i--;
+    }
+    hits[i].chord2 = chord2;
+    hits[i].index = index;
+}
+
+/* Function:  PoiSearch
+ * --------------------
+ * Search the k nearest POIs of a range of the tree, nearer than bound.
+ * The side of the query is searched first, the other one only if the
+ * split plane is nearer than the farthest hit.
+ *
+ * returns: nothing
+ */
+static void PoiSearch(const poi_index_t *index,
+                      size_t lo,
+                      size_t hi,
+                      const double query[3],
+                      poi_hit_t *hits,
+                      unsigned int k,
+                      unsigned int *count,
+                      double *bound2)
+{
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const poi_t *poi = &index->pois[mid];
+        double dx = query[0] - poi->xyz[0], dy = query[1] - poi->xyz[1];
+        double dz = query[2] - poi->xyz[2];
+        double chord2 = dx * dx + dy * dy + dz * dz;
+
+        if (chord2 < *bound2) {
+            PoiHitAdd(hits, k, count, chord2, mid);
+            if (*count == k)
+                *bound2 = hits[k - 1].chord2;
+        }
+
+        double split = query[poi->axis] - poi->xyz[poi->axis];
+        if (split < 0) {
+            PoiSearch(index, lo, mid, query, hits, k, count, bound2);
+            lo = mid + 1;
+        }
+        else {
+            PoiSearch(index, mid + 1, hi, query, hits, k, count, bound2);
+            hi = mid;
+        }
+        if (split * split >= *bound2)
+            return;
+    }
+}
+
+/* Function:  PoiChord2
+ * --------------------
+ * returns: the squared chord on the unit sphere of a radius in m, any POI
+ *          being nearer than the antipode
+ */
+static double PoiChord2(double radius)
+{
+    if (radius >= M_PI * POI_EARTH_RADIUS)
+        return INFINITY;
+
+    double chord = 2 * sin(radius / POI_EARTH_RADIUS / 2);
+    return nextafter(chord * chord, INFINITY);
+}
+
+/* Function:  PoiNearest
+ * ---------------------
+ * Find the k nearest POIs of a position, within a radius.
+ * PoiLock must be held by the caller.
+ *
+ * returns: the number of POIs found, sorted by distance in hits
+ */
+static unsigned int PoiNearest(double latitude,
+                               double longitude,
+                               double radius,
+                               unsigned int k,
+                               poi_hit_t *hits)
+{
+    double query[3] = {cos(latitude * M_PI / 180) * cos(longitude * M_PI / 180),
+                       cos(latitude * M_PI / 180) * sin(longitude * M_PI / 180),
+                       sin(latitude * M_PI / 180)};
+    unsigned int count = 0;
+
+    if (!poi_index || !k)
+        return 0;
+
+    double bound2 = PoiChord2(radius);
+    PoiSearch(poi_index, 0, poi_index->count, query, hits, k, &count, &bound2);
+    return count;
+}
+
+/* Function:  PoiToJson
+ * --------------------
+ * Marshal a POI found by PoiNearest.
+ * PoiLock must be held by the caller.
+ *
+ * returns: Json object describing the POI
+ */
+static json_object *PoiToJson(const poi_hit_t *hit)
+{
+    const poi_t *poi = &poi_index->pois[hit->index];
+    json_object *JsonPoi = json_object_new_object();
+
+    json_object_object_add(JsonPoi, "name", json_object_new_string(poi->name));
+    json_object_object_add(JsonPoi, "latitude", json_object_new_double(poi->latitude));
+    json_object_object_add(JsonPoi, "longitude", json_object_new_double(poi->longitude));
+    json_object_object_add(
+        JsonPoi, "distance",
+        json_object_new_double(2 * POI_EARTH_RADIUS * asin(fmin(sqrt(hit->chord2) / 2, 1.0))));
+    return JsonPoi;
+}
+
+/* Function:  GpsPoiInit
+ * ---------------------
+ * Load the POI file given by the environment, if any.
+ *
+ * returns: -1 if failed
+ *          0 if went well (or disabled)
+ */
+int GpsPoiInit()
+{
+    const char *path = getenv("RPGPS_POI_PATH");
+
+    if (!path || path[0] == '\0')
+        return 0;
+
+    poi_path = strdup(path);
+    if (!poi_path)
+        return -1;
+    return GpsPoiReload();
+}
+
+/* Function:  GpsPoiReload
+ * -----------------------
+ * Load the POI file again, the current index being kept if it fails.
+ * The events of the watched radiuses are pushed again on next fix.
+ *
+ * returns: -1 if failed
+ *          0 if reloaded
+ */
+int GpsPoiReload()
+{
+    poi_index_t *index, *old;
+
+    if (!poi_path)
+        return -1;
+
+    // Built out of the lock, the queries only wait for the swap
+    index = PoiLoad(poi_path);
+    if (!index)
+        return -1;
+
+    pthread_rwlock_wrlock(&PoiLock);
+    old = poi_index;
+    poi_index = index;
+    poi_generation++;
+    pthread_rwlock_unlock(&PoiLock);
+
+    PoiIndexFree(old);
+    return 0;
+}
+
+/* Function:  GpsPoiNearest
+ * ------------------------
+ * Get the k nearest POIs of a position, in O(log n) for a small k.
+ *
+ * latitude, longitude : position, in degrees
+ * radius : in m, INFINITY for no limit
+ * k : max number of POIs, at most GPS_POI_MAX_NEAREST
+ *
+ * returns: Json array of the POIs, sorted by distance
+ */
+json_object *GpsPoiNearest(double latitude, double longitude, double radius, unsigned int k)
+{
+    poi_hit_t hits[GPS_POI_MAX_NEAREST];
+    json_object *JsonPois = json_object_new_array();
+    unsigned int count, i;
+
+    if (k > GPS_POI_MAX_NEAREST)
+        k = GPS_POI_MAX_NEAREST;
+
+    pthread_rwlock_rdlock(&PoiLock);
+    count = PoiNearest(latitude, longitude, radius, k, hits);
+    for (i = 0; i < count; i++)
+        json_object_array_add(JsonPois, PoiToJson(&hits[i]));
+    pthread_rwlock_unlock(&PoiLock);
+
+    return JsonPois;
+}
+
+/* Function:  PoiWatchDrop
+ * -----------------------
+ * Remove a watch without subscribers, releasing its event.
+ * PoiWatchMutex must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void PoiWatchDrop(poi_watch_t *watch)
+{
+    cds_list_del(&watch->list_head);
+    afb_event_unref(watch->event);
+    free(watch);
+}
+
+/* Function:  GpsPoiUpdate
+ * -----------------------
+ * Push the watched radiuses whose nearest POI changed with a new fix.
+ * Called from the polling thread, with the gps data unlocked.
+ * A single search within the largest radius serves all the watches, its hit
+ * being the nearest POI of each radius it lies within.
+ *
+ * latitude, longitude : position of the fix, in degrees
+ *
+ * returns: nothing
+ */
+void GpsPoiUpdate(double latitude, double longitude)
+{
+    poi_watch_t *watch, *next;
+    poi_hit_t hit;
+    int radius = 0;
+    bool found;
+
+    pthread_mutex_lock(&PoiWatchMutex);
+    if (cds_list_empty(&poi_watches)) {
+        pthread_mutex_unlock(&PoiWatchMutex);
+        return;
+    }
+
+    cds_list_for_each_entry(watch, &poi_watches, list_head)
+    {
+        if (watch->radius > radius)
+            radius = watch->radius;
+    }
+
+    pthread_rwlock_rdlock(&PoiLock);
+    found = PoiNearest(latitude, longitude, radius, 1, &hit) > 0;
+    cds_list_for_each_entry_safe(watch, next, &poi_watches, list_head)
+    {
+        long nearest = found && hit.chord2 <= PoiChord2(watch->radius) ? (long)hit.index : -1;
+        if (watch->generation == poi_generation && watch->nearest == nearest)
+            continue;
+        watch->generation = poi_generation;
+        watch->nearest = nearest;
+
+        json_object *JsonEvent = json_object_new_object();
+        json_object_object_add(JsonEvent, "radius", json_object_new_int(watch->radius));
+        json_object_object_add(JsonEvent, "nearest", nearest >= 0 ? PoiToJson(&hit) : NULL);
+        afb_data_t data = afb_data_json_c_hold(JsonEvent);
+        // Clients may leave without unsubscribing
+        if (afb_event_push(watch->event, 1, &data) == 0)
+            PoiWatchDrop(watch);
+    }
+    pthread_rwlock_unlock(&PoiLock);
+    pthread_mutex_unlock(&PoiWatchMutex);
+}
+
+/* Function:  GpsPoiSubscribe
+ * --------------------------
+ * (Un)subscribe a client to the changes of the nearest POI within a radius.
+ * A new subscriber gets the current one on next fix. At most
+ * GPS_POI_MAX_WATCHES radiuses are watched, a watch being dropped with its
+ * last subscriber.
+ *
+ * request : Request from the client
+ * radius : in m
+ * subscribe : true to subscribe, false to unsubscribe
+ *
+ * returns: 0 if went well
+ *          -1 otherwise
+ */
+int GpsPoiSubscribe(afb_req_t request, int radius, bool subscribe)
+{
+    poi_watch_t *watch, *found = NULL;
+    char event_name[EVENT_NAME_MAX];
+    int watches = 0;
+    int ret = -1;
+
+    pthread_mutex_lock(&PoiWatchMutex);
+    cds_list_for_each_entry(watch, &poi_watches, list_head)
+    {
+        if (watch->radius == radius)
+            found = watch;
+        watches++;
+    }
+
+    if (subscribe) {
+        if (!found) {
+            if (watches >= GPS_POI_MAX_WATCHES) {
+                AFB_ERROR("Too many watched radiuses, %d", watches);
+                goto out;
+            }
+            found = calloc(1, sizeof(poi_watch_t));
+            snprintf(event_name, sizeof(event_name), "poi_nearest_%d", radius);
+            if (!found ||
+                afb_api_new_event(afb_req_get_api(request), event_name, &found->event) < 0) {
+                AFB_ERROR("Cannot create the event %s", event_name);
+                free(found);
+                goto out;
+            }
+            found->radius = radius;
+            cds_list_add_tail(&found->list_head, &poi_watches);
+        }
+        ret = afb_req_subscribe(request, found->event);
+        if (ret >= 0) {
+            found->subscribers++;
+            found->nearest = -2;  // pushed again on next fix
+        }
+        else if (!found->subscribers) {
+            PoiWatchDrop(found);
+        }
+    }
+    else if (found) {
+        ret = afb_req_unsubscribe(request, found->event);
+        if (ret >= 0 && found->subscribers && !--found->subscribers)
+            PoiWatchDrop(found);
+    }
+out:
+    pthread_mutex_unlock(&PoiWatchMutex);
+    return ret;
+}
+
+/* Function:  GpsPoiListening
+ * --------------------------
+ * returns: true if a radius is watched
+ */
+bool GpsPoiListening()
+{
+    bool listening;
+
+    pthread_mutex_lock(&PoiWatchMutex);
+    listening = !cds_list_empty(&poi_watches);
+    pthread_mutex_unlock(&PoiWatchMutex);
+    return listening;
+}
+
+/* Function:  GpsPoiToJson
+ * -----------------------
+ * Marshal the POI index state.
+ *
+ * returns: Json object containing the state
+ */
+json_object *GpsPoiToJson()
+{
+    json_object *JsonPoi = json_object_new_object();
+    poi_watch_t *watch;
+    int watches = 0;
+
+    pthread_mutex_lock(&PoiWatchMutex);
+    cds_list_for_each_entry(watch, &poi_watches, list_head)
+    {
+        watches++;
+    }
+    pthread_mutex_unlock(&PoiWatchMutex);
+
+    pthread_rwlock_rdlock(&PoiLock);
+    json_object_object_add(JsonPoi, "enabled", json_object_new_boolean(poi_index != NULL));
+    json_object_object_add(JsonPoi, "count",
+                           json_object_new_int64(poi_index ? poi_index->count : 0));
+    json_object_object_add(JsonPoi, "skipped",
+                           json_object_new_int64(poi_index ? poi_index->skipped : 0));
+    json_object_object_add(JsonPoi, "loads", json_object_new_int64(poi_generation));
+    json_object_object_add(JsonPoi, "watches", json_object_new_int(watches));
+    pthread_rwlock_unlock(&PoiLock);
+
+    return JsonPoi;
+}
@@ -0,0 +1,400 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ *
+ * Projected coordinates of the fixes: UTM, local East-North-Up frame
+ * and Earth-Centered Earth-Fixed frame, all on the WGS84 ellipsoid.
+ */
+
+#define _GNU_SOURCE
+#include <json-c/json.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rp-gps-binding.h"
+
+// WGS84 ellipsoid
+#define WGS84_A 6378137.0
+#define WGS84_F (1 / 298.257223563)
+
+// UTM
+#define UTM_K0          0.9996
+#define UTM_FALSE_EAST  500000.0
+#define UTM_FALSE_NORTH 10000000.0  // southern hemisphere
+#define UTM_MIN_LAT     -80.0
+#define UTM_MAX_LAT     84.0
+
+#define DEG_TO_RAD(x) ((x) * (M_PI / 180))
+
+static const char *proj_names[GPS_PROJ_COUNT] = {"utm", "enu", "ecef"};
+
+// Constants depending on the ellipsoid only, computed once
+static pthread_once_t ProjOnce = PTHREAD_ONCE_INIT;
+static struct
+{
+    double e2;             // first eccentricity squared
+    double e;              // first eccentricity
+    double utm_a;          // rectifying radius, times UTM_K0
+    double utm_alpha[6];   // Krüger series coefficients
+} ellipsoid;
+
+// ENU origin and its cached trigonometry, protected by ProjMutex
+static pthread_mutex_t ProjMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    bool set;  // false until given or taken from the first fix
+    double latitude, longitude, altitude;
+    double sin_lat, cos_lat, sin_lon, cos_lon;
+    double x, y, z;  // in ECEF
+} origin;
+
+/* Function:  ProjInitConstants
+ * ----------------------------
+ * Compute the ellipsoid constants, the UTM ones being
+ * the 6th order Krüger series (Karney, 2011).
+ *
+ * returns: nothing
+ */
+static void ProjInitConstants()
+{
+    double n = WGS84_F / (2 - WGS84_F);
+    double n2 = n * n, n3 = n2 * n, n4 = n3 * n, n5 = n4 * n, n6 = n5 * n;
+
+    ellipsoid.e2 = WGS84_F * (2 - WGS84_F);
+    ellipsoid.e = sqrt(ellipsoid.e2);
+    ellipsoid.utm_a = UTM_K0 * WGS84_A / (1 + n) * (1 + n2 / 4 + n4 / 64 + n6 / 256);
+
+    ellipsoid.utm_alpha[0] = n / 2 - 2 * n2 / 3 + 5 * n3 / 16 + 41 * n4 / 180 - 127 * n5 / 288 +
+                             7891 * n6 / 37800;
+    ellipsoid.utm_alpha[1] = 13 * n2 / 48 - 3 * n3 / 5 + 557 * n4 / 1440 + 281 * n5 / 630 -
+                             1983433 * n6 / 1935360;
+    ellipsoid.utm_alpha[2] = 61 * n3 / 240 - 103 * n4 / 140 + 15061 * n5 / 26880 +
+                             167603 * n6 / 181440;
+    ellipsoid.utm_alpha[3] = 49561 * n4 / 161280 - 179 * n5 / 168 + 6601661 * n6 / 7257600;
+    ellipsoid.utm_alpha[4] = 34729 * n5 / 80640 - 3418889 * n6 / 1995840;
+    ellipsoid.utm_alpha[5] = 212378941 * n6 / 319334400;
+}
+
+/* Function:  ProjUtmZone
+ * ----------------------
+ * Find the UTM zone of a position, with the Norway and
+ * Svalbard exceptions.
+ *
+ * returns: the zone, 0 outside of the UTM latitudes
+ */
+static int ProjUtmZone(double latitude, double longitude)
+{
+    if (latitude < UTM_MIN_LAT || latitude >= UTM_MAX_LAT)
+        return 0;
+
+    int zone = (int)floor((longitude + 180) / 6) % 60 + 1;
+
+    if (latitude >= 56 && latitude < 64 && longitude >= 3 && longitude < 12)
+        zone = 32;
+    else if (latitude >= 72 && longitude >= 0 && longitude < 42)
+        zone = longitude < 9 ? 31 : longitude < 21 ? 33 : longitude < 33 ? 35 : 37;
+
+    return zone;
+}
+
+/* Function:  ProjUtm
+ * ------------------
+ * Project a position to UTM.
+ *
+ * proj : where to store the coordinates
+ *
+ * returns: nothing
+ */
+static void ProjUtm(double latitude, double longitude, gps_projected_t *proj)
+{
+    int i;
+
+    proj->utm_zone = ProjUtmZone(latitude, longitude);
+    proj->utm_north = latitude >= 0;
+    if (!proj->utm_zone) {
+        proj->utm_easting = proj->utm_northing = NAN;
+        return;
+    }
+
+    double lat = DEG_TO_RAD(latitude);
+    double dlon = DEG_TO_RAD(longitude - (proj->utm_zone * 6 - 183));
+    double sin_lat = sin(lat);
+
+    // Conformal latitude, then Gauss-Schreiber coordinates
+    double t = sinh(atanh(sin_lat) - ellipsoid.e * atanh(ellipsoid.e * sin_lat));
+    double xi0 = atan2(t, cos(dlon));
+    double eta0 = atanh(sin(dlon) / sqrt(1 + t * t));
+    double xi = xi0, eta = eta0;
+
+    for (i = 0; i < 6; i++) {
+        double j2 = 2 * (i + 1);
+        xi += ellipsoid.utm_alpha[i] * sin(j2 * xi0) * cosh(j2 * eta0);
+        eta += ellipsoid.utm_alpha[i] * cos(j2 * xi0) * sinh(j2 * eta0);
+    }
+
+    proj->utm_easting = UTM_FALSE_EAST + ellipsoid.utm_a * eta;
+    proj->utm_northing = ellipsoid.utm_a * xi + (proj->utm_north ? 0 : UTM_FALSE_NORTH);
+}
+
+/* Function:  ProjEcef
+ * -------------------
+ * Convert a position to ECEF.
+ *
+ * altitude : height above the ellipsoid, in m
+ * x, y, z : where to store the coordinates
+ *
+ * returns: nothing
+ */
+static void ProjEcef(double latitude, double longitude, double altitude,
+                     double *x, double *y, double *z)
+{
+    double lat = DEG_TO_RAD(latitude), lon = DEG_TO_RAD(longitude);
+    double sin_lat = sin(lat), cos_lat = cos(lat);
+    double n = WGS84_A / sqrt(1 - ellipsoid.e2 * sin_lat * sin_lat);
+
+    *x = (n + altitude) * cos_lat * cos(lon);
+    *y = (n + altitude) * cos_lat * sin(lon);
+    *z = (n * (1 - ellipsoid.e2) + altitude) * sin_lat;
+}
+
+/* Function:  ProjSetOrigin
+ * ------------------------
+ * Set the ENU origin and cache its trigonometry.
+ * ProjMutex must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void ProjSetOrigin(double latitude, double longitude, double altitude)
+{
+    origin.latitude = latitude;
+    origin.longitude = longitude;
+    origin.altitude = altitude;
+    origin.sin_lat = sin(DEG_TO_RAD(latitude));
+    origin.cos_lat = cos(DEG_TO_RAD(latitude));
+    origin.sin_lon = sin(DEG_TO_RAD(longitude));
+    origin.cos_lon = cos(DEG_TO_RAD(longitude));
+    ProjEcef(latitude, longitude, altitude, &origin.x, &origin.y, &origin.z);
+    origin.set = true;
+}
+
+/* Function:  GpsProjCompute
+ * -------------------------
+ * Compute the projections of a fix that are not already known.
+ * The ENU origin is taken from the first fix if not set yet.
+ * Without altitude (2D fix), the ECEF coordinates are on the
+ * ellipsoid and the ENU ones at the origin height, "up" is NaN.
+ *
+ * fix : fix to project
+ * mask : projections needed, bits of gps_proj_enum
+ * proj : projections of this fix, done is updated
+ *
+ * returns: nothing
+ */
+void GpsProjCompute(const gps_fix_snapshot_t *fix, unsigned int mask, gps_projected_t *proj)
+{
+    double x, y, z;
+
+    mask &= ~proj->done;
+    if (!mask)
+        return;
+
+    pthread_once(&ProjOnce, ProjInitConstants);
+
+    if (mask & GPS_PROJ_BIT(PROJ_UTM))
+        ProjUtm(fix->latitude, fix->longitude, proj);
+
+    if (mask & GPS_PROJ_BIT(PROJ_ECEF)) {
+        double altitude = isnan(fix->altitude) ? 0 : fix->altitude;
+        ProjEcef(fix->latitude, fix->longitude, altitude, &proj->ecef_x, &proj->ecef_y,
+                 &proj->ecef_z);
+    }
+
+    if (mask & GPS_PROJ_BIT(PROJ_ENU)) {
+        pthread_mutex_lock(&ProjMutex);
+        if (!origin.set)
+            ProjSetOrigin(fix->latitude, fix->longitude,
+                          isnan(fix->altitude) ? 0 : fix->altitude);
+
+        double altitude = isnan(fix->altitude) ? origin.altitude : fix->altitude;
+        ProjEcef(fix->latitude, fix->longitude, altitude, &x, &y, &z);
+        double dx = x - origin.x, dy = y - origin.y, dz = z - origin.z;
+
+        proj->enu_east = -origin.sin_lon * dx + origin.cos_lon * dy;
+        proj->enu_north = -origin.sin_lat * origin.cos_lon * dx -
+                          origin.sin_lat * origin.sin_lon * dy + origin.cos_lat * dz;
+        proj->enu_up = isnan(fix->altitude) ? NAN
+                                            : origin.cos_lat * origin.cos_lon * dx +
+                                                  origin.cos_lat * origin.sin_lon * dy +
+                                                  origin.sin_lat * dz;
+        pthread_mutex_unlock(&ProjMutex);
+    }
+
+    proj->done |= mask;
+}
+
+/* Function:  GpsProjDistance
+ * --------------------------
+ * Distance between two projected positions, horizontal in the
+ * UTM and ENU frames, straight in the ECEF one.
+ *
+ * frame : projection to measure in
+ * from, to : positions, with this projection computed
+ *
+ * returns: the distance in meters
+ *          NaN if not comparable (not computed, other UTM zone)
+ */
+double GpsProjDistance(enum gps_proj_enum frame, const gps_projected_t *from,
+                       const gps_projected_t *to)
+{
+    if (!(from->done & to->done & GPS_PROJ_BIT(frame)))
+        return NAN;
+
+    switch (frame) {
+    case PROJ_UTM:
+        if (!from->utm_zone || from->utm_zone != to->utm_zone ||
+            from->utm_north != to->utm_north)
+            return NAN;
+        return hypot(to->utm_easting - from->utm_easting, to->utm_northing - from->utm_northing);
+    case PROJ_ENU:
+        return hypot(to->enu_east - from->enu_east, to->enu_north - from->enu_north);
+    case PROJ_ECEF:
+        return sqrt(pow(to->ecef_x - from->ecef_x, 2) + pow(to->ecef_y - from->ecef_y, 2) +
+                    pow(to->ecef_z - from->ecef_z, 2));
+    default:
+        return NAN;
+    }
+}
+
+/* Function:  GpsProjMaskFromJson
+ * ------------------------------
+ * Parse the "projection" option of a request: a projection
+ * name or an array of them.
+ *
+ * jprojection : option value, NULL if absent
+ * mask : where to store the projections, bits of gps_proj_enum
+ *
+ * returns: -1 if invalid
+ *          0 if well parsed
+ */
+int GpsProjMaskFromJson(json_object *jprojection, unsigned int *mask)
+{
+    size_t i, count = 1;
+    int j;
+
+    *mask = 0;
+    if (!jprojection)
+        return 0;
+
+    bool is_array = json_object_is_type(jprojection, json_type_array);
+    if (is_array)
+        count = json_object_array_length(jprojection);
+
+    for (i = 0; i < count; i++) {
+        json_object *jname = is_array ? json_object_array_get_idx(jprojection, i) : jprojection;
+        if (!json_object_is_type(jname, json_type_string))
+            return -1;
+
+        for (j = 0; j < GPS_PROJ_COUNT; j++) {
+            if (!strcasecmp(json_object_get_string(jname), proj_names[j]))
+                break;
+        }
+        if (j == GPS_PROJ_COUNT)
+            return -1;
+        *mask |= GPS_PROJ_BIT(j);
+    }
+    return 0;
+}
+
+/* Function:  GpsProjName
+ * ----------------------
+ * Append the names of some projections, each preceded by
+ * an underscore, to an event name.
+ *
+ * mask : projections, bits of gps_proj_enum
+ * result : event name to complete
+ * size : size of result
+ *
+ * returns: -1 if too long
+ *          0 if well appended
+ */
+int GpsProjName(unsigned int mask, char *result, size_t size)
+{
+    size_t len = strlen(result);
+    int i;
+
+    for (i = 0; i < GPS_PROJ_COUNT; i++) {
+        if (!(mask & GPS_PROJ_BIT(i)))
+            continue;
+        int ret = snprintf(result + len, size - len, "_%s", proj_names[i]);
+        if (ret < 0 || (size_t)ret >= size - len)
+            return -1;
+        len += ret;
+    }
+    return 0;
+}
+
+/* Function:  GpsProjSetOrigin
+ * ---------------------------
+ * Move the ENU origin.
+ *
+ * altitude : height above the ellipsoid, in m
+ *
+ * returns: -1 if out of range
+ *          0 if set
+ */
+int GpsProjSetOrigin(double latitude, double longitude, double altitude)
+{
+    if (!(latitude >= -90 && latitude <= 90) || !(longitude >= -180 && longitude <= 180) ||
+        !isfinite(altitude))
+        return -1;
+
+    pthread_once(&ProjOnce, ProjInitConstants);
+    pthread_mutex_lock(&ProjMutex);
+    ProjSetOrigin(latitude, longitude, altitude);
+    pthread_mutex_unlock(&ProjMutex);
+    return 0;
+}
+
+/* Function:  GpsProjOriginToJson
+ * ------------------------------
+ * Marshal the ENU origin.
+ *
+ * returns: Json object containing the origin,
+ *          with only "set" false if not set yet
+ */
+json_object *GpsProjOriginToJson()
+{
+    json_object *JsonOrigin = json_object_new_object();
+
+    pthread_mutex_lock(&ProjMutex);
+    json_object_object_add(JsonOrigin, "set", json_object_new_boolean(origin.set));
+    if (origin.set) {
+        json_object_object_add(JsonOrigin, "latitude", json_object_new_double(origin.latitude));
+        json_object_object_add(JsonOrigin, "longitude", json_object_new_double(origin.longitude));
+        json_object_object_add(JsonOrigin, "altitude", json_object_new_double(origin.altitude));
+    }
+    pthread_mutex_unlock(&ProjMutex);
+
+    return JsonOrigin;
+}
@@ -0,0 +1,317 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Track recording: the fixes are appended to a file in the compact track
+ * format, one full block at a time, and read back a page at a time.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <json-c/json.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rp-gps-binding.h"
+
+static pthread_mutex_t RecordMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct
+{
+    FILE *file;  // NULL if not recording
+    char *path;
+    uint8_t block[GPS_TRACK_BLOCK_HEADER_LEN + GPS_TRACK_BLOCK_MAX_LEN];
+    gps_track_encoder_t encoder;
+    unsigned long fixes;   // written to the file
+    unsigned long bytes;   // written to the file, headers included
+    long length;           // of the file, up to the last block written
+    unsigned long errors;  // blocks that could not be written
+} record;
+
+/* Function:  RecordWriteBlock
+ * ---------------------------
+ * Write the current block to the file and start a new one.
+ * A block that cannot be written is dropped, the file being truncated
+ * back to record.length, or recording stopped if it cannot be.
+ * RecordMutex must be held by the caller.
+ *
+ * returns: nothing
+ */
+static void RecordWriteBlock()
+{
+    size_t len = GPS_TRACK_BLOCK_HEADER_LEN + record.encoder.len;
+
+    if (record.encoder.count == 0)
+        return;
+
+    GpsTrackPutBlockHeader(record.block, &record.encoder);
+    if (fwrite(record.block, len, 1, record.file) != 1 || fflush(record.file) != 0) {
+        if (record.errors++ == 0)
+            AFB_ERROR("Cannot write to track file %s (errno: %d)", record.path, errno);
+        // The reads compute the block offsets from record.length
+        __fpurge(record.file);
+        clearerr(record.file);
+        if (ftruncate(fileno(record.file), record.length) < 0) {
+            AFB_ERROR("Cannot truncate track file %s (errno: %d), recording stopped",
+                      record.path, errno);
+            fclose(record.file);
+            record.file = NULL;
+        }
+    }
+    else {
+        record.fixes += record.encoder.count;
+        record.bytes += len;
+        record.length += len;
+    }
+
+    GpsTrackEncoderInit(&record.encoder, record.block + GPS_TRACK_BLOCK_HEADER_LEN,
+                        GPS_TRACK_BLOCK_MAX_LEN);
+}
+
+/* Function:  GpsRecordOpen
+ * ------------------------
+ * Start recording the fixes to a file, appended to
+ * what it already contains.
+ *
+ * path : track file
+ *
+ * returns: -1 if failed
+ *          0 if went well
+ */
+int GpsRecordOpen(const char *path)
+{
+    uint8_t header[GPS_TRACK_FILE_HEADER_LEN];
+    int ret = 0;
+
+    pthread_mutex_lock(&RecordMutex);
+    record.file = fopen(path, "ab");
+    record.path = strdup(path);
+    if (!record.file || !record.path) {
+        AFB_ERROR("Cannot open track file %s (errno: %d)", path, errno);
+        ret = -1;
+        goto out;
+    }
+
+    // A new file starts with the format header
+    if (ftell(record.file) == 0) {
+        uint32_t magic = GPS_TRACK_FILE_MAGIC, version = GPS_TRACK_FILE_VERSION;
+        unsigned int i;
+        for (i = 0; i < 4; i++) {
+            header[i] = magic >> (8 * i);
+            header[4 + i] = version >> (8 * i);
+        }
+        if (fwrite(header, sizeof(header), 1, record.file) != 1 || fflush(record.file) != 0) {
+            AFB_ERROR("Cannot write to track file %s (errno: %d)", path, errno);
+            ret = -1;
+            goto out;
+        }
+        record.bytes += sizeof(header);
+    }
+    record.length = ftell(record.file);
+
+    GpsTrackEncoderInit(&record.encoder, record.block + GPS_TRACK_BLOCK_HEADER_LEN,
+                        GPS_TRACK_BLOCK_MAX_LEN);
+    AFB_NOTICE("Recording fixes to %s", path);
+out:
+    if (ret < 0) {
+        if (record.file)
+            fclose(record.file);
+        free(record.path);
+        record.file = NULL;
+        record.path = NULL;
+    }
+    pthread_mutex_unlock(&RecordMutex);
+    return ret;
+}
+
+/* Function:  GpsRecordAppend
+ * --------------------------
+ * Record a fix. The file is only written once a block is full,
+ * so must not be called with the gps data locked.
+ *
+ * point : fix to record
+ *
+ * returns: nothing
+ */
+void GpsRecordAppend(const gps_track_point_t *point)
+{
+    pthread_mutex_lock(&RecordMutex);
+    if (record.file && GpsTrackEncode(&record.encoder, point) < 0) {
+        RecordWriteBlock();
+        GpsTrackEncode(&record.encoder, point);
+    }
+    pthread_mutex_unlock(&RecordMutex);
+}
+
+/* Function:  GpsRecordClose
+ * -------------------------
+ * Write the fixes not written yet and stop recording.
+ *
+ * returns: nothing
+ */
+void GpsRecordClose()
+{
+    pthread_mutex_lock(&RecordMutex);
+    if (record.file)
+        RecordWriteBlock();
+    if (record.file) {
+        fclose(record.file);
+        record.file = NULL;
+    }
+    pthread_mutex_unlock(&RecordMutex);
+}
+
+/* Function:  GpsRecordEnabled
+ * ---------------------------
+ * returns: true if the fixes are recorded
+ */
+bool GpsRecordEnabled()
+{
+    bool enabled;
+
+    pthread_mutex_lock(&RecordMutex);
+    enabled = record.file != NULL;
+    pthread_mutex_unlock(&RecordMutex);
+    return enabled;
+}
+
+/* Function:  GpsRecordRead
+ * ------------------------
+ * Read the recorded fixes of a time window a page at a time, from
+ * the blocks already written: one block is decoded at a time, so
+ * memory use does not depend on the size of the file. The file
+ * being in time order, reading stops at the first fix after the end.
+ *
+ * cursor : position of the first fix to read (offset of its block in the
+ *          file, times GPS_TRACK_BLOCK_POINTS, plus its index in the block),
+ *          receives the one of the next page
+ * resume : false to start at the beginning of the file
+ * start, end : time window, fix timestamps in s
+ * points : receives the fixes
+ * max : room in points
+ * more : receives true if the window has fixes after this page
+ *
+ * returns: the number of fixes read
+ *          -1 if the cursor is invalid, or the file cannot be read
+ */
+long GpsRecordRead(uint64_t *cursor,
+                   bool resume,
+                   double start,
+                   double end,
+                   gps_track_point_t *points,
+                   unsigned int max,
+                   bool *more)
+{
+    uint8_t header[GPS_TRACK_FILE_HEADER_LEN], data[GPS_TRACK_BLOCK_MAX_LEN];
+    gps_track_decoder_t decoder;
+    gps_track_point_t point;
+    const char *path;
+    long length, count = 0;
+    FILE *file;
+
+    // The path is kept once recording started, and blocks are written whole
+    pthread_mutex_lock(&RecordMutex);
+    path = record.file ? record.path : NULL;
+    length = record.length;
+    pthread_mutex_unlock(&RecordMutex);
+
+    *more = false;
+    if (!path || !(file = fopen(path, "rb")))
+        return -1;
+
+    uint64_t offset = resume ? *cursor / GPS_TRACK_BLOCK_POINTS : GPS_TRACK_FILE_HEADER_LEN;
+    unsigned int index = resume ? *cursor % GPS_TRACK_BLOCK_POINTS : 0;
+    if (resume && offset < GPS_TRACK_FILE_HEADER_LEN)
+        goto failed;
+    if (!resume) {
+        if (fread(header, GPS_TRACK_FILE_HEADER_LEN, 1, file) != 1 ||
+            (header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24) !=
+                GPS_TRACK_FILE_MAGIC)
+            goto failed;
+    }
+
+    while (offset < (uint64_t)length) {
+        size_t len;
+        unsigned int block_count, i;
+        int ret;
+
+        if (offset + GPS_TRACK_BLOCK_HEADER_LEN > (uint64_t)length ||
+            fseek(file, offset, SEEK_SET) != 0 ||
+            fread(header, GPS_TRACK_BLOCK_HEADER_LEN, 1, file) != 1)
+            goto failed;
+        GpsTrackGetBlockHeader(header, &len, &block_count);
+        if (len > sizeof(data) || block_count > GPS_TRACK_BLOCK_POINTS ||
+            index >= block_count || offset + GPS_TRACK_BLOCK_HEADER_LEN + len > (uint64_t)length ||
+            fread(data, len, 1, file) != 1)
+            goto failed;
+
+        GpsTrackDecoderInit(&decoder, data, len, block_count);
+        for (i = 0; (ret = GpsTrackDecode(&decoder, &point)) > 0; i++) {
+            if (i < index || point.time < start)
+                continue;
+            if (point.time > end)
+                goto done;
+            if (count == max) {
+                *more = true;
+                *cursor = offset * GPS_TRACK_BLOCK_POINTS + i;
+                goto done;
+            }
+            points[count++] = point;
+        }
+        if (ret < 0)
+            goto failed;
+
+        offset += GPS_TRACK_BLOCK_HEADER_LEN + len;
+        index = 0;
+    }
+done:
+    fclose(file);
+    return count;
+
+failed:
+    fclose(file);
+    return -1;
+}
+
+/* Function:  GpsRecordToJson
+ * --------------------------
+ * Marshal the recording state.
+ *
+ * returns: Json object containing the state
+ */
+json_object *GpsRecordToJson()
+{
+    json_object *JsonRecord = json_object_new_object();
+
+    pthread_mutex_lock(&RecordMutex);
+    json_object_object_add(JsonRecord, "enabled", json_object_new_boolean(record.file != NULL));
+    json_object_object_add(JsonRecord, "fixes", json_object_new_int64(record.fixes));
+    json_object_object_add(JsonRecord, "pending", json_object_new_int(record.encoder.count));
+    json_object_object_add(JsonRecord, "bytes", json_object_new_int64(record.bytes));
+    json_object_object_add(JsonRecord, "errors", json_object_new_int64(record.errors));
+    pthread_mutex_unlock(&RecordMutex);
+
+    return JsonRecord;
+}
@@ -0,0 +1,400 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Replay of a NMEA log: its fixes are read one at a time and published
+ * in place of the GPSd ones, the simulated clock following their time.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <gps.h>
+#include <json-c/json.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp-gps-binding.h"
+
+#define REPLAY_LINE_MAX    256
+#define REPLAY_FIELDS_MAX  24
+#define REPLAY_KNOTS_TO_MS 0.514444
+
+static pthread_mutex_t ReplayMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ReplayStartCond = PTHREAD_COND_INITIALIZER;
+
+static struct
+{
+    FILE *file;  // NULL once read
+    bool enabled;
+    bool started;
+    bool done;
+    bool failed;              // the file could not be read to its end
+    unsigned long sentences;  // read from the file
+    unsigned long skipped;    // sentences that could not be read
+    unsigned long fixes;      // replayed
+    double first;             // timestamp of the first fix replayed
+    double last;              // timestamp of the last fix replayed
+    struct timespec start_time;  // on the real clock, to compute the speedup
+    struct timespec end_time;
+    // Read from the sentences preceding the RMC one of a fix
+    double altitude;
+    int satellites_used;
+    int mode;
+} replay;
+
+/* Function:  ReplayChecksum
+ * -------------------------
+ * Check the checksum of a sentence, if any, and strip it.
+ *
+ * line : sentence, starting with '$'
+ *
+ * returns: false if the sentence is invalid
+ */
+static bool ReplayChecksum(char *line)
+{
+    char *star = strchr(line, '*');
+    char digits[3], *end;
+    unsigned char sum = 0;
+    const char *p;
+
+    if (line[0] != '$')
+        return false;
+    if (!star)
+        return true;
+
+    for (p = line + 1; p < star; p++)
+        sum ^= (unsigned char)*p;
+    *star = '\0';
+    digits[0] = star[1];
+    digits[1] = digits[0] ? star[2] : '\0';
+    digits[2] = '\0';
+    return strtoul(digits, &end, 16) == sum && end == digits + 2;
+}
+
+/* Function:  ReplayFields
+ * -----------------------
+ * Split the comma separated fields of a sentence in place.
+ *
+ * returns: number of fields
+ */
+static int ReplayFields(char *line, char **fields, int max)
+{
+    int count = 0;
+
+    while (count < max) {
+        fields[count++] = line;
+        line = strchr(line, ',');
+        if (!line)
+            break;
+        *line++ = '\0';
+    }
+    return count;
+}
+
+/* Function:  ReplayDegrees
+ * ------------------------
+ * Convert a ddmm.mmm field to signed degrees.
+ *
+ * returns: the degrees, NaN if empty
+ */
+static double ReplayDegrees(const char *value, const char *hemisphere)
+{
+    if (!value[0])
+        return NAN;
+
+    double raw = atof(value);
+    double degrees = floor(raw / 100.0);
+    degrees += (raw - degrees * 100.0) / 60.0;
+    return hemisphere[0] == 'S' || hemisphere[0] == 'W' ? -degrees : degrees;
+}
+
+/* Function:  ReplayNumber
+ * -----------------------
+ * returns: the value of a numeric field, NaN if empty
+ */
+static double ReplayNumber(const char *value)
+{
+    return value[0] ? atof(value) : NAN;
+}
+
+/* Function:  ReplayTime
+ * ---------------------
+ * Get the time of a RMC sentence.
+ *
+ * hms : hhmmss.sss field
+ * dmy : ddmmyy field
+ *
+ * returns: the time in nanoseconds since the epoch, -1 if invalid
+ */
+static long long ReplayTime(const char *hms, const char *dmy)
+{
+    struct tm tm = {0};
+    int date = atoi(dmy);
+    double seconds = atof(hms);
+    long whole = (long)seconds;
+    long long ms = llround((seconds - whole) * 1000);
+
+    if (strlen(hms) < 6 || strlen(dmy) != 6)
+        return -1;
+
+    tm.tm_mday = date / 10000;
+    tm.tm_mon = date / 100 % 100 - 1;
+    tm.tm_year = date % 100 + 100;
+    tm.tm_hour = whole / 10000;
+    tm.tm_min = whole / 100 % 100;
+    tm.tm_sec = whole % 100;
+    return timegm(&tm) * 1000000000LL + ms * 1000000;
+}
+
+/* Function:  GpsReplayOpen
+ * ------------------------
+ * Open a NMEA log to replay instead of connecting to GPSd.
+ * The replay waits for GpsReplayStart.
+ *
+ * path : NMEA log
+ *
+ * returns: -1 if failed
+ *          0 if went well
+ */
+int GpsReplayOpen(const char *path)
+{
+    pthread_mutex_lock(&ReplayMutex);
+    replay.file = fopen(path, "r");
+    replay.enabled = replay.file != NULL;
+    replay.altitude = NAN;
+    pthread_mutex_unlock(&ReplayMutex);
+
+    if (!replay.file) {
+        AFB_ERROR("Cannot open NMEA log %s (errno: %d)", path, errno);
+        return -1;
+    }
+    AFB_NOTICE("Replaying %s on a simulated clock", path);
+    return 0;
+}
+
+/* Function:  GpsReplayEnabled
+ * ---------------------------
+ * returns: true if a NMEA log is replayed instead of the GPSd fixes
+ */
+bool GpsReplayEnabled()
+{
+    bool enabled;
+
+    pthread_mutex_lock(&ReplayMutex);
+    enabled = replay.enabled;
+    pthread_mutex_unlock(&ReplayMutex);
+    return enabled;
+}
+
+/* Function:  GpsReplayStart
+ * -------------------------
+ * Start the replay, once the clients have subscribed.
+ *
+ * returns: -1 if there is no replay, or if it has already been started
+ *          0 if started
+ */
+int GpsReplayStart()
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&ReplayMutex);
+    if (replay.enabled && !replay.started) {
+        replay.started = true;
+        clock_gettime(CLOCK_MONOTONIC, &replay.start_time);
+        pthread_cond_broadcast(&ReplayStartCond);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&ReplayMutex);
+    return ret;
+}
+
+/* Function:  GpsReplayWaitStart
+ * -----------------------------
+ * Wait for GpsReplayStart.
+ *
+ * returns: nothing
+ */
+void GpsReplayWaitStart()
+{
+    pthread_mutex_lock(&ReplayMutex);
+    while (!replay.started)
+        pthread_cond_wait(&ReplayStartCond, &ReplayMutex);
+    pthread_mutex_unlock(&ReplayMutex);
+}
+
+/* Function:  GpsReplayNext
+ * ------------------------
+ * Read the next fix of the log: one per valid RMC sentence, with
+ * the altitude, satellites and mode of the GGA and GSA sentences
+ * received before it.
+ *
+ * gps : receives the fix, as gps_read would
+ * time_ns : receives the time of the fix, in nanoseconds since the epoch
+ *
+ * returns: 1 if a fix has been read
+ *          0 at the end of the log
+ *          -1 if the log cannot be read
+ */
+int GpsReplayNext(struct gps_data_t *gps, long long *time_ns)
+{
+    char line[REPLAY_LINE_MAX], *fields[REPLAY_FIELDS_MAX];
+
+    while (replay.file && fgets(line, sizeof(line), replay.file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+
+        int count = ReplayChecksum(line) ? ReplayFields(line, fields, REPLAY_FIELDS_MAX) : 0;
+        bool valid = count > 0 && strlen(fields[0]) == 6;
+        pthread_mutex_lock(&ReplayMutex);
+        replay.sentences++;
+        if (!valid)
+            replay.skipped++;
+        pthread_mutex_unlock(&ReplayMutex);
+        if (!valid)
+            continue;
+
+        // $ttGGA, ttGSA or ttRMC, whatever the talker
+        const char *kind = fields[0] + 3;
+        if (!strcmp(kind, "GGA") && count >= 10) {
+            replay.satellites_used = atoi(fields[7]);
+            replay.altitude = ReplayNumber(fields[9]);
+        }
+        else if (!strcmp(kind, "GSA") && count >= 3) {
+            replay.mode = atoi(fields[2]);
+        }
+        else if (!strcmp(kind, "RMC") && count >= 10) {
+            long long fix_ns = ReplayTime(fields[1], fields[9]);
+            double latitude = ReplayDegrees(fields[3], fields[4]);
+            double longitude = ReplayDegrees(fields[5], fields[6]);
+            int mode = replay.mode >= MODE_2D ? replay.mode
+                                              : (isnan(replay.altitude) ? MODE_2D : MODE_3D);
+            double altitude = replay.altitude;
+            int satellites_used = replay.satellites_used;
+
+            // The next fix starts from scratch
+            replay.altitude = NAN;
+            replay.satellites_used = 0;
+            replay.mode = MODE_NOT_SEEN;
+
+            // No fix (status V)
+            if (strcmp(fields[2], "A"))
+                continue;
+            if (fix_ns < 0 || isnan(latitude) || isnan(longitude)) {
+                pthread_mutex_lock(&ReplayMutex);
+                replay.skipped++;
+                pthread_mutex_unlock(&ReplayMutex);
+                continue;
+            }
+
+            memset(&gps->fix, 0, sizeof(gps->fix));
+            gps->fix.mode = mode;
+#if GPSD_API_MAJOR_VERSION > 8
+            gps->fix.time.tv_sec = fix_ns / 1000000000LL;
+            gps->fix.time.tv_nsec = fix_ns % 1000000000LL;
+#else
+            gps->fix.time = fix_ns / 1e9;
+#endif
+            gps->fix.latitude = latitude;
+            gps->fix.longitude = longitude;
+            gps->fix.altitude = mode == MODE_3D ? altitude : NAN;
+            gps->fix.speed = ReplayNumber(fields[7]) * REPLAY_KNOTS_TO_MS;
+            gps->fix.track = ReplayNumber(fields[8]);
+            gps->fix.climb = NAN;
+            gps->fix.ept = gps->fix.epx = gps->fix.epy = gps->fix.epv = NAN;
+            gps->fix.eps = gps->fix.epc = gps->fix.epd = NAN;
+            gps->satellites_used = gps->satellites_visible = satellites_used;
+            gps->set = MODE_SET | TIME_SET | LATLON_SET;
+            *time_ns = fix_ns;
+
+            pthread_mutex_lock(&ReplayMutex);
+            if (replay.fixes++ == 0)
+                replay.first = fix_ns / 1e9;
+            replay.last = fix_ns / 1e9;
+            pthread_mutex_unlock(&ReplayMutex);
+            return 1;
+        }
+    }
+    return replay.file && ferror(replay.file) ? -1 : 0;
+}
+
+/* Function:  GpsReplayDone
+ * ------------------------
+ * Close the log once the dispatch went through its last fix.
+ *
+ * failed : the log could not be read to its end
+ *
+ * returns: nothing
+ */
+void GpsReplayDone(bool failed)
+{
+    pthread_mutex_lock(&ReplayMutex);
+    if (replay.file)
+        fclose(replay.file);
+    replay.file = NULL;
+    replay.done = true;
+    replay.failed = failed;
+    clock_gettime(CLOCK_MONOTONIC, &replay.end_time);
+    pthread_mutex_unlock(&ReplayMutex);
+
+    if (failed)
+        AFB_ERROR("NMEA log replay interrupted by a read error");
+    else
+        AFB_NOTICE("NMEA log replayed: %lu fixes", replay.fixes);
+}
+
+/* Function:  GpsReplayToJson
+ * --------------------------
+ * Marshal the replay state.
+ *
+ * returns: Json object containing the state
+ */
+json_object *GpsReplayToJson()
+{
+    json_object *JsonReplay = json_object_new_object();
+
+    pthread_mutex_lock(&ReplayMutex);
+    json_object_object_add(JsonReplay, "enabled", json_object_new_boolean(replay.enabled));
+    json_object_object_add(JsonReplay, "started", json_object_new_boolean(replay.started));
+    json_object_object_add(JsonReplay, "done", json_object_new_boolean(replay.done));
+    json_object_object_add(JsonReplay, "failed", json_object_new_boolean(replay.failed));
+    json_object_object_add(JsonReplay, "sentences", json_object_new_int64(replay.sentences));
+    json_object_object_add(JsonReplay, "skipped", json_object_new_int64(replay.skipped));
+    json_object_object_add(JsonReplay, "fixes", json_object_new_int64(replay.fixes));
+    if (replay.fixes) {
+        json_object_object_add(JsonReplay, "first", json_object_new_double(replay.first));
+        json_object_object_add(JsonReplay, "last", json_object_new_double(replay.last));
+    }
+    if (replay.done) {
+        double wall = (replay.end_time.tv_sec - replay.start_time.tv_sec) +
+                      (replay.end_time.tv_nsec - replay.start_time.tv_nsec) / 1e9;
+        json_object_object_add(JsonReplay, "wall time", json_object_new_double(wall * 1e3));
+        json_object_object_add(
+            JsonReplay, "speedup",
+            json_object_new_double(wall > 0 ? (replay.last - replay.first) / wall : 0.0));
+    }
+    pthread_mutex_unlock(&ReplayMutex);
+
+    return JsonReplay;
+}
@@ -0,0 +1,232 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Real-time mode: event nodes preallocated at init, memory locking
+ * and scheduling of the polling and dispatch threads.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <json-c/json.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "rp-gps-binding.h"
+
+#define RT_DEFAULT_NODES    64
+#define RT_DEFAULT_PAYLOADS 8
+
+static const char *rt_thread_name[RT_THREAD_COUNT] = {"polling", "dispatch", "shard"};
+
+static struct
+{
+    bool enabled;               // event nodes are preallocated
+    bool locked;                // memory is locked
+    int priority;               // SCHED_FIFO priority, 0 to keep the default policy
+    int cpu[RT_THREAD_COUNT];   // CPU of each thread, -1 for any
+    unsigned long pool_misses;  // allocations done despite the real-time mode
+} rt = {.cpu = {-1, -1, -1}};
+
+// Preallocated event nodes
+static pthread_mutex_t RtNodeMutex = PTHREAD_MUTEX_INITIALIZER;
+static event_list_node *node_pool;
+static event_list_node **node_free;
+static unsigned int node_pool_size;
+static unsigned int node_free_count;
+
+/* Function:  RtEnvInt
+ * -------------------
+ * Read an integer from the environment.
+ *
+ * returns: the value, or fallback if the variable is not set
+ */
+static int RtEnvInt(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+
+    return value && value[0] != '\0' ? atoi(value) : fallback;
+}
+
+/* Function:  GpsRtInit
+ * --------------------
+ * Read the real-time configuration from the environment,
+ * preallocate the pools and lock the memory if asked to.
+ *
+ * returns: -1 if failed
+ *          0 if went well
+ */
+int GpsRtInit()
+{
+    unsigned int i;
+
+    // Payload buffers are always reused, only their count is configurable
+    int payloads = RtEnvInt("RPGPS_RT_PAYLOADS", RT_DEFAULT_PAYLOADS);
+    if (payloads < 1 || GpsPayloadPoolInit(payloads) < 0) {
+        AFB_ERROR("Cannot preallocate payloads");
+        return -1;
+    }
+
+    rt.enabled = RtEnvInt("RPGPS_RT", 0) != 0;
+    rt.priority = RtEnvInt("RPGPS_RT_PRIORITY", 0);
+    rt.cpu[RT_THREAD_POLLING] = RtEnvInt("RPGPS_RT_POLL_CPU", -1);
+    rt.cpu[RT_THREAD_DISPATCH] = RtEnvInt("RPGPS_RT_DISPATCH_CPU", -1);
+    rt.cpu[RT_THREAD_SHARD] = -1;  // shard workers are spread by the scheduler
+
+    if (rt.enabled) {
+        int nodes = RtEnvInt("RPGPS_RT_NODES", RT_DEFAULT_NODES);
+        if (nodes < 1) {
+            AFB_ERROR("Invalid real-time pool size");
+            return -1;
+        }
+
+        node_pool = calloc(nodes, sizeof(event_list_node));
+        node_free = calloc(nodes, sizeof(event_list_node *));
+        if (!node_pool || !node_free) {
+            AFB_ERROR("Cannot preallocate real-time pools");
+            return -1;
+        }
+        for (i = 0; i < (unsigned int)nodes; i++)
+            node_free[i] = &node_pool[i];
+        node_pool_size = node_free_count = nodes;
+        AFB_INFO("Real-time mode: %d event nodes, %d payloads", nodes, payloads);
+    }
+
+    if (RtEnvInt("RPGPS_RT_MLOCK", 0)) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+            AFB_WARNING("Cannot lock memory (errno: %d)", errno);
+        else
+            rt.locked = true;
+    }
+    return 0;
+}
+
+/* Function:  GpsRtPoolMiss
+ * ------------------------
+ * Count an allocation the pools did not avoid, in real-time mode.
+ *
+ * returns: nothing
+ */
+void GpsRtPoolMiss()
+{
+    if (rt.enabled)
+        __atomic_add_fetch(&rt.pool_misses, 1, __ATOMIC_RELAXED);
+}
+
+/* Function:  GpsRtNodeAlloc
+ * -------------------------
+ * Get a zeroed event node, from the pool in real-time mode.
+ *
+ * returns: the node, NULL if failed
+ */
+event_list_node *GpsRtNodeAlloc()
+{
+    event_list_node *node = NULL;
+
+    pthread_mutex_lock(&RtNodeMutex);
+    if (node_free_count)
+        node = node_free[--node_free_count];
+    pthread_mutex_unlock(&RtNodeMutex);
+
+    if (node) {
+        memset(node, 0, sizeof(*node));
+        return node;
+    }
+
+    GpsRtPoolMiss();
+    return calloc(1, sizeof(event_list_node));
+}
+
+/* Function:  GpsRtNodeRelease
+ * ---------------------------
+ * Give back a node got from GpsRtNodeAlloc.
+ *
+ * returns: nothing
+ */
+void GpsRtNodeRelease(event_list_node *node)
+{
+    if (node < node_pool || node >= node_pool + node_pool_size) {
+        free(node);
+        return;
+    }
+
+    pthread_mutex_lock(&RtNodeMutex);
+    node_free[node_free_count++] = node;
+    pthread_mutex_unlock(&RtNodeMutex);
+}
+
+/* Function:  GpsRtThreadSetup
+ * ---------------------------
+ * Apply the configured scheduling policy and CPU affinity
+ * to the calling thread.
+ *
+ * thread : role of the calling thread
+ *
+ * returns: nothing
+ */
+void GpsRtThreadSetup(enum gps_rt_thread_enum thread)
+{
+    if (rt.priority > 0) {
+        struct sched_param param = {.sched_priority = rt.priority};
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0)
+            AFB_WARNING("Cannot set %s thread priority (errno: %d)", rt_thread_name[thread], ret);
+    }
+
+    if (rt.cpu[thread] >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(rt.cpu[thread], &cpus);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (ret != 0)
+            AFB_WARNING("Cannot pin %s thread on CPU %d (errno: %d)", rt_thread_name[thread],
+                        rt.cpu[thread], ret);
+    }
+}
+
+/* Function:  GpsRtToJson
+ * ----------------------
+ * Marshal the real-time mode state.
+ *
+ * returns: Json object containing the state
+ */
+json_object *GpsRtToJson()
+{
+    json_object *JsonRt = json_object_new_object();
+
+    pthread_mutex_lock(&RtNodeMutex);
+    unsigned int free_nodes = node_free_count;
+    pthread_mutex_unlock(&RtNodeMutex);
+
+    json_object_object_add(JsonRt, "enabled", json_object_new_boolean(rt.enabled));
+    json_object_object_add(JsonRt, "memory locked", json_object_new_boolean(rt.locked));
+    json_object_object_add(JsonRt, "priority", json_object_new_int(rt.priority));
+    json_object_object_add(JsonRt, "free nodes", json_object_new_int(free_nodes));
+    json_object_object_add(JsonRt, "free payloads", json_object_new_int(GpsPayloadPoolFree()));
+    json_object_object_add(
+        JsonRt, "pool misses",
+        json_object_new_int64(__atomic_load_n(&rt.pool_misses, __ATOMIC_RELAXED)));
+
+    return JsonRt;
+}
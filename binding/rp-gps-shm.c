@@ -0,0 +1,162 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Publication of the latest fix in POSIX shared memory (writer side).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <gps.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "rp-gps-binding.h"
+#include "rp-gps-shm.h"
+
+static struct rp_gps_shm *shm;
+static char *shm_name;
+
+/* Function:  GpsShmOpen
+ * ---------------------
+ * Create (or reuse) the shared memory segment where fixes are published.
+ *
+ * name : POSIX shared memory object name (ex: "/rp-gps-fix")
+ *
+ * returns: 0 if went well
+ *          -1 otherwise
+ */
+int GpsShmOpen(const char *name)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        AFB_ERROR("Cannot open shared memory %s (errno: %d)", name, errno);
+        return -1;
+    }
+
+    // Readers may run as another user, do not depend on the umask
+    if (fchmod(fd, 0644) < 0 || ftruncate(fd, sizeof(struct rp_gps_shm)) < 0) {
+        AFB_ERROR("Cannot size shared memory %s (errno: %d)", name, errno);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(struct rp_gps_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        AFB_ERROR("Cannot map shared memory %s (errno: %d)", name, errno);
+        return -1;
+    }
+
+    shm = map;
+    shm_name = strdup(name);
+
+    // Start from an even sequence, readers may already be there
+    __atomic_store_n(&shm->seq, __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) & ~1u,
+                     __ATOMIC_RELEASE);
+    shm->version = RP_GPS_SHM_VERSION;
+    __atomic_store_n(&shm->magic, RP_GPS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    AFB_INFO("Publishing fixes in shared memory %s", name);
+    return 0;
+}
+
+/* Function:  GpsShmPublish
+ * ------------------------
+ * Publish a new fix, waking up the readers blocked in rp_gps_shm_wait.
+ * Only called from the polling thread, there is a single writer.
+ *
+ * gps : freshly read gps data
+ *
+ * returns: nothing
+ */
+void GpsShmPublish(const struct gps_data_t *gps)
+{
+    if (!shm)
+        return;
+
+    uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    uint32_t generation = __atomic_load_n(&shm->generation, __ATOMIC_RELAXED) + 1;
+
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    shm->fix.generation = generation;
+    shm->fix.mode = gps->fix.mode;
+    shm->fix.satellites_used = gps->satellites_used;
+    shm->fix.satellites_visible = gps->satellites_visible;
+#if GPSD_API_MAJOR_VERSION > 8
+    shm->fix.time_sec = gps->fix.time.tv_sec;
+    shm->fix.time_nsec = gps->fix.time.tv_nsec;
+#else
+    shm->fix.time_sec = (int64_t)gps->fix.time;
+    shm->fix.time_nsec = (int64_t)((gps->fix.time - floor(gps->fix.time)) * 1000000000);
+#endif
+    shm->fix.latitude = gps->fix.latitude;
+    shm->fix.longitude = gps->fix.longitude;
+    shm->fix.altitude = gps->fix.mode == MODE_3D ? gps->fix.altitude : NAN;
+    shm->fix.speed = gps->fix.speed;
+    shm->fix.climb = gps->fix.mode == MODE_3D ? gps->fix.climb : NAN;
+    shm->fix.track = gps->fix.track;
+    shm->fix.epx = gps->fix.epx;
+    shm->fix.epy = gps->fix.epy;
+    shm->fix.epv = gps->fix.epv;
+    shm->fix.eps = gps->fix.eps;
+    shm->fix.epd = gps->fix.epd;
+
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->generation, generation, __ATOMIC_RELEASE);
+
+    syscall(SYS_futex, &shm->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Function:  GpsShmEnabled
+ * ------------------------
+ * Readers only map the segment, they cannot be counted:
+ * the fixes are needed as long as it is published.
+ *
+ * returns: true if the segment is published
+ */
+bool GpsShmEnabled()
+{
+    return shm != NULL;
+}
+
+/* Function:  GpsShmClose
+ * ----------------------
+ * Stop publishing and remove the segment name,
+ * readers keep their mapping until they close it.
+ *
+ * returns: nothing
+ */
+void GpsShmClose()
+{
+    if (!shm)
+        return;
+
+    munmap(shm, sizeof(struct rp_gps_shm));
+    shm = NULL;
+    shm_unlink(shm_name);
+    free(shm_name);
+    shm_name = NULL;
+}
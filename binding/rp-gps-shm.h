@@ -0,0 +1,138 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Latest fix published by the gps binding in POSIX shared memory.
+ *
+ * This header is self-contained so that local processes can read the
+ * fix without the binder:
+ *
+ *     const struct rp_gps_shm *shm = rp_gps_shm_open(RP_GPS_SHM_DEFAULT_NAME);
+ *     struct rp_gps_shm_fix fix;
+ *     uint32_t gen = rp_gps_shm_read(shm, &fix);
+ *     ...
+ *     rp_gps_shm_wait(shm, gen, NULL);  // blocks until the next fix
+ *
+ * Reading is lock-free and does not involve any syscall, the writer never
+ * waits for the readers. Needs the GNU/default feature set (syscall, shm_open),
+ * link with -lrt on glibc older than 2.34.
+ */
+
+#ifndef RP_GPS_SHM_H
+#define RP_GPS_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RP_GPS_SHM_DEFAULT_NAME "/rp-gps-fix"
+#define RP_GPS_SHM_MAGIC        0x53475052u  // "RPGS"
+#define RP_GPS_SHM_VERSION      1
+
+// Compact fix record, same units as the gps_data event
+struct rp_gps_shm_fix
+{
+    uint32_t generation;  // number of fixes published so far
+    int32_t mode;         // mode of fix (0 to 3)
+    int32_t satellites_used;
+    int32_t satellites_visible;
+    int64_t time_sec;   // fix timestamp
+    int64_t time_nsec;  // fix timestamp, nanoseconds part
+    double latitude;    // in degrees
+    double longitude;   // in degrees
+    double altitude;    // in meters, NaN if not a 3D fix
+    double speed;       // in meters/sec
+    double climb;       // in meters/sec, NaN if not a 3D fix
+    double track;       // heading relative to true north, in degrees
+    double epx;         // longitude error, in meters
+    double epy;         // latitude error, in meters
+    double epv;         // altitude error, in meters
+    double eps;         // speed error, in meters/sec
+    double epd;         // heading error, in degrees
+};
+
+struct rp_gps_shm
+{
+    uint32_t magic;       // RP_GPS_SHM_MAGIC once initialized
+    uint32_t version;     // RP_GPS_SHM_VERSION
+    uint32_t seq;         // seqlock counter, odd while the record is being written
+    uint32_t generation;  // incremented after each fix, usable as a futex
+    struct rp_gps_shm_fix fix;
+};
+
+/* Map the segment published by the binding, read-only.
+ * Returns NULL on error (errno is set). */
+static inline const struct rp_gps_shm *rp_gps_shm_open(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    void *map = mmap(NULL, sizeof(struct rp_gps_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    return (const struct rp_gps_shm *)map;
+}
+
+static inline void rp_gps_shm_close(const struct rp_gps_shm *shm)
+{
+    munmap((void *)shm, sizeof(struct rp_gps_shm));
+}
+
+/* Copy a consistent snapshot of the latest fix.
+ * Returns its generation, 0 if no fix has been published yet. */
+static inline uint32_t rp_gps_shm_read(const struct rp_gps_shm *shm, struct rp_gps_shm_fix *fix)
+{
+    uint32_t begin, end;
+
+    do {
+        begin = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        memcpy(fix, (const void *)&shm->fix, sizeof(*fix));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    } while ((begin & 1) || begin != end);
+
+    return fix->generation;
+}
+
+/* Block until a fix newer than generation is published, or timeout expires
+ * (NULL to wait forever). Returns 0, or -1 with errno set (ETIMEDOUT, EINTR). */
+static inline int rp_gps_shm_wait(const struct rp_gps_shm *shm,
+                                  uint32_t generation,
+                                  const struct timespec *timeout)
+{
+    while (__atomic_load_n(&shm->generation, __ATOMIC_ACQUIRE) == generation) {
+        if (syscall(SYS_futex, &shm->generation, FUTEX_WAIT, generation, timeout, NULL, 0) == -1 &&
+            errno != EAGAIN)
+            return -1;
+    }
+    return 0;
+}
+
+#endif /* RP_GPS_SHM_H */
@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ *
+ * Static tracepoints (USDT) of the fix and dispatch paths, for bpftrace,
+ * perf or SystemTap. They are built in with -DGPS_TRACEPOINTS=ON, otherwise
+ * they compile to nothing. Built in, each probe has a semaphore the tracer
+ * increments while attached: the arguments are only evaluated then, costing
+ * a load and a branch while nobody traces. GPS_TRACE_ACTIVE guards what a
+ * probe needs computed beforehand, like a duration.
+ *
+ * Provider "rpgps", probes and arguments:
+ *
+ *     gps_read        fix sequence, fix mode, 1 if it is a new fix
+ *     fix_published   fix sequence, fix time (ms)
+ *     event_push      event name, push duration (ns), 1 if someone listens
+ *     subscribe       event name, 1 if the event has been created, 1 if private
+ *     unsubscribe     event name
+ *     gpsd_lost       connection losses so far
+ *     reconnect       connection losses so far, loss to first fix delay (us)
+ *
+ * See scripts/gps-trace.bt for an example.
+ */
+
+#ifndef RP_GPS_TRACE_H
+#define RP_GPS_TRACE_H
+
+#ifdef RP_GPS_TRACEPOINTS
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// Semaphore of a probe, only this header including sys/sdt.h refers to it
+#define GPS_TRACE_SEMAPHORE(name)                                                             \
+    static volatile unsigned short rpgps_##name##_semaphore                                   \
+        __attribute__((used, section(".probes")))
+
+GPS_TRACE_SEMAPHORE(gps_read);
+GPS_TRACE_SEMAPHORE(fix_published);
+GPS_TRACE_SEMAPHORE(event_push);
+GPS_TRACE_SEMAPHORE(subscribe);
+GPS_TRACE_SEMAPHORE(unsubscribe);
+GPS_TRACE_SEMAPHORE(gpsd_lost);
+GPS_TRACE_SEMAPHORE(reconnect);
+
+#define GPS_TRACE_ACTIVE(name) __builtin_expect(rpgps_##name##_semaphore != 0, 0)
+#define GPS_TRACE(name, ...)                                                                  \
+    do {                                                                                      \
+        if (GPS_TRACE_ACTIVE(name))                                                           \
+            STAP_PROBEV(rpgps, name, ##__VA_ARGS__);                                          \
+    } while (0)
+#else
+#define GPS_TRACE_ACTIVE(name) 0
+// Never called, only keeps the arguments used for the compiler
+static inline void GpsTraceNone(int unused, ...)
+{
+}
+#define GPS_TRACE(name, ...) (0 ? GpsTraceNone(0, ##__VA_ARGS__) : (void)0)
+#endif
+
+#endif /* RP_GPS_TRACE_H */
@@ -0,0 +1,278 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Compact track encoding: streaming encoder and decoder of the blocks
+ * described in rp-gps-track.h.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "rp-gps-track.h"
+
+#define TRACK_DEGREE_SCALE 1e7
+#define TRACK_METER_SCALE  1e2
+#define TRACK_SECOND_SCALE 1e3
+
+// Flags byte of an encoded fix
+#define TRACK_HAS_ALTITUDE 0x01
+#define TRACK_HAS_SPEED    0x02
+
+/* Function:  TrackPutVarint
+ * -------------------------
+ * Write a signed value as a zigzag varint, 7 bits per byte.
+ *
+ * returns: end of the written bytes
+ */
+static uint8_t *TrackPutVarint(uint8_t *p, int64_t value)
+{
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+
+    while (zigzag >= 0x80) {
+        *p++ = (uint8_t)zigzag | 0x80;
+        zigzag >>= 7;
+    }
+    *p++ = (uint8_t)zigzag;
+    return p;
+}
+
+/* Function:  TrackGetVarint
+ * -------------------------
+ * Read a zigzag varint.
+ *
+ * returns: false if the block is truncated or corrupted
+ */
+static bool TrackGetVarint(gps_track_decoder_t *decoder, int64_t *value)
+{
+    uint64_t zigzag = 0;
+    unsigned int shift;
+
+    for (shift = 0; shift < 64 && decoder->pos < decoder->len; shift += 7) {
+        uint8_t byte = decoder->data[decoder->pos++];
+        zigzag |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Function:  GpsTrackEncoderInit
+ * ------------------------------
+ * Start a new block, its first fix will be a keyframe.
+ *
+ * encoder : encoder to initialize
+ * data : where to write the block
+ * size : room in data, GPS_TRACK_BLOCK_MAX_LEN is always enough
+ *
+ * returns: nothing
+ */
+void GpsTrackEncoderInit(gps_track_encoder_t *encoder, uint8_t *data, size_t size)
+{
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->data = data;
+    encoder->size = size;
+}
+
+/* Function:  GpsTrackEncode
+ * -------------------------
+ * Append a fix to the block.
+ *
+ * encoder : encoder of the block
+ * point : fix to append
+ *
+ * returns: -1 if the block is full, a new one has to be started
+ *          0 if appended
+ */
+int GpsTrackEncode(gps_track_encoder_t *encoder, const gps_track_point_t *point)
+{
+    gps_track_state_t *state = &encoder->state;
+    uint8_t *p = encoder->data + encoder->len;
+    uint8_t flags = 0;
+
+    if (encoder->count >= GPS_TRACK_BLOCK_POINTS ||
+        encoder->size - encoder->len < GPS_TRACK_POINT_MAX_LEN)
+        return -1;
+
+    int64_t time = llround(point->time * TRACK_SECOND_SCALE);
+    int64_t latitude = llround(point->latitude * TRACK_DEGREE_SCALE);
+    int64_t longitude = llround(point->longitude * TRACK_DEGREE_SCALE);
+    if (!isnan(point->altitude))
+        flags |= TRACK_HAS_ALTITUDE;
+    if (!isnan(point->speed))
+        flags |= TRACK_HAS_SPEED;
+
+    *p++ = flags;
+    if (encoder->count == 0) {
+        p = TrackPutVarint(p, time);
+        p = TrackPutVarint(p, latitude);
+        p = TrackPutVarint(p, longitude);
+        state->dtime = state->dlatitude = state->dlongitude = 0;
+    }
+    else {
+        int64_t dtime = time - state->time;
+        int64_t dlatitude = latitude - state->latitude;
+        int64_t dlongitude = longitude - state->longitude;
+        p = TrackPutVarint(p, dtime - state->dtime);
+        p = TrackPutVarint(p, dlatitude - state->dlatitude);
+        p = TrackPutVarint(p, dlongitude - state->dlongitude);
+        state->dtime = dtime;
+        state->dlatitude = dlatitude;
+        state->dlongitude = dlongitude;
+    }
+    state->time = time;
+    state->latitude = latitude;
+    state->longitude = longitude;
+
+    // Unknown values keep the previous ones as reference
+    if (flags & TRACK_HAS_ALTITUDE) {
+        int64_t altitude = llround(point->altitude * TRACK_METER_SCALE);
+        p = TrackPutVarint(p, altitude - state->altitude);
+        state->altitude = altitude;
+    }
+    if (flags & TRACK_HAS_SPEED) {
+        int64_t speed = llround(point->speed * TRACK_METER_SCALE);
+        p = TrackPutVarint(p, speed - state->speed);
+        state->speed = speed;
+    }
+
+    encoder->len = p - encoder->data;
+    encoder->count++;
+    return 0;
+}
+
+/* Function:  GpsTrackDecoderInit
+ * ------------------------------
+ * Start decoding a block.
+ *
+ * decoder : decoder to initialize
+ * data : the block
+ * len : length of the block, in bytes
+ * count : number of fixes in the block
+ *
+ * returns: nothing
+ */
+void GpsTrackDecoderInit(gps_track_decoder_t *decoder,
+                         const uint8_t *data,
+                         size_t len,
+                         unsigned int count)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->data = data;
+    decoder->len = len;
+    decoder->count = count;
+}
+
+/* Function:  GpsTrackDecode
+ * -------------------------
+ * Read the next fix of a block.
+ *
+ * decoder : decoder of the block
+ * point : receives the fix
+ *
+ * returns: -1 if the block is corrupted
+ *          0 at the end of the block
+ *          1 if a fix has been read
+ */
+int GpsTrackDecode(gps_track_decoder_t *decoder, gps_track_point_t *point)
+{
+    gps_track_state_t *state = &decoder->state;
+    int64_t time, latitude, longitude, value;
+
+    if (decoder->index >= decoder->count)
+        return 0;
+    if (decoder->pos >= decoder->len)
+        return -1;
+
+    uint8_t flags = decoder->data[decoder->pos++];
+    if (!TrackGetVarint(decoder, &time) || !TrackGetVarint(decoder, &latitude) ||
+        !TrackGetVarint(decoder, &longitude))
+        return -1;
+
+    if (decoder->index > 0) {
+        state->dtime += time;
+        state->dlatitude += latitude;
+        state->dlongitude += longitude;
+        time = state->time + state->dtime;
+        latitude = state->latitude + state->dlatitude;
+        longitude = state->longitude + state->dlongitude;
+    }
+    state->time = time;
+    state->latitude = latitude;
+    state->longitude = longitude;
+
+    point->time = time / TRACK_SECOND_SCALE;
+    point->latitude = latitude / TRACK_DEGREE_SCALE;
+    point->longitude = longitude / TRACK_DEGREE_SCALE;
+    point->altitude = point->speed = NAN;
+
+    if (flags & TRACK_HAS_ALTITUDE) {
+        if (!TrackGetVarint(decoder, &value))
+            return -1;
+        state->altitude += value;
+        point->altitude = state->altitude / TRACK_METER_SCALE;
+    }
+    if (flags & TRACK_HAS_SPEED) {
+        if (!TrackGetVarint(decoder, &value))
+            return -1;
+        state->speed += value;
+        point->speed = state->speed / TRACK_METER_SCALE;
+    }
+
+    decoder->index++;
+    return 1;
+}
+
+/* Function:  GpsTrackPutBlockHeader
+ * ---------------------------------
+ * Write the header of a block in a track file.
+ *
+ * header : where to write, GPS_TRACK_BLOCK_HEADER_LEN bytes
+ * encoder : encoder of the block
+ *
+ * returns: nothing
+ */
+void GpsTrackPutBlockHeader(uint8_t *header, const gps_track_encoder_t *encoder)
+{
+    header[0] = encoder->len & 0xff;
+    header[1] = encoder->len >> 8;
+    header[2] = encoder->count & 0xff;
+    header[3] = encoder->count >> 8;
+}
+
+/* Function:  GpsTrackGetBlockHeader
+ * ---------------------------------
+ * Read the header of a block in a track file.
+ *
+ * header : GPS_TRACK_BLOCK_HEADER_LEN bytes
+ * len : receives the length of the block, in bytes
+ * count : receives the number of fixes in the block
+ *
+ * returns: nothing
+ */
+void GpsTrackGetBlockHeader(const uint8_t *header, size_t *len, unsigned int *count)
+{
+    *len = header[0] | header[1] << 8;
+    *count = header[2] | header[3] << 8;
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Compact track encoding, used for the fix history and the recorded tracks.
+ *
+ * Fixes are stored in fixed point (1e-7 degree, centimeter, centimeter/s,
+ * millisecond) and grouped in blocks of at most GPS_TRACK_BLOCK_POINTS fixes.
+ * The first fix of a block is a keyframe, written in full, so that any
+ * block can be decoded on its own. The next ones are written as zigzag
+ * varint deltas: second order for the time and the position (change of
+ * the interval and of the velocity, close to 0 at a steady pace), first
+ * order for the altitude and the speed. Each fix starts with a flags byte
+ * telling which of the altitude and the speed follow.
+ *
+ * A recorded track file is a header (GPS_TRACK_FILE_MAGIC, then
+ * GPS_TRACK_FILE_VERSION, both 32 bits little endian), followed by blocks,
+ * each prefixed by its length in bytes and its number of fixes (both
+ * 16 bits little endian).
+ *
+ * This header does not depend on the binder, so that tools can decode
+ * the recorded tracks with rp-gps-track.c alone.
+ */
+
+#ifndef RP_GPS_TRACK_H
+#define RP_GPS_TRACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GPS_TRACK_FILE_MAGIC   0x54475052u  // "RPGT"
+#define GPS_TRACK_FILE_VERSION 1
+#define GPS_TRACK_FILE_HEADER_LEN 8
+
+// Keyframe interval
+#define GPS_TRACK_BLOCK_POINTS 64
+
+// Longest encoded fix: the flags and 5 varints of 64 bits
+#define GPS_TRACK_POINT_MAX_LEN (1 + 5 * 10)
+
+// Room needed by a full block
+#define GPS_TRACK_BLOCK_MAX_LEN (GPS_TRACK_BLOCK_POINTS * GPS_TRACK_POINT_MAX_LEN)
+
+// Length of the block header in a track file
+#define GPS_TRACK_BLOCK_HEADER_LEN 4
+
+// Fix as stored, NaN for an unknown altitude or speed
+typedef struct gps_track_point
+{
+    double time;  // in s
+    double latitude;
+    double longitude;
+    double altitude;  // in m
+    double speed;     // in m/s
+} gps_track_point_t;
+
+// Fixed point values of the previous fix, and the previous deltas
+typedef struct gps_track_state
+{
+    int64_t time, latitude, longitude, altitude, speed;
+    int64_t dtime, dlatitude, dlongitude;
+} gps_track_state_t;
+
+typedef struct gps_track_encoder
+{
+    uint8_t *data;
+    size_t size;         // room in data
+    size_t len;          // bytes written
+    unsigned int count;  // fixes written
+    gps_track_state_t state;
+} gps_track_encoder_t;
+
+typedef struct gps_track_decoder
+{
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    unsigned int count;  // fixes in the block
+    unsigned int index;  // next fix
+    gps_track_state_t state;
+} gps_track_decoder_t;
+
+extern void GpsTrackEncoderInit(gps_track_encoder_t *encoder, uint8_t *data, size_t size);
+extern int GpsTrackEncode(gps_track_encoder_t *encoder, const gps_track_point_t *point);
+extern void GpsTrackDecoderInit(gps_track_decoder_t *decoder,
+                                const uint8_t *data,
+                                size_t len,
+                                unsigned int count);
+extern int GpsTrackDecode(gps_track_decoder_t *decoder, gps_track_point_t *point);
+extern void GpsTrackPutBlockHeader(uint8_t *header, const gps_track_encoder_t *encoder);
+extern void GpsTrackGetBlockHeader(const uint8_t *header, size_t *len, unsigned int *count);
+
+#endif /* RP_GPS_TRACK_H */
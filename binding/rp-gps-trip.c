@@ -0,0 +1,435 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Incremental trip statistics, updated from the polling thread on each fix.
+ */
+
+#define _GNU_SOURCE
+#include <gps.h>
+#include <json-c/json.h>
+#include <math.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <urcu/list.h>
+
+#include "rp-gps-binding.h"
+
+// Below this speed (m/s), position changes are considered as noise
+#define TRIP_MOVING_SPEED 0.5
+
+// Altitude has to raise by this many meters before being counted as gain
+#define TRIP_ELEVATION_HYSTERESIS 2.0
+
+typedef struct trip_s
+{
+    struct cds_list_head list_head;
+    char *name;
+    afb_event_t event;        // created on first subscription
+    unsigned int subscribers; // subscribed clients, as far as known
+    bool armed;               // a fix has been seen since (re)start
+    bool changed;             // changed since last event push
+    double start_time;        // fix timestamp of the first fix
+    double last_time;         // fix timestamp of the latest fix
+    double distance;          // in m
+    double moving_time;       // in s
+    double max_speed;         // in m/s
+    double elevation_gain;    // in m
+    double elevation_ref;     // lowest altitude since last counted gain, in m
+} trip_t;
+
+static pthread_mutex_t TripMutex = PTHREAD_MUTEX_INITIALIZER;
+static CDS_LIST_HEAD(trips);
+
+// Previous fix, shared by all the trips so that the distance is computed once
+static struct
+{
+    bool valid;
+    double time;
+    double latitude;
+    double longitude;
+} prev_fix;
+
+/* Function:  TripFind
+ * -------------------
+ * Find a trip by its name.
+ * TripMutex must be held by the caller.
+ *
+ * returns: the trip, NULL if not found
+ */
+static trip_t *TripFind(const char *name)
+{
+    trip_t *trip;
+
+    cds_list_for_each_entry(trip, &trips, list_head)
+    {
+        if (!strcmp(trip->name, name))
+            return trip;
+    }
+    return NULL;
+}
+
+/* Function:  TripNameValid
+ * ------------------------
+ * Check a trip name, used as is in its event name: 1 to TRIP_NAME_MAX
+ * letters, digits, '-' or '_'.
+ *
+ * returns: true if the name can be used
+ */
+bool TripNameValid(const char *name)
+{
+    size_t length;
+
+    for (length = 0; name[length]; length++) {
+        if (length >= TRIP_NAME_MAX)
+            return false;
+        if (!isalnum((unsigned char)name[length]) && name[length] != '-' && name[length] != '_')
+            return false;
+    }
+    return length > 0;
+}
+
+/* Function:  TripClear
+ * --------------------
+ * Reset all the counters of a trip, it will
+ * start on next fix.
+ *
+ * returns: nothing
+ */
+static void TripClear(trip_t *trip)
+{
+    trip->armed = false;
+    trip->changed = true;
+    trip->start_time = trip->last_time = 0.0;
+    trip->distance = trip->moving_time = 0.0;
+    trip->max_speed = trip->elevation_gain = 0.0;
+    trip->elevation_ref = NAN;
+}
+
+/* Function:  TripToJson
+ * ---------------------
+ * Marshal the statistics of a trip.
+ * TripMutex must be held by the caller.
+ *
+ * returns: Json object containing the statistics
+ */
+static json_object *TripToJson(trip_t *trip)
+{
+    json_object *JsonTrip = json_object_new_object();
+
+    json_object_object_add(JsonTrip, "name", json_object_new_string(trip->name));
+    json_object_object_add(JsonTrip, "distance", json_object_new_double(trip->distance));
+    json_object_object_add(JsonTrip, "elapsed time",
+                           json_object_new_double(trip->last_time - trip->start_time));
+    json_object_object_add(JsonTrip, "moving time", json_object_new_double(trip->moving_time));
+    json_object_object_add(
+        JsonTrip, "average speed",
+        json_object_new_double(trip->moving_time > 0 ? trip->distance / trip->moving_time : 0.0));
+    json_object_object_add(JsonTrip, "max speed", json_object_new_double(trip->max_speed));
+    json_object_object_add(JsonTrip, "elevation gain",
+                           json_object_new_double(trip->elevation_gain));
+
+    return JsonTrip;
+}
+
+/* Function:  TripUpdate
+ * ---------------------
+ * Account a new fix in every trip, in constant time per trip.
+ * Called from the polling thread only.
+ *
+ * gps : freshly read gps data
+ *
+ * returns: nothing
+ */
+void TripUpdate(const struct gps_data_t *gps)
+{
+    trip_t *trip;
+    double time = GpsFixTimestamp(gps);
+    double distance = 0.0;
+    double elapsed = 0.0;
+    double speed = isnan(gps->fix.speed) ? 0.0 : gps->fix.speed;
+    double altitude = gps->fix.mode == MODE_3D ? gps->fix.altitude : NAN;
+    bool moving = speed >= TRIP_MOVING_SPEED;
+
+    if (prev_fix.valid && time > prev_fix.time) {
+        elapsed = time - prev_fix.time;
+        if (moving)
+            distance = GetDistanceInMeters(prev_fix.latitude, prev_fix.longitude,
+                                           gps->fix.latitude, gps->fix.longitude);
+    }
+
+    pthread_mutex_lock(&TripMutex);
+    cds_list_for_each_entry(trip, &trips, list_head)
+    {
+        if (!trip->armed) {
+            trip->armed = true;
+            trip->start_time = trip->last_time = time;
+            trip->elevation_ref = altitude;
+            continue;
+        }
+
+        if (moving && elapsed > 0.0) {
+            trip->distance += distance;
+            trip->moving_time += elapsed;
+            trip->changed = true;
+        }
+
+        if (speed > trip->max_speed) {
+            trip->max_speed = speed;
+            trip->changed = true;
+        }
+
+        if (!isnan(altitude)) {
+            if (isnan(trip->elevation_ref) || altitude < trip->elevation_ref) {
+                trip->elevation_ref = altitude;
+            }
+            else if (altitude - trip->elevation_ref >= TRIP_ELEVATION_HYSTERESIS) {
+                trip->elevation_gain += altitude - trip->elevation_ref;
+                trip->elevation_ref = altitude;
+                trip->changed = true;
+            }
+        }
+
+        if (time > trip->last_time)
+            trip->last_time = time;
+    }
+    pthread_mutex_unlock(&TripMutex);
+
+    prev_fix.valid = true;
+    prev_fix.time = time;
+    prev_fix.latitude = gps->fix.latitude;
+    prev_fix.longitude = gps->fix.longitude;
+}
+
+/* Function:  TripPushChanged
+ * --------------------------
+ * Push the statistics of the subscribed trips that changed
+ * since their last push.
+ *
+ * returns: nothing
+ */
+void TripPushChanged()
+{
+    trip_t *trip;
+
+    pthread_mutex_lock(&TripMutex);
+    cds_list_for_each_entry(trip, &trips, list_head)
+    {
+        if (!trip->event || !trip->changed)
+            continue;
+
+        afb_data_t data = afb_data_json_c_hold(TripToJson(trip));
+        // Clients may have left without unsubscribing
+        if (afb_event_push(trip->event, 1, &data) == 0)
+            trip->subscribers = 0;
+        trip->changed = false;
+    }
+    pthread_mutex_unlock(&TripMutex);
+}
+
+/* Function:  TripStart
+ * --------------------
+ * Create a trip, or reset it if it already exists.
+ * At most TRIP_MAX_COUNT trips exist at once.
+ *
+ * name : name of the trip, see TripNameValid
+ *
+ * returns: 0 if went well
+ *          -1 otherwise
+ */
+int TripStart(const char *name)
+{
+    trip_t *iterator;
+    unsigned int count = 0;
+    int ret = 0;
+
+    pthread_mutex_lock(&TripMutex);
+    trip_t *trip = TripFind(name);
+    if (!trip) {
+        cds_list_for_each_entry(iterator, &trips, list_head)
+        {
+            count++;
+        }
+        if (count >= TRIP_MAX_COUNT || !TripNameValid(name)) {
+            AFB_ERROR("Cannot create the trip %s (%u trips)", name, count);
+            ret = -1;
+            goto out;
+        }
+        trip = calloc(1, sizeof(trip_t));
+        if (trip)
+            trip->name = strdup(name);
+        if (!trip || !trip->name) {
+            AFB_ERROR("Allocation error.");
+            free(trip);
+            ret = -1;
+            goto out;
+        }
+        cds_list_add_tail(&trip->list_head, &trips);
+    }
+    TripClear(trip);
+out:
+    pthread_mutex_unlock(&TripMutex);
+    return ret;
+}
+
+/* Function:  TripReset
+ * --------------------
+ * Reset the counters of an existing trip.
+ *
+ * name : name of the trip
+ *
+ * returns: false if not found
+ *          true if reset
+ */
+bool TripReset(const char *name)
+{
+    pthread_mutex_lock(&TripMutex);
+    trip_t *trip = TripFind(name);
+    if (trip)
+        TripClear(trip);
+    pthread_mutex_unlock(&TripMutex);
+    return trip != NULL;
+}
+
+/* Function:  TripDelete
+ * ---------------------
+ * Delete a trip.
+ *
+ * name : name of the trip
+ *
+ * returns: false if not found
+ *          true if deleted
+ */
+bool TripDelete(const char *name)
+{
+    pthread_mutex_lock(&TripMutex);
+    trip_t *trip = TripFind(name);
+    if (trip) {
+        cds_list_del(&trip->list_head);
+        if (trip->event)
+            afb_event_unref(trip->event);
+        free(trip->name);
+        free(trip);
+    }
+    pthread_mutex_unlock(&TripMutex);
+    return trip != NULL;
+}
+
+/* Function:  TripGet
+ * ------------------
+ * Get the statistics of a trip, or of all of them.
+ *
+ * name : name of the trip, NULL for all
+ *
+ * returns: Json object (array if name is NULL) containing the statistics
+ *          NULL if not found
+ */
+json_object *TripGet(const char *name)
+{
+    json_object *JsonTrips = NULL;
+    trip_t *trip;
+
+    pthread_mutex_lock(&TripMutex);
+    if (name) {
+        trip = TripFind(name);
+        if (trip)
+            JsonTrips = TripToJson(trip);
+    }
+    else {
+        JsonTrips = json_object_new_array();
+        cds_list_for_each_entry(trip, &trips, list_head)
+        {
+            json_object_array_add(JsonTrips, TripToJson(trip));
+        }
+    }
+    pthread_mutex_unlock(&TripMutex);
+    return JsonTrips;
+}
+
+/* Function:  TripSubscribe
+ * ------------------------
+ * (Un)subscribe a client to the changes of a trip.
+ *
+ * request : Request from the client
+ * name : name of the trip
+ * subscribe : true to subscribe, false to unsubscribe
+ *
+ * returns: 0 if went well
+ *          -1 otherwise
+ */
+int TripSubscribe(afb_req_t request, const char *name, bool subscribe)
+{
+    int ret = -1;
+    char *event_name;
+
+    pthread_mutex_lock(&TripMutex);
+    trip_t *trip = TripFind(name);
+    if (!trip)
+        goto out;
+
+    if (subscribe) {
+        if (!trip->event) {
+            if (asprintf(&event_name, "trip_%s", name) == -1)
+                goto out;
+            if (afb_api_new_event(afb_req_get_api(request), event_name, &trip->event) < 0)
+                trip->event = NULL;
+            free(event_name);
+            if (!trip->event)
+                goto out;
+        }
+        ret = afb_req_subscribe(request, trip->event);
+        if (ret == 0)
+            trip->subscribers++;
+        trip->changed = true;
+    }
+    else if (trip->event) {
+        ret = afb_req_unsubscribe(request, trip->event);
+        if (ret == 0 && trip->subscribers)
+            trip->subscribers--;
+    }
+out:
+    pthread_mutex_unlock(&TripMutex);
+    return ret;
+}
+
+/* Function:  TripListening
+ * ------------------------
+ * returns: true if a client is subscribed to a trip
+ */
+bool TripListening()
+{
+    trip_t *trip;
+    bool listening = false;
+
+    pthread_mutex_lock(&TripMutex);
+    cds_list_for_each_entry(trip, &trips, list_head)
+    {
+        if (trip->subscribers) {
+            listening = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&TripMutex);
+    return listening;
+}
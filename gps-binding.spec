@@ -35,6 +35,13 @@ Requires:       afb-binder
 This binding provide a gps service
 
 
+%package devel
+Summary: Header to read the fixes published in shared memory by %{name}
+%description devel
+This package contains the header needed by local processes to read
+the latest fix published by the gps binding in shared memory.
+
+
 %package redtest
 Summary: redtest package (coverage build)
 Requires: lcov
@@ -90,6 +97,11 @@ install -Dm644 test/lorient.nmea %{buildroot}%{_libexecdir}/redtest/%{name}/lori
 %{_afmappdir}/%{name}/.rpconfig/
 
 
+%files devel
+%defattr(-,root,root)
+%{_includedir}/%{name}/
+
+
 %files redtest
 %defattr(-,root,root)
 %{_libexecdir}/redtest/%{name}/run-redtest
@@ -0,0 +1,92 @@
+"""
+Dispatch scaling benchmark: thousands of expression subscriptions evaluated
+on each fix of fake_gpsd.py, with 1 to N dispatch threads (RPGPS_DISPATCH_THREADS).
+Reports the mean dispatch round time, the speedup and the scaling efficiency.
+
+To run the file 'bench_dispatch.py' use the command
+python bench_dispatch.py --threads 4 --events 4000 --rate 20 --path ../build
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+CHILD_ENV = "BENCH_DISPATCH_CHILD"
+
+
+def child():
+    "One binder run, with the thread count given by the environment"
+    from afb_test import AFBTestCase, configure_afb_binding_tests, run_afb_binding_tests
+    import libafb
+    from fake_gpsd import FakeGpsd
+
+    events = int(os.environ["BENCH_EVENTS"])
+    duration = float(os.environ["BENCH_DURATION"])
+    gpsd = FakeGpsd(os.path.join(os.path.dirname(os.path.abspath(__file__)), "lorient.nmea"),
+                    rate=float(os.environ["BENCH_RATE"])).start()
+    os.environ["RPGPS_HOST"] = "127.0.0.1"
+    os.environ["RPGPS_SERVICE"] = str(gpsd.port)
+    os.environ["RPGPS_SHM_NAME"] = ""
+    bindings = {"gps": f"gps-binding.so"}
+
+    class BenchDispatch(AFBTestCase):
+
+        def dispatch(self):
+            stats = libafb.callsync(self.binder, "gps", "stats", {}).args[0]["dispatch"]
+            return stats["rounds"], stats["rounds"] * stats["mean round time"]
+
+        def test_dispatch(self):
+            # Never true, so that only the evaluation is measured
+            for i in range(events):
+                libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "expression", "value" : "speed_kmh > %d and mode >= 2" % (100000 + i)})
+            time.sleep(1.0)
+            rounds, busy = self.dispatch()
+            time.sleep(duration)
+            end_rounds, end_busy = self.dispatch()
+            rounds = end_rounds - rounds
+            print("RESULT " + json.dumps({"rounds": rounds,
+                                          "mean": (end_busy - busy) / rounds if rounds else 0.0}),
+                  flush=True)
+
+    configure_afb_binding_tests(bindings=bindings)
+    try:
+        run_afb_binding_tests(bindings)
+    finally:
+        gpsd.stop()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--threads", type=int, default=os.cpu_count(), help="max dispatch threads")
+    parser.add_argument("--events", type=int, default=4000, help="expression subscriptions")
+    parser.add_argument("--rate", type=float, default=20.0, help="fixes per second")
+    parser.add_argument("--duration", type=float, default=10.0, help="measure time, seconds")
+    args, binder_args = parser.parse_known_args()
+
+    print("%d events, %g Hz fixes" % (args.events, args.rate))
+    print("threads  rounds  mean round (ms)  speedup  efficiency")
+    reference = None
+    for threads in range(1, args.threads + 1):
+        env = dict(os.environ, RPGPS_DISPATCH_THREADS=str(threads), BENCH_EVENTS=str(args.events),
+                   BENCH_RATE=str(args.rate), BENCH_DURATION=str(args.duration))
+        env[CHILD_ENV] = "1"
+        run = subprocess.run([sys.executable, os.path.abspath(__file__)] + binder_args, env=env,
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        results = [l for l in run.stdout.splitlines() if l.startswith("RESULT ")]
+        if not results:
+            sys.exit("run with %d threads failed:\n%s" % (threads, run.stdout))
+        result = json.loads(results[-1][len("RESULT "):])
+        reference = reference or result["mean"]
+        speedup = reference / result["mean"] if result["mean"] else 0.0
+        print("%7d  %6d  %15.3f  %7.2f  %9.0f%%" % (threads, result["rounds"], result["mean"],
+                                                   speedup, 100.0 * speedup / threads))
+
+
+if __name__ == "__main__":
+    if os.environ.get(CHILD_ENV):
+        child()
+    else:
+        main()
@@ -0,0 +1,248 @@
+/**
+ * Copyright (C) 2019-2020 IoT.bzh Company
+ * Contact: https://www.iot.bzh/licensing
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Benchmark of the compact track encoding on a NMEA log: bytes per fix,
+ * encoding and decoding throughput, and worst round trip error.
+ *
+ * Usage :
+ *     bench-track [--rounds N] lorient.nmea
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rp-gps-track.h"
+
+// Size of a fix kept as doubles, as gps_track_point_t
+#define RAW_POINT_LEN sizeof(gps_track_point_t)
+
+/* Function:  NmeaDegrees
+ * ----------------------
+ * Convert a NMEA ddmm.mmm field to signed degrees.
+ *
+ * returns: the degrees, NaN if empty
+ */
+static double NmeaDegrees(const char *value, const char *hemisphere)
+{
+    if (!value[0])
+        return NAN;
+
+    double raw = atof(value);
+    double degrees = floor(raw / 100.0);
+    degrees += (raw - degrees * 100.0) / 60.0;
+    return hemisphere[0] == 'S' || hemisphere[0] == 'W' ? -degrees : degrees;
+}
+
+/* Function:  NmeaFields
+ * ---------------------
+ * Split the comma separated fields of a sentence in place.
+ *
+ * returns: number of fields
+ */
+static int NmeaFields(char *line, char **fields, int max)
+{
+    int count = 0;
+    char *end = strchr(line, '*');
+
+    if (end)
+        *end = '\0';
+    while (count < max) {
+        fields[count++] = line;
+        line = strchr(line, ',');
+        if (!line)
+            break;
+        *line++ = '\0';
+    }
+    return count;
+}
+
+/* Function:  LoadNmea
+ * -------------------
+ * Build the fixes of a NMEA log, one per valid RMC sentence, with the
+ * altitude of the GGA sentence received before it.
+ *
+ * returns: number of fixes, -1 if failed
+ */
+static long LoadNmea(const char *path, gps_track_point_t **points)
+{
+    char line[256], *fields[20];
+    long count = 0, allocated = 0;
+    double altitude = NAN;
+    FILE *file = fopen(path, "r");
+
+    if (!file)
+        return -1;
+
+    while (fgets(line, sizeof(line), file)) {
+        int n = NmeaFields(line, fields, 20);
+        if (n < 1 || strlen(fields[0]) < 6)
+            continue;
+        const char *kind = fields[0] + 3;
+
+        if (!strcmp(kind, "GGA") && n >= 10) {
+            altitude = fields[9][0] ? atof(fields[9]) : NAN;
+        }
+        else if (!strcmp(kind, "RMC") && n >= 10 && !strcmp(fields[2], "A")) {
+            if (count == allocated) {
+                allocated = allocated ? allocated * 2 : 1024;
+                *points = realloc(*points, allocated * sizeof(gps_track_point_t));
+                if (!*points) {
+                    fclose(file);
+                    return -1;
+                }
+            }
+            // hhmmss.sss of ddmmyy
+            struct tm tm = {0};
+            double hms = atof(fields[1]);
+            int date = atoi(fields[9]);
+            tm.tm_mday = date / 10000;
+            tm.tm_mon = date / 100 % 100 - 1;
+            tm.tm_year = date % 100 + 100;
+            tm.tm_hour = (int)(hms / 10000);
+            tm.tm_min = (int)(hms / 100) % 100;
+            tm.tm_sec = (int)hms % 100;
+
+            gps_track_point_t *point = &(*points)[count++];
+            point->time = timegm(&tm) + (hms - floor(hms));
+            point->latitude = NmeaDegrees(fields[3], fields[4]);
+            point->longitude = NmeaDegrees(fields[5], fields[6]);
+            point->altitude = altitude;
+            point->speed = fields[7][0] ? atof(fields[7]) * 0.514444 : NAN;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static double Now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    gps_track_point_t *points = NULL, point;
+    gps_track_encoder_t encoder;
+    gps_track_decoder_t decoder;
+    long rounds = 200, count, i, r;
+    const char *path = NULL;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--rounds") && i + 1 < argc)
+            rounds = atol(argv[++i]);
+        else
+            path = argv[i];
+    }
+    if (!path || rounds < 1) {
+        fprintf(stderr, "usage: %s [--rounds N] track.nmea\n", argv[0]);
+        return 2;
+    }
+
+    count = LoadNmea(path, &points);
+    if (count <= 0) {
+        fprintf(stderr, "No fix read from %s\n", path);
+        return 1;
+    }
+
+    // Blocks as written in a track file, header included
+    size_t max_blocks = count / GPS_TRACK_BLOCK_POINTS + 1;
+    uint8_t *data = malloc(max_blocks * (GPS_TRACK_BLOCK_HEADER_LEN + GPS_TRACK_BLOCK_MAX_LEN));
+    size_t *offsets = calloc(max_blocks, sizeof(size_t));
+    if (!data || !offsets)
+        return 1;
+
+    size_t len = 0, blocks = 0;
+    double start = Now();
+    for (r = 0; r < rounds; r++) {
+        len = blocks = 0;
+        for (i = 0; i < count; i++) {
+            if (i % GPS_TRACK_BLOCK_POINTS == 0) {
+                if (i) {
+                    GpsTrackPutBlockHeader(data + offsets[blocks - 1], &encoder);
+                    len += encoder.len;
+                }
+                offsets[blocks++] = len;
+                len += GPS_TRACK_BLOCK_HEADER_LEN;
+                GpsTrackEncoderInit(&encoder, data + len, GPS_TRACK_BLOCK_MAX_LEN);
+            }
+            GpsTrackEncode(&encoder, &points[i]);
+        }
+        GpsTrackPutBlockHeader(data + offsets[blocks - 1], &encoder);
+        len += encoder.len;
+    }
+    double encode_time = Now() - start;
+
+    double max_position_error = 0, max_altitude_error = 0, max_time_error = 0;
+    long decoded = 0;
+    start = Now();
+    for (r = 0; r < rounds; r++) {
+        size_t b;
+        decoded = 0;
+        for (b = 0; b < blocks; b++) {
+            size_t block_len;
+            unsigned int block_count;
+            GpsTrackGetBlockHeader(data + offsets[b], &block_len, &block_count);
+            GpsTrackDecoderInit(&decoder, data + offsets[b] + GPS_TRACK_BLOCK_HEADER_LEN,
+                                block_len, block_count);
+            while (GpsTrackDecode(&decoder, &point) > 0) {
+                if (r == 0) {
+                    const gps_track_point_t *ref = &points[decoded];
+                    max_position_error = fmax(max_position_error,
+                                              fmax(fabs(point.latitude - ref->latitude),
+                                                   fabs(point.longitude - ref->longitude)));
+                    if (!isnan(ref->altitude))
+                        max_altitude_error =
+                            fmax(max_altitude_error, fabs(point.altitude - ref->altitude));
+                    max_time_error = fmax(max_time_error, fabs(point.time - ref->time));
+                }
+                decoded++;
+            }
+        }
+    }
+    double decode_time = Now() - start;
+
+    if (decoded != count) {
+        fprintf(stderr, "Decoded %ld fixes out of %ld\n", decoded, count);
+        return 1;
+    }
+
+    printf("fixes               %ld (%zu blocks)\n", count, blocks);
+    printf("encoded size        %zu bytes\n", len);
+    printf("bytes per fix       %.2f (raw doubles: %zu, ratio %.1fx)\n", (double)len / count,
+           RAW_POINT_LEN, RAW_POINT_LEN * count / (double)len);
+    printf("encode throughput   %.1f Mfix/s\n", count * rounds / encode_time / 1e6);
+    printf("decode throughput   %.1f Mfix/s\n", count * rounds / decode_time / 1e6);
+    printf("max position error  %.2e degrees\n", max_position_error);
+    printf("max altitude error  %.3f m\n", max_altitude_error);
+    printf("max time error      %.4f s\n", max_time_error);
+
+    free(points);
+    free(data);
+    free(offsets);
+    return 0;
+}
@@ -0,0 +1,334 @@
+#!/usr/bin/env python3
+"""
+Minimal stand-in for gpsd, for load and fault-injection testing.
+
+It speaks just enough of the gpsd JSON protocol for libgps clients:
+VERSION on connection, ?WATCH to start/stop the streaming, and TPV/SKY
+reports built from a NMEA log (GGA/GSA/RMC sentences) or replayed from
+a script of JSON reports (one per line), at any rate up to several kHz.
+
+Faults can be injected while running: disconnects (optionally refusing
+connections for a while), stalls, malformed lines and slow reads (reports
+dribbled a few bytes at a time).
+
+Usage :
+    python3 fake_gpsd.py --port 2947 --rate 10 lorient.nmea
+    python3 fake_gpsd.py --rate 1000 --faults "10:disconnect=2,20:stall=5" lorient.nmea
+
+From a test :
+    gpsd = FakeGpsd("lorient.nmea", rate=100)
+    gpsd.start()
+    os.environ["RPGPS_SERVICE"] = str(gpsd.port)
+    ...
+    gpsd.disconnect(down_for=2.0)
+"""
+
+import argparse
+import json
+import select
+import socket
+import threading
+import time
+
+
+def nmea_degrees(value, hemisphere):
+    "Convert a NMEA ddmm.mmm field to signed degrees"
+    if not value:
+        return None
+    dot = value.index(".")
+    degrees = float(value[:dot - 2]) + float(value[dot - 2:]) / 60.0
+    return -degrees if hemisphere in ("S", "W") else degrees
+
+
+def nmea_float(value):
+    return float(value) if value else None
+
+
+def load_nmea(path):
+    """
+    Build the list of fixes of a NMEA log, one per RMC sentence,
+    completed by the GGA and GSA sentences received since the previous one.
+    """
+    fixes = []
+    fix = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.strip().split("*")[0].split(",")
+            kind = fields[0][3:]
+            if kind == "GGA" and len(fields) >= 10:
+                fix["alt"] = nmea_float(fields[9])
+                fix["used"] = int(fields[7] or 0)
+            elif kind == "GSA" and len(fields) >= 15:
+                fix["mode"] = int(fields[2] or 1)
+                fix["prns"] = [int(prn) for prn in fields[3:15] if prn]
+            elif kind == "RMC" and len(fields) >= 9:
+                if fields[2] == "A":
+                    fix["lat"] = nmea_degrees(fields[3], fields[4])
+                    fix["lon"] = nmea_degrees(fields[5], fields[6])
+                    speed = nmea_float(fields[7])
+                    fix["speed"] = speed * 0.514444 if speed is not None else None
+                    fix["track"] = nmea_float(fields[8])
+                    fixes.append(fix)
+                fix = {}
+    return fixes
+
+
+class FakeGpsd:
+    """
+    gpsd protocol stand-in, serving each client from its own thread.
+    """
+
+    DEVICE = "/dev/fake0"
+
+    def __init__(self, source, rate=10.0, host="127.0.0.1", port=0, sky_every=10):
+        self.rate = rate
+        self.sky_every = sky_every
+        self.reports = None
+        self.fixes = None
+        if source.endswith(".nmea") or source.endswith(".log"):
+            self.fixes = load_nmea(source)
+        else:
+            with open(source) as f:
+                self.reports = [l.strip() for l in f if l.strip() and not l.startswith("#")]
+
+        self.lock = threading.Lock()
+        self.clients = []
+        self.running = False
+        self.refuse_until = 0.0
+        self.stall_until = 0.0
+        self.slow_until = 0.0
+        self.slow_chunk = 8
+        self.malformed_pending = 0
+
+        # Counters, for the tests
+        self.connections = 0
+        self.sent = 0  # reports (fixes) sent, malformed lines excluded
+        self.watch_disables = 0  # ?WATCH commands disabling the streaming
+        self.last_connect = 0.0
+
+        self.server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind((host, port))
+        self.server.listen(8)
+        self.port = self.server.getsockname()[1]
+
+    # Control
+
+    def start(self):
+        self.running = True
+        threading.Thread(target=self._accept, daemon=True).start()
+        return self
+
+    def stop(self):
+        self.running = False
+        self.server.close()
+        self.disconnect()
+
+    def disconnect(self, down_for=0.0):
+        "Close every client connection, and refuse new ones for down_for seconds"
+        with self.lock:
+            self.refuse_until = time.monotonic() + down_for
+            clients, self.clients = self.clients, []
+        for client in clients:
+            try:
+                client.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            client.close()
+
+    def stall(self, seconds):
+        "Keep the connections open but stop sending anything"
+        self.stall_until = time.monotonic() + seconds
+
+    def malformed(self, count=1):
+        "Send count malformed lines in place of the next reports"
+        with self.lock:
+            self.malformed_pending += count
+
+    def slow_reads(self, seconds, chunk=8):
+        "Dribble the reports chunk bytes at a time, as through a slow link"
+        self.slow_chunk = chunk
+        self.slow_until = time.monotonic() + seconds
+
+    def wait_connection(self, after, timeout):
+        "Wait for a connection made after the given monotonic time"
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            if self.last_connect > after:
+                return self.last_connect
+            time.sleep(0.01)
+        return None
+
+    # Protocol
+
+    def _accept(self):
+        while self.running:
+            try:
+                client, _ = self.server.accept()
+            except OSError:
+                break
+            if time.monotonic() < self.refuse_until:
+                client.close()
+                continue
+            client.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            with self.lock:
+                self.clients.append(client)
+                self.connections += 1
+                self.last_connect = time.monotonic()
+            threading.Thread(target=self._serve, args=(client,), daemon=True).start()
+
+    def _send(self, client, data):
+        if time.monotonic() < self.slow_until:
+            for i in range(0, len(data), self.slow_chunk):
+                client.sendall(data[i:i + self.slow_chunk])
+                time.sleep(0.001)
+        else:
+            client.sendall(data)
+
+    def _reports(self, index):
+        "Lines of the report number index of the stream"
+        if self.reports is not None:
+            return [self.reports[index % len(self.reports)]]
+
+        fix = self.fixes[index % len(self.fixes)]
+        now = time.time()
+        stamp = time.strftime("%Y-%m-%dT%H:%M:%S", time.gmtime(now)) + ".%03dZ" % (
+            int(now * 1000) % 1000)
+        report = {"class": "TPV", "device": self.DEVICE, "mode": fix.get("mode", 3),
+                  "time": stamp, "ept": 0.005}
+        for key in ("lat", "lon", "alt", "speed", "track"):
+            if fix.get(key) is not None:
+                report[key] = fix[key]
+        lines = [json.dumps(report, separators=(",", ":"))]
+
+        if index % self.sky_every == 0:
+            sats = [{"PRN": prn, "el": 45.0, "az": (prn * 30) % 360, "ss": 40.0, "used": True}
+                    for prn in fix.get("prns", [])]
+            lines.append(json.dumps({"class": "SKY", "device": self.DEVICE, "time": stamp,
+                                     "satellites": sats}, separators=(",", ":")))
+        return lines
+
+    def _command(self, client, line, state):
+        line = line.strip()
+        if line.startswith("?WATCH"):
+            if "=" in line:
+                args = json.loads(line[line.index("=") + 1:].rstrip(";"))
+                state["watch"] = args.get("enable", True) and args.get("json", state["watch"])
+                if not args.get("enable", True):
+                    with self.lock:
+                        self.watch_disables += 1
+            client.sendall(b'{"class":"DEVICES","devices":[{"class":"DEVICE","path":"%s",'
+                           b'"activated":"%s"}]}\r\n' % (self.DEVICE.encode(),
+                                                        time.strftime("%Y-%m-%dT%H:%M:%SZ").encode()))
+            client.sendall(b'{"class":"WATCH","enable":%s,"json":%s}\r\n' % (
+                b"true" if state["watch"] else b"false", b"true" if state["watch"] else b"false"))
+        elif line.startswith("?VERSION"):
+            client.sendall(self._version())
+
+    def _version(self):
+        return (b'{"class":"VERSION","release":"fake","rev":"fake",'
+                b'"proto_major":3,"proto_minor":14}\r\n')
+
+    def _serve(self, client):
+        state = {"watch": False}
+        pending = b""
+        index = 0       # reports due since start
+        position = 0    # next report of the source
+        start = time.monotonic()
+        try:
+            client.sendall(self._version())
+            while self.running:
+                # Commands from the client
+                readable, _, _ = select.select([client], [], [], 0.001 if state["watch"] else 0.1)
+                if readable:
+                    chunk = client.recv(4096)
+                    if not chunk:
+                        break
+                    pending += chunk
+                    while b";" in pending or b"\n" in pending:
+                        cut = min(i for i in (pending.find(b";"), pending.find(b"\n")) if i >= 0)
+                        line, pending = pending[:cut + 1], pending[cut + 1:]
+                        self._command(client, line.decode(errors="replace"), state)
+
+                now = time.monotonic()
+                if self.rate != state.get("rate"):
+                    state["rate"] = self.rate
+                    start = now
+                    index = 0
+                if not state["watch"] or now < self.stall_until:
+                    # Reports are not queued while stalled or not watched
+                    start = now
+                    index = 0
+                    continue
+
+                # Send every report due at this time, in one write
+                due = int((now - start) * self.rate)
+                lines = []
+                sent = 0
+                while index < due:
+                    with self.lock:
+                        broken = self.malformed_pending > 0
+                        if broken:
+                            self.malformed_pending -= 1
+                    if broken:
+                        lines.append('{"class":"TPV","device":"%s","mode":3,"lat":' % self.DEVICE)
+                    else:
+                        lines += self._reports(position)
+                        position += 1
+                        sent += 1
+                    index += 1
+                if lines:
+                    self._send(client, ("\r\n".join(lines) + "\r\n").encode())
+                    with self.lock:
+                        self.sent += sent
+        except (OSError, ValueError):
+            pass
+        finally:
+            with self.lock:
+                if client in self.clients:
+                    self.clients.remove(client)
+            client.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("source", help="NMEA log, or file of JSON reports (one per line)")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=2947)
+    parser.add_argument("--rate", type=float, default=10.0, help="reports per second")
+    parser.add_argument("--faults", default="",
+                        help="comma separated time:fault[=value], fault being disconnect, "
+                             "stall, malformed or slow (ex: 10:disconnect=2,20:stall=5)")
+    args = parser.parse_args()
+
+    gpsd = FakeGpsd(args.source, rate=args.rate, host=args.host, port=args.port).start()
+    print("fake gpsd listening on %s:%d" % (args.host, gpsd.port), flush=True)
+
+    faults = []
+    for spec in filter(None, args.faults.split(",")):
+        at, fault = spec.split(":", 1)
+        name, _, value = fault.partition("=")
+        faults.append((float(at), name, float(value or 0)))
+    faults.sort()
+
+    start = time.monotonic()
+    try:
+        for at, name, value in faults:
+            time.sleep(max(0.0, start + at - time.monotonic()))
+            print("%.1fs: %s %g" % (at, name, value), flush=True)
+            if name == "disconnect":
+                gpsd.disconnect(value)
+            elif name == "stall":
+                gpsd.stall(value)
+            elif name == "malformed":
+                gpsd.malformed(int(value or 1))
+            elif name == "slow":
+                gpsd.slow_reads(value)
+        while True:
+            time.sleep(1.0)
+    except KeyboardInterrupt:
+        gpsd.stop()
+
+
+if __name__ == "__main__":
+    main()
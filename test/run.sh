@@ -21,6 +21,18 @@ sleep 3
 
 LD_LIBRARY_PATH=${SCRIPT_DIR}/../build python ${SCRIPT_DIR}/tests.py -vvv --tap
 
+echo "--- Real-time mode tests ---"
+LD_LIBRARY_PATH=${SCRIPT_DIR}/../build python ${SCRIPT_DIR}/tests_rt.py -vvv --tap
+
 echo "--- Killing created gpsd & gpsfake instances ---"
 stop_gpsd
 
+echo "--- Fault injection tests (fake gpsd) ---"
+LD_LIBRARY_PATH=${SCRIPT_DIR}/../build python ${SCRIPT_DIR}/tests_fake_gpsd.py -vvv --tap
+
+echo "--- Idle mode tests (fake gpsd) ---"
+LD_LIBRARY_PATH=${SCRIPT_DIR}/../build python ${SCRIPT_DIR}/tests_idle.py -vvv --tap
+
+
+echo "--- Deterministic replay tests (simulated clock) ---"
+LD_LIBRARY_PATH=${SCRIPT_DIR}/../build python ${SCRIPT_DIR}/tests_replay.py -vvv --tap
@@ -11,12 +11,15 @@ python tests.py --path ../build
 """
 
 import libafb
+import json
 import os
 import subprocess
 import signal
+import struct
 import time
 import unittest
 from math import radians, sin, cos, asin, sqrt
+from xml.etree import ElementTree
 
 
 bindings = {"gps": f"gps-binding.so"}
@@ -64,7 +67,55 @@ class TestVerbGps(AFBTestCase):
         assert type(dicto['timestamp']) == float
         assert type(dicto['timestamp error']) == float
 
+        # nothing but the documented fields
+        fields = {'visible satellites', 'used satellites', 'mode', 'latitude', 'longitude',
+                  'speed', 'altitude', 'climb', 'heading (true north)', 'timestamp'}
+        assert set(dicto) <= fields | {key + ' error' for key in fields}
+
     
+    "Test projected coordinates"
+    def test_data_projection(self):
+        time.sleep(1.0) # add a sleep time to wait for the gpsd to start
+
+        r = libafb.callsync(self.binder, "gps", "enu-origin", {"current" : True})
+        origin = r.args[0]
+        assert origin["set"] == True
+
+        dicto = libafb.callsync(self.binder, "gps", "gps-data", {"projection" : ["utm", "enu", "ecef"]}).args[0]
+        # Lorient, France
+        assert dicto["utm zone"] == 30
+        assert dicto["utm hemisphere"] == "N"
+        assert 400000 < dicto["utm easting"] < 600000
+        assert 5200000 < dicto["utm northing"] < 5400000
+        # the replay only moves a few meters per second
+        assert abs(dicto["enu east"]) < 1000 and abs(dicto["enu north"]) < 1000
+        radius = sqrt(dicto["ecef x"] ** 2 + dicto["ecef y"] ** 2 + dicto["ecef z"] ** 2)
+        assert 6350000 < radius < 6390000
+
+        r = libafb.callsync(self.binder, "gps", "enu-origin", {"latitude" : 0, "longitude" : 0})
+        assert r.args[0]["latitude"] == 0.0 and r.args[0]["altitude"] == 0.0
+        dicto = libafb.callsync(self.binder, "gps", "gps-data", {"projection" : "enu"}).args[0]
+        assert dicto["enu north"] > 5000000
+        assert "utm zone" not in dicto
+        libafb.callsync(self.binder, "gps", "enu-origin", {"current" : True})
+
+        with self.assertRaises(RuntimeError):
+            libafb.callsync(self.binder, "gps", "enu-origin", {"latitude" : 91, "longitude" : 0})
+
+        # Movement measured in the ENU frame, events named after their projections
+        names = []
+        def evt_move(binder, evt_name, userdata, data):
+            names.append(evt_name)
+            assert "enu east" in data
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_move})
+        libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "movement", "value" : 1, "projection" : "enu"})
+        time.sleep(3.0)
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "movement", "value" : 1, "projection" : "enu"})
+        libafb.evtdelete(self.binder, "gps/*")
+        assert names and all(n.endswith("gps_data_movement_1_enu") for n in names)
+
+
     def test_data_fail(self):
         time.sleep(1.0) # add a sleep time to wait for the gpsd to start
 
@@ -106,6 +157,41 @@ class TestVerbGps(AFBTestCase):
             r = libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "max_speed", "value" : speedList[s]})
             assert r.status == 0
 
+        for e in ["speed_kmh > 50 and mode == 3 and epx < 10", "abs(delta(heading)) > 30", "not (used < 4) || -climb >= 1.5"]:
+            r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "expression", "value" : e, "debounce" : 500})
+            assert r.status == 0
+            r = libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "expression", "value" : e, "debounce" : 500})
+            assert r.status == 0
+
+        for a in [{"value" : 50}, {"value" : 20, "min_interval" : 200, "max_interval" : 5000, "heading" : 15}]:
+            r = libafb.callsync(self.binder, "gps", "subscribe", dict(a, data="gps_data", condition="adaptive"))
+            assert r.status == 0
+            r = libafb.callsync(self.binder, "gps", "unsubscribe", dict(a, data="gps_data", condition="adaptive"))
+            assert r.status == 0
+
+        # same expression spelled differently
+        r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "expression", "value" : "speed>1"})
+        r = libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "expression", "value" : "(speed  >  1)"})
+        assert r.status == 0
+
+        for c in ["TPV", "SKY", "PPS"]:
+            r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gpsd_raw", "condition" : "class", "value" : c})
+            assert r.status == 0
+            r = libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gpsd_raw", "condition" : "class", "value" : c})
+            assert r.status == 0
+
+        # composite events are private, unsubscribed by their stream id
+        composite = {"data" : "gps_data", "condition" : "composite", "projection" : "enu",
+                     "value" : [{"condition" : "frequency", "value" : 10}, {"condition" : "movement", "value" : 100},
+                                {"condition" : "expression", "value" : "speed_kmh > 90"}]}
+        streams = [libafb.callsync(self.binder, "gps", "subscribe", composite).args[0]["stream"] for i in range(2)]
+        assert streams[0] != streams[1]
+        with self.assertRaises(RuntimeError):
+            libafb.callsync(self.binder, "gps", "ack", {"stream" : streams[0]})
+        for stream in streams:
+            r = libafb.callsync(self.binder, "gps", "unsubscribe", {"stream" : stream})
+            assert r.status == 0
+
         #testing double subscription 
         r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 1})
         r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 1})
@@ -134,6 +220,35 @@ class TestVerbGps(AFBTestCase):
         with self.assertRaises(RuntimeError):
             r = libafb.callsync(self.binder, "gps", "subscribe", {"dataaa" : "gps_data", "condition" : "frequency", "value" : 1})
 
+        with self.assertRaises(RuntimeError):
+            r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gpsd_raw", "condition" : "class", "value" : "NMEA"})
+
+        # too deeply nested expressions are refused before exhausting the stack
+        nested = ["-" * 100000 + "1 > 0", "(" * 100000 + "speed" + ")" * 100000 + " > 1",
+                  "abs(" * 100000 + "climb" + ")" * 100000 + " > 1", "not " * 100000 + "speed > 1",
+                  "!" * 100000 + "(speed > 1)"]
+        for e in ["speed >", "altitud > 3", "speed > 3)", 42] + nested:
+            with self.assertRaises(RuntimeError):
+                r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "expression", "value" : e})
+
+        for a in [{"value" : 0}, {"value" : 10.5}, {"value" : 10, "min_interval" : -1},
+                  {"value" : 10, "min_interval" : 2000, "max_interval" : 1000}, {"value" : 10, "heading" : 270}]:
+            with self.assertRaises(RuntimeError):
+                r = libafb.callsync(self.binder, "gps", "subscribe", dict(a, data="gps_data", condition="adaptive"))
+
+        with self.assertRaises(RuntimeError):
+            r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gpsd_raw", "condition" : "frequency", "value" : 1})
+
+        for c in [[], 10, [{"condition" : "frequency", "value" : 3}], [{"condition" : "class", "value" : "TPV"}],
+                  [{"condition" : "composite", "value" : [{"condition" : "frequency", "value" : 1}]}],
+                  [{"condition" : "frequency", "value" : 1}] * 33]:
+            with self.assertRaises(RuntimeError):
+                r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "composite", "value" : c})
+
+        for p in ["lambert", ["utm", 3], 1]:
+            with self.assertRaises(RuntimeError):
+                r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 1, "projection" : p})
+
 
     def test_unsubscribe_fail(self):
         time.sleep(1.0) # add a sleep time to wait for the gpsd to start
@@ -167,6 +282,184 @@ class TestVerbGps(AFBTestCase):
             r = libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "movement", "value" : 1})
 
 
+    "Test stats verb"
+    def test_stats_success(self):
+        time.sleep(1.0) # add a sleep time to wait for the gpsd to start
+
+        r = libafb.callsync(self.binder, "gps", "stats", {})
+        assert r.status == 0
+        dicto = r.args[0]
+
+        assert dicto['online'] == True
+        assert dicto['streaming'] == True
+        assert type(dicto['wake count']) == int
+        assert type(dicto['last wake latency']) == float
+        assert dicto['dispatch']['threads'] == 1
+        assert dicto['dispatch']['rounds'] > 0
+        assert dicto['record']['enabled'] == False
+        assert dicto['poi']['enabled'] == False
+
+
+    "Test trip verb"
+    def test_trip_success(self):
+        time.sleep(1.0) # add a sleep time to wait for the gpsd to start
+
+        r = libafb.callsync(self.binder, "gps", "trip", {"name" : "test", "action" : "start"})
+        assert r.status == 0
+        time.sleep(3.0)
+
+        r = libafb.callsync(self.binder, "gps", "trip", {"name" : "test"})
+        assert r.status == 0
+        dicto = r.args[0]
+        assert dicto['name'] == "test"
+        assert dicto['distance'] > 0.0
+        assert dicto['moving time'] > 0.0
+        assert dicto['max speed'] >= dicto['average speed'] > 0.0
+
+        r = libafb.callsync(self.binder, "gps", "trip", {})
+        assert len(r.args[0]) >= 2
+
+        r = libafb.callsync(self.binder, "gps", "trip", {"name" : "test", "action" : "delete"})
+        assert r.status == 0
+
+        with self.assertRaises(RuntimeError):
+            r = libafb.callsync(self.binder, "gps", "trip", {"name" : "test"})
+
+        with self.assertRaises(RuntimeError):
+            r = libafb.callsync(self.binder, "gps", "trip", {"name" : "default", "action" : "noAction"})
+
+        for bad in [{"name" : 5}, {"name" : {"a" : 1}}, {"name" : None}, {"name" : ""},
+                    {"name" : "a" * 33}, {"name" : "a b"}, {"name" : "a/b", "action" : "start"},
+                    {"action" : 1}, {"action" : None}]:
+            with self.assertRaises(RuntimeError):
+                libafb.callsync(self.binder, "gps", "trip", bad)
+
+        # A bounded number of trips, the default one included
+        created = 0
+        for i in range(40):
+            try:
+                libafb.callsync(self.binder, "gps", "trip", {"name" : "t%d" % i, "action" : "start"})
+                created += 1
+            except RuntimeError:
+                break
+        assert len(libafb.callsync(self.binder, "gps", "trip", {}).args[0]) == 32
+        for i in range(created):
+            libafb.callsync(self.binder, "gps", "trip", {"name" : "t%d" % i, "action" : "delete"})
+
+
+    "Test history verb"
+    def test_history_success(self):
+        time.sleep(3.0) # add a sleep time to record a few fixes
+
+        history = libafb.callsync(self.binder, "gps", "stats", {}).args[0]["history"]
+        assert history["size"] == 36000
+        assert history["count"] > 0
+        assert history["oldest"] <= history["newest"]
+        assert 0 < history["bytes"] < 16 * history["count"]
+
+        r = libafb.callsync(self.binder, "gps", "history", {"last" : 2})
+        dicto = r.args[0]
+        assert len(dicto["segments"]) == 1
+        points = dicto["segments"][0]
+        assert dicto["count"] == dicto["matched"] == len(points)
+        assert points[-1][0] - points[0][0] <= 2
+        assert all(a[0] < b[0] for a, b in zip(points, points[1:]))
+
+        # Fixes around the latest one
+        t, latitude, longitude = points[-1][:3]
+        r = libafb.callsync(self.binder, "gps", "history", {"latitude" : latitude, "longitude" : longitude, "radius" : 200})
+        dicto = r.args[0]
+        assert dicto["matched"] >= 1
+        for segment in dicto["segments"]:
+            for p in segment:
+                dlat, dlon = radians(p[1] - latitude), radians(p[2] - longitude)
+                a = sin(dlat / 2) ** 2 + cos(radians(latitude)) * cos(radians(p[1])) * sin(dlon / 2) ** 2
+                assert 2 * 6371000 * asin(sqrt(a)) <= 200.001
+
+        r = libafb.callsync(self.binder, "gps", "history", {"bbox" : [latitude - 0.01, longitude - 0.01, latitude + 0.01, longitude + 0.01], "end" : t})
+        assert r.args[0]["segments"][-1][-1][0] == t
+
+        # Simplified track, with its ends kept
+        full = libafb.callsync(self.binder, "gps", "history", {}).args[0]
+        simple = libafb.callsync(self.binder, "gps", "history", {"tolerance" : 1000}).args[0]
+        assert simple["matched"] >= full["matched"]
+        assert simple["count"] <= simple["matched"]
+        assert simple["segments"][0][0] == full["segments"][0][0]
+
+        r = libafb.callsync(self.binder, "gps", "history", {"latitude" : 0, "longitude" : 0, "radius" : 10})
+        assert r.args[0]["matched"] == 0 and r.args[0]["segments"] == []
+
+        for bad in [{"latitude" : 47.7, "radius" : 10}, {"latitude" : 47.7, "longitude" : -3.3, "radius" : 0},
+                    {"bbox" : [47.7, -3.4, 47.8]}, {"bbox" : [47.8, -3.4, 47.7, -3.3]},
+                    {"tolerance" : -1}, {"last" : "1h"}]:
+            with self.assertRaises(RuntimeError):
+                libafb.callsync(self.binder, "gps", "history", bad)
+
+
+    "Test export verb"
+    def test_export_success(self):
+        time.sleep(3.0) # add a sleep time to record a few fixes
+
+        points = libafb.callsync(self.binder, "gps", "history", {"last" : 2}).args[0]["segments"][0]
+        window = {"start" : points[0][0], "end" : points[-1][0]}
+
+        # Pages concatenated make the same document as a single page
+        for kind in ["gpx", "geojson"]:
+            single = libafb.callsync(self.binder, "gps", "export", dict(window, format=kind)).args[0]
+            assert single["format"] == kind and single["source"] == "history"
+            assert single["count"] == len(points)
+            assert "cursor" not in single
+
+            data, pages, request = "", 0, dict(window, format=kind, limit=3)
+            while True:
+                page = libafb.callsync(self.binder, "gps", "export", request).args[0]
+                assert page["count"] <= 3
+                data += page["data"]
+                pages += 1
+                if "cursor" not in page:
+                    break
+                request["cursor"] = page["cursor"]
+            assert data == single["data"]
+            assert pages >= len(points) // 3
+
+        features = json.loads(data)["features"]
+        assert [f["properties"]["time"] for f in features] == [p[0] for p in points]
+        assert features[-1]["geometry"]["coordinates"][:2] == [points[-1][2], points[-1][1]]
+
+        gpx = libafb.callsync(self.binder, "gps", "export", window).args[0]["data"]
+        trkpts = ElementTree.fromstring(gpx).findall(".//{http://www.topografix.com/GPX/1/1}trkpt")
+        assert len(trkpts) == len(points)
+        assert abs(float(trkpts[0].get("lat")) - points[0][1]) < 1e-6
+
+        stats = libafb.callsync(self.binder, "gps", "stats", {}).args[0]["export"]
+        assert stats["fixes"] >= 4 * len(points)
+        assert stats["fixes per second"] > 0
+
+        for bad in [{"format" : "kml"}, {"source" : "disk"}, {"source" : "record"},
+                    {"format" : None}, {"source" : None}, {"format" : 1},
+                    {"limit" : 0}, {"limit" : 100000}, {"cursor" : -1}, {"cursor" : "next"},
+                    {"start" : 10, "end" : 5}]:
+            with self.assertRaises(RuntimeError):
+                libafb.callsync(self.binder, "gps", "export", bad)
+
+
+    "Test shared memory publication"
+    def test_shm_success(self):
+        time.sleep(1.0) # add a sleep time to wait for the gpsd to start
+
+        with open("/dev/shm/rp-gps-fix", "rb") as f:
+            shm = f.read()
+        magic, version, seq, generation = struct.unpack_from("<IIII", shm, 0)
+        latitude, longitude = struct.unpack_from("<dd", shm, 48)
+
+        assert magic == 0x53475052
+        assert version == 1
+        assert seq % 2 == 0
+        assert generation > 0
+        assert -90.0 <= latitude <= 90.0 and latitude != 0.0
+        assert -180.0 <= longitude <= 180.0 and longitude != 0.0
+
+
     "Test info verb"
     def test_info_success(self):
         time.sleep(1.0) # add a sleep time to wait for the gpsd to start
@@ -192,6 +485,23 @@ class TestEventGps(AFBTestCase):
         libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10})
         libafb.evtdelete(self.binder, "gps/*")
 
+        # Lower frequencies fire on the ticks of the higher ones, with the same payload
+        received = {}
+        def evt_grid(binder, evt_name, userdata, data):
+            received.setdefault(evt_name, []).append(data["timestamp"])
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_grid})
+        for freq in (1, 10):
+            libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : freq})
+        time.sleep(3.5)
+        for freq in (1, 10):
+            libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "frequency", "value" : freq})
+        libafb.evtdelete(self.binder, "gps/*")
+        slow = [v for k, v in received.items() if k.endswith("_freq_1")]
+        fast = [v for k, v in received.items() if k.endswith("_freq_10")]
+        assert slow and fast
+        assert set(slow[0]) <= set(fast[0])
+
         ###
         #   Calculate the great circle distance in kilometers 
         #   between two points on the earth (specified in decimal degrees)
@@ -228,6 +538,61 @@ class TestEventGps(AFBTestCase):
         libafb.evtdelete(self.binder, "gps/*")
 
 
+        count = 0
+        def evt_expr(binder, evt_name, userdata, data):
+            nonlocal count
+            count += 1
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_expr})
+        r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "expression", "value" : "mode >= 2"})
+        time.sleep(3.0)
+        # edge triggered: pushed once as the fix stays valid
+        assert count == 1
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "expression", "value" : "mode >= 2"})
+        libafb.evtdelete(self.binder, "gps/*")
+
+
+        count = 0
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_freq})
+        r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10, "window" : 2})
+        stream = r.args[0]["stream"]
+        time.sleep(2.0)
+        # nothing acknowledged: only the window has been pushed
+        assert count == 2
+        r = libafb.callsync(self.binder, "gps", "ack", {"stream" : stream, "count" : 2})
+        assert r.args[0]["conflated"] > 0
+        time.sleep(0.5)
+        assert count == 4
+        r = libafb.callsync(self.binder, "gps", "stats", {})
+        assert r.args[0]["conflated"] > 0
+        for c in [2.9, "2", None, 0]:
+            with self.assertRaises(RuntimeError):
+                libafb.callsync(self.binder, "gps", "ack", {"stream" : stream, "count" : c})
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"stream" : stream})
+        libafb.evtdelete(self.binder, "gps/*")
+
+        with self.assertRaises(RuntimeError):
+            libafb.callsync(self.binder, "gps", "ack", {"stream" : 12345})
+        for s in [str(stream), None, 1.5]:
+            with self.assertRaises(RuntimeError):
+                libafb.callsync(self.binder, "gps", "unsubscribe", {"stream" : s})
+
+
+        raw = None
+        def evt_raw(binder, evt_name, userdata, data):
+            nonlocal raw
+            raw = data
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_raw})
+        r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gpsd_raw", "condition" : "class", "value" : "TPV"})
+        time.sleep(2.0)
+        assert raw is not None
+        assert raw["class"] == "TPV"
+        assert "lat" in raw
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gpsd_raw", "condition" : "class", "value" : "TPV"})
+        libafb.evtdelete(self.binder, "gps/*")
+
+
         target = 20
         speed = 0
         def evt_speed(binder, evt_name, userdata, data):
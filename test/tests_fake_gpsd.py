@@ -0,0 +1,378 @@
+from afb_test import AFBTestCase, configure_afb_binding_tests, run_afb_binding_tests
+"""
+Load and fault-injection tests, run against fake_gpsd.py instead of gpsd:
+no gpsd nor gpsfake instance is needed.
+
+To run the file 'tests_fake_gpsd.py' us the command
+python tests_fake_gpsd.py --path ../build
+Set GPS_LONG_TESTS=1 to also run the tests lasting more than a minute.
+"""
+
+import libafb
+import json
+import os
+import struct
+import tempfile
+import time
+import unittest
+from math import radians, sin, cos, asin, sqrt
+
+from fake_gpsd import FakeGpsd, load_nmea
+
+
+bindings = {"gps": f"gps-binding.so"}
+gpsd = None
+record_path = os.path.join(tempfile.mkdtemp(), "track.rpgt")
+poi_path = os.path.join(tempfile.mkdtemp(), "pois.csv")
+pois = []
+
+
+def distance(latitude1, longitude1, latitude2, longitude2):
+    "Great circle distance, in m"
+    dlat, dlon = radians(latitude2 - latitude1), radians(longitude2 - longitude1)
+    h = sin(dlat / 2) ** 2 + cos(radians(latitude1)) * cos(radians(latitude2)) * sin(dlon / 2) ** 2
+    return 2 * 6371000 * asin(sqrt(h))
+
+
+def write_pois(path, fixes):
+    "One POI every 100 fixes along the track, with a line that cannot be read"
+    with open(path, "w") as f:
+        f.write("# Along the Lorient track\nname,latitude,longitude\n\n")
+        for i, fix in enumerate(fixes[::100]):
+            pois.append(("poi%d" % i, fix["lat"], fix["lon"]))
+            f.write("poi%d,%.7f,%.7f\n" % pois[-1])
+        f.write("nowhere,91,0\n")
+
+
+def read_track(path):
+    """
+    Decode a track file: blocks of fixes, the first one in full, the next ones
+    as zigzag varints (second order deltas for time and position, first order
+    ones for altitude and speed)
+    """
+    with open(path, "rb") as f:
+        raw = f.read()
+    magic, version = struct.unpack_from("<II", raw, 0)
+    assert magic == 0x54475052 and version == 1
+
+    def varint(block, pos):
+        value, shift = 0, 0
+        while True:
+            byte = block[pos]
+            pos += 1
+            value |= (byte & 0x7f) << shift
+            shift += 7
+            if not byte & 0x80:
+                return (value >> 1) ^ -(value & 1), pos
+
+    fixes = []
+    pos = 8
+    while pos < len(raw):
+        length, count = struct.unpack_from("<HH", raw, pos)
+        block, pos = raw[pos + 4:pos + 4 + length], pos + 4 + length
+        state = [0] * 5  # time, latitude, longitude, altitude, speed
+        deltas = [0] * 3
+        at = 0
+        for i in range(count):
+            flags = block[at]
+            at += 1
+            for k in range(3):
+                value, at = varint(block, at)
+                if i == 0:
+                    state[k] = value
+                else:
+                    deltas[k] += value
+                    state[k] += deltas[k]
+            fix = [state[0] / 1e3, state[1] / 1e7, state[2] / 1e7, None, None]
+            for k, flag in ((3, 1), (4, 2)):
+                if flags & flag:
+                    value, at = varint(block, at)
+                    state[k] += value
+                    fix[k] = state[k] / 1e2
+            fixes.append(fix)
+        assert at == length
+    return fixes
+
+
+def setUpModule():
+    global gpsd
+    nmea = os.path.join(os.path.dirname(os.path.abspath(__file__)), "lorient.nmea")
+    gpsd = FakeGpsd(nmea, rate=10).start()
+    write_pois(poi_path, load_nmea(nmea))
+    os.environ["RPGPS_HOST"] = "127.0.0.1"
+    os.environ["RPGPS_SERVICE"] = str(gpsd.port)
+    os.environ["RPGPS_SHM_NAME"] = ""
+    # Sharded dispatch, the single thread one is covered by tests.py
+    os.environ["RPGPS_DISPATCH_THREADS"] = "2"
+    os.environ["RPGPS_RECORD_PATH"] = record_path
+    os.environ["RPGPS_POI_PATH"] = poi_path
+    configure_afb_binding_tests(bindings=bindings)
+
+def tearDownModule():
+    gpsd.stop()
+
+
+class TestFakeGpsd(AFBTestCase):
+
+    def stats(self):
+        return libafb.callsync(self.binder, "gps", "stats", {}).args[0]
+
+    def wait_data(self, timeout):
+        "Time taken by gps-data to answer successfully again, None if it did not"
+        start = time.monotonic()
+        while time.monotonic() - start < timeout:
+            try:
+                libafb.callsync(self.binder, "gps", "gps-data", {})
+                return time.monotonic() - start
+            except RuntimeError:
+                time.sleep(0.05)
+        return None
+
+    def setUp(self):
+        gpsd.rate = 10
+        assert self.wait_data(10.0) is not None
+
+
+    "Fixes are all decoded, events paced, at a high rate"
+    def test_throughput(self):
+        gpsd.rate = 2000
+        time.sleep(1.0)
+
+        count = 0
+        def evt_freq(binder, evt_name, userdata, data):
+            nonlocal count
+            count += 1
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_freq})
+        libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 100})
+        fixes, sent = self.stats()["fixes"], gpsd.sent
+        time.sleep(3.0)
+        fixes, sent = self.stats()["fixes"] - fixes, gpsd.sent - sent
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 100})
+        libafb.evtdelete(self.binder, "gps/*")
+
+        print("fixes = ", fixes, "/", sent, ", events = ", count)
+        assert fixes >= sent * 0.9
+        assert 240 <= count <= 330
+
+
+    "Connection closed by GPSd: reconnected right away"
+    def test_recovery_disconnect(self):
+        reconnects = self.stats()["reconnect count"]
+        start = time.monotonic()
+        gpsd.disconnect()
+        reconnect = gpsd.wait_connection(start, 5.0)
+        assert reconnect is not None
+        print("reconnected in ", reconnect - start)
+        assert reconnect - start < 2.0
+        assert self.wait_data(3.0) is not None
+        stats = self.stats()
+        assert stats["online"] == True
+        assert stats["reconnect count"] == reconnects + 1
+        assert 0.0 < stats["last reconnect time"] < 2000.0
+
+
+    "GPSd down for a while: reconnected by the backoff"
+    def test_recovery_refused(self):
+        start = time.monotonic()
+        gpsd.disconnect(down_for=2.0)
+        reconnect = gpsd.wait_connection(start, 10.0)
+        assert reconnect is not None
+        print("reconnected in ", reconnect - start)
+        # retried right away, then after 100ms, 200ms, ... 1.6s
+        assert reconnect - start < 4.0
+        assert self.wait_data(3.0) is not None
+
+
+    "GPSd silent for a few seconds: the connection is kept, data reported as stale"
+    def test_stall(self):
+        stale = []
+        def evt_freq(binder, evt_name, userdata, data):
+            stale.append(data.get("stale", False))
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_freq})
+        libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10})
+        connections = gpsd.connections
+        gpsd.stall(4.0)
+        time.sleep(3.5)
+        assert self.stats()["online"] == True
+        # still pushed while stale, at 1 Hz
+        assert True in stale
+        assert stale.count(True) <= 3
+        stale.clear()
+        fixes = self.stats()["fixes"]
+        time.sleep(1.5)
+        assert self.stats()["fixes"] > fixes
+        assert gpsd.connections == connections
+        assert stale[-1] == False
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10})
+        libafb.evtdelete(self.binder, "gps/*")
+
+
+    "Malformed lines: the binding recovers"
+    def test_malformed(self):
+        fixes = self.stats()["fixes"]
+        gpsd.malformed(5)
+        time.sleep(1.0)
+        assert self.wait_data(5.0) is not None
+        time.sleep(1.0)
+        assert self.stats()["fixes"] > fixes
+
+
+    "Reports split in small chunks"
+    def test_slow_reads(self):
+        gpsd.rate = 100
+        gpsd.slow_reads(2.0, chunk=7)
+        fixes = self.stats()["fixes"]
+        time.sleep(2.0)
+        assert self.stats()["fixes"] - fixes >= 100
+        assert self.wait_data(1.0) is not None
+
+
+    "Fixes recorded to the track file, one block at a time"
+    def test_record(self):
+        gpsd.rate = 500
+        time.sleep(1.0)
+        gpsd.rate = 10
+        record = self.stats()["record"]
+        assert record["enabled"] == True
+        assert record["errors"] == 0
+        assert record["fixes"] >= 256
+
+        fixes = read_track(record_path)
+        assert len(fixes) == record["fixes"]
+        assert all(a[0] <= b[0] for a, b in zip(fixes, fixes[1:]))
+        # Lorient, France
+        assert all(47.0 < f[1] < 48.5 and -4.0 < f[2] < -3.0 for f in fixes)
+        assert all(f[4] is not None and f[4] >= 0.0 for f in fixes)
+        print("bytes per fix = ", os.path.getsize(record_path) / len(fixes))
+        assert os.path.getsize(record_path) == record["bytes"]
+        assert record["bytes"] < 16 * len(fixes)
+
+
+    "Adaptive events: one per distance traveled, or per max interval"
+    def test_adaptive(self):
+        received = []
+        def evt_adaptive(binder, evt_name, userdata, data):
+            received.append((data["timestamp"], data["latitude"], data["longitude"]))
+
+        condition = {"data" : "gps_data", "condition" : "adaptive", "value" : 20, "min_interval" : 500, "max_interval" : 3000}
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_adaptive})
+        fixes = self.stats()["fixes"]
+        libafb.callsync(self.binder, "gps", "subscribe", condition)
+        time.sleep(6.0)
+        libafb.callsync(self.binder, "gps", "unsubscribe", condition)
+        libafb.evtdelete(self.binder, "gps/*")
+        fixes = self.stats()["fixes"] - fixes
+
+        print("adaptive events = ", len(received), "/", fixes, "fixes")
+        assert len(received) >= 2
+        assert len(received) < fixes / 2
+        for a, b in zip(received, received[1:]):
+            dt = b[0] - a[0]
+            assert dt >= 0.5 - 1e-3
+            assert distance(a[1], a[2], b[1], b[2]) >= 20 * 0.999 or dt >= 3.0 - 1e-3
+
+
+    "Export of the track file, page by page"
+    def test_export_record(self):
+        gpsd.rate = 500
+        time.sleep(1.0)
+        gpsd.rate = 10
+        fixes = read_track(record_path)
+        assert len(fixes) >= 256
+        window = {"start" : fixes[0][0], "end" : fixes[-1][0]}
+
+        data, pages, request = "", 0, dict(window, format="geojson", source="record", limit=100)
+        while True:
+            page = libafb.callsync(self.binder, "gps", "export", request).args[0]
+            assert page["count"] <= 100
+            data += page["data"]
+            pages += 1
+            if "cursor" not in page:
+                break
+            request["cursor"] = page["cursor"]
+
+        features = json.loads(data)["features"]
+        assert len(features) == len(fixes)
+        assert pages == (len(fixes) + 99) // 100
+        assert [f["properties"]["time"] for f in features] == [f[0] for f in fixes]
+        assert all(f["properties"]["speed"] >= 0.0 for f in features)
+
+        export = self.stats()["export"]
+        print("export fixes per second = ", export["fixes per second"])
+        assert export["fixes"] >= len(fixes)
+
+
+    "Nearest POIs of a position, and events when the nearest one changes"
+    def test_nearest(self):
+        poi = self.stats()["poi"]
+        assert poi["enabled"] == True
+        assert poi["count"] == len(pois)
+        assert poi["skipped"] == 1
+
+        # Same order as a linear search
+        latitude, longitude = 47.745, -3.366
+        r = libafb.callsync(self.binder, "gps", "nearest", {"latitude" : latitude, "longitude" : longitude, "count" : 5})
+        nearest = r.args[0]["pois"]
+        expected = sorted(pois, key=lambda p: distance(latitude, longitude, p[1], p[2]))[:5]
+        assert [p["name"] for p in nearest] == [p[0] for p in expected]
+        for p, e in zip(nearest, expected):
+            assert abs(p["distance"] - distance(latitude, longitude, e[1], e[2])) < 0.01
+
+        # Around the latest fix by default
+        r = libafb.callsync(self.binder, "gps", "nearest", {"count" : 100, "radius" : 1000})
+        assert all(p["distance"] <= 1000 for p in r.args[0]["pois"])
+        assert all(a["distance"] <= b["distance"] for a, b in zip(r.args[0]["pois"], r.args[0]["pois"][1:]))
+
+        received = []
+        def evt_nearest(binder, evt_name, userdata, data):
+            received.append(data)
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/poi_nearest_300", "callback": evt_nearest})
+        libafb.callsync(self.binder, "gps", "nearest", {"action" : "subscribe", "radius" : 300})
+        gpsd.rate = 100
+        time.sleep(3.0)
+        reloaded = libafb.callsync(self.binder, "gps", "nearest", {"action" : "reload"}).args[0]
+        time.sleep(1.0)
+        gpsd.rate = 10
+        libafb.callsync(self.binder, "gps", "nearest", {"action" : "unsubscribe", "radius" : 300})
+        libafb.evtdelete(self.binder, "gps/poi_nearest_300")
+
+        print("nearest events = ", len(received))
+        assert reloaded["loads"] == poi["loads"] + 1 and reloaded["watches"] == 1
+        assert len(received) >= 2
+        assert all(d["radius"] == 300 for d in received)
+        assert all(d["nearest"] is None or d["nearest"]["distance"] <= 300 for d in received)
+        assert self.stats()["poi"]["watches"] == 0
+
+        # A bounded number of radiuses, each dropped with its last subscriber
+        for radius in range(1, 17):
+            libafb.callsync(self.binder, "gps", "nearest", {"action" : "subscribe", "radius" : radius})
+        with self.assertRaises(RuntimeError):
+            libafb.callsync(self.binder, "gps", "nearest", {"action" : "subscribe", "radius" : 17})
+        assert self.stats()["poi"]["watches"] == 16
+        for radius in range(1, 17):
+            libafb.callsync(self.binder, "gps", "nearest", {"action" : "unsubscribe", "radius" : radius})
+        assert self.stats()["poi"]["watches"] == 0
+
+        for bad in [{"latitude" : 47.7}, {"latitude" : 95, "longitude" : 0}, {"count" : 0},
+                    {"count" : 1000}, {"radius" : -1}, {"action" : "subscribe"},
+                    {"action" : "watch", "radius" : 300}, {"action" : None},
+                    {"action" : 1, "radius" : 300}]:
+            with self.assertRaises(RuntimeError):
+                libafb.callsync(self.binder, "gps", "nearest", bad)
+
+
+    "GPSd silent for more than a minute: the binding gives up and reconnects"
+    @unittest.skipUnless(os.environ.get("GPS_LONG_TESTS"), "lasts more than a minute")
+    def test_stall_give_up(self):
+        start = time.monotonic()
+        gpsd.stall(75.0)
+        reconnect = gpsd.wait_connection(start, 75.0)
+        assert reconnect is not None
+        assert 60.0 <= reconnect - start < 70.0
+
+
+if __name__ == "__main__":
+    run_afb_binding_tests(bindings)
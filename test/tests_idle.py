@@ -0,0 +1,87 @@
+from afb_test import AFBTestCase, configure_afb_binding_tests, run_afb_binding_tests
+"""
+Idle mode tests, in a binder of their own with RPGPS_IDLE_TIMEOUT set and
+no permanent listener (shared memory segment, track recording), run against
+fake_gpsd.py.
+
+To run the file 'tests_idle.py' use the command
+python tests_idle.py --path ../build
+"""
+
+import libafb
+import os
+import time
+
+from fake_gpsd import FakeGpsd
+
+
+bindings = {"gps": f"gps-binding.so"}
+gpsd = None
+IDLE_TIMEOUT = 2
+
+
+def setUpModule():
+    global gpsd
+    nmea = os.path.join(os.path.dirname(os.path.abspath(__file__)), "lorient.nmea")
+    gpsd = FakeGpsd(nmea, rate=10).start()
+    os.environ["RPGPS_HOST"] = "127.0.0.1"
+    os.environ["RPGPS_SERVICE"] = str(gpsd.port)
+    os.environ["RPGPS_IDLE_TIMEOUT"] = str(IDLE_TIMEOUT)
+    # Unset, the shared memory segment is not published in idle mode
+    os.environ.pop("RPGPS_SHM_NAME", None)
+    configure_afb_binding_tests(bindings=bindings)
+
+def tearDownModule():
+    gpsd.stop()
+
+
+class TestIdle(AFBTestCase):
+
+    def stats(self):
+        return libafb.callsync(self.binder, "gps", "stats", {}).args[0]
+
+    def wait_streaming(self, streaming, timeout):
+        "Wait for the streaming state, stats not being a listener"
+        start = time.monotonic()
+        while time.monotonic() - start < timeout:
+            stats = self.stats()
+            if stats["streaming"] == streaming:
+                return stats
+            time.sleep(0.1)
+        return None
+
+
+    "Streaming disabled without listener, resumed by a subscription"
+    def test_idle_wake(self):
+        stats = self.wait_streaming(False, IDLE_TIMEOUT + 5)
+        assert stats is not None
+        assert stats["idle timeout"] == IDLE_TIMEOUT
+        assert stats["idle count"] >= 1
+        assert gpsd.watch_disables >= 1
+        wakes = stats["wake count"]
+
+        count = 0
+        def evt_freq(binder, evt_name, userdata, data):
+            nonlocal count
+            count += 1
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_freq})
+        libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10})
+        time.sleep(1.0)
+        stats = self.stats()
+        assert stats["streaming"] == True
+        assert stats["wake count"] == wakes + 1
+        assert stats["last wake latency"] > 0
+        assert count > 0
+
+        # Idle again once the last subscriber has left
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10})
+        libafb.evtdelete(self.binder, "gps/*")
+        disables = gpsd.watch_disables
+        stats = self.wait_streaming(False, IDLE_TIMEOUT + 5)
+        assert stats is not None
+        assert gpsd.watch_disables == disables + 1
+
+
+if __name__ == "__main__":
+    run_afb_binding_tests(bindings)
@@ -0,0 +1,129 @@
+from afb_test import AFBTestCase, configure_afb_binding_tests, run_afb_binding_tests
+"""
+Deterministic dispatch tests: the NMEA log is replayed on a simulated clock,
+as fast as the binding goes, so the pushes of each subscription are exact.
+No gpsd instance is needed.
+
+To run the file 'tests_replay.py' use the command
+python tests_replay.py --path ../build
+"""
+
+import libafb
+import os
+import time
+from math import floor, radians, sin, cos, asin, sqrt
+
+
+bindings = {"gps": f"gps-binding.so"}
+
+
+def setUpModule():
+    os.environ["RPGPS_REPLAY_PATH"] = os.path.join(os.path.dirname(os.path.abspath(__file__)), "lorient.nmea")
+    os.environ["RPGPS_SHM_NAME"] = ""
+    os.environ["RPGPS_DISPATCH_THREADS"] = "2"
+    configure_afb_binding_tests(bindings=bindings)
+
+
+def distance(a, b):
+    "Great circle distance between two (timestamp, latitude, longitude), in m"
+    dlat, dlon = radians(b[1] - a[1]), radians(b[2] - a[2])
+    h = sin(dlat / 2) ** 2 + cos(radians(a[1])) * cos(radians(b[1])) * sin(dlon / 2) ** 2
+    return 2 * 6371000 * asin(sqrt(h))
+
+
+class TestReplay(AFBTestCase):
+
+    "Lorient log replayed: exact push counts and payloads of each subscription"
+    def test_replay(self):
+        conditions = {"1hz" : {"data" : "gps_data", "condition" : "frequency", "value" : 1},
+                      "10hz" : {"data" : "gps_data", "condition" : "frequency", "value" : 10},
+                      "100m" : {"data" : "gps_data", "condition" : "movement", "value" : 100},
+                      "90kmh" : {"data" : "gps_data", "condition" : "max_speed", "value" : 90}}
+        names = {"gps/gps_data_freq_1" : "1hz", "gps/gps_data_freq_10" : "10hz",
+                 "gps/gps_data_movement_100" : "100m", "gps/gps_data_speed_90" : "90kmh"}
+        received = {key : [] for key in list(conditions) + ["composite"]}
+        def evt_replay(binder, evt_name, userdata, data):
+            fix = (data["timestamp"], data["latitude"], data["longitude"])
+            if "triggered" in data:
+                received["composite"].append((fix, data["triggered"]))
+            else:
+                received[names[evt_name]].append(fix)
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_replay})
+        for condition in conditions.values():
+            libafb.callsync(self.binder, "gps", "subscribe", condition)
+
+        # The same conditions, but 1 Hz, in a single stream
+        composite = ["1hz", "100m", "90kmh"]
+        r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "composite",
+                                                              "value" : [conditions[key] for key in composite]})
+        assert r.args[0]["event"].startswith("gps_data_composite_s")
+
+        # Nothing is replayed until started
+        state = libafb.callsync(self.binder, "gps", "replay", {}).args[0]
+        assert state["enabled"] == True and state["started"] == False and state["fixes"] == 0
+
+        libafb.callsync(self.binder, "gps", "replay", {"action" : "start"})
+        with self.assertRaises(RuntimeError):
+            libafb.callsync(self.binder, "gps", "replay", {"action" : "start"})
+        for bad in [{"action" : "stop"}, {"action" : None}, {"action" : 1}]:
+            with self.assertRaises(RuntimeError):
+                libafb.callsync(self.binder, "gps", "replay", bad)
+
+        start = time.monotonic()
+        while not state["done"] and time.monotonic() - start < 60:
+            time.sleep(0.1)
+            state = libafb.callsync(self.binder, "gps", "replay", {}).args[0]
+        assert state["done"] == True and state["failed"] == False
+        print("replay speedup = ", state["speedup"])
+
+        # Events still on their way
+        while len(received["10hz"]) < state["fixes"] and time.monotonic() - start < 60:
+            time.sleep(0.1)
+        libafb.evtdelete(self.binder, "gps/*")
+
+        # One 10 Hz push per fix, each fix being in its own period
+        fixes = received["10hz"]
+        assert state["fixes"] == 5034 and state["skipped"] == 0
+        assert len(fixes) == state["fixes"]
+        assert fixes[0][0] == state["first"] and fixes[-1][0] == state["last"]
+
+        # The payload of the last fix reads back as its json-c encoding, made by enu-origin
+        data = libafb.callsync(self.binder, "gps", "gps-data", {}).args[0]
+        origin = libafb.callsync(self.binder, "gps", "enu-origin", {"current" : True}).args[0]
+        assert data["timestamp"] == state["last"]
+        assert (data["latitude"], data["longitude"]) == (origin["latitude"], origin["longitude"])
+        assert data.get("altitude", 0.0) == origin["altitude"]
+
+        # A 1 Hz push on the first fix, then at each second with the latest fix before it
+        first, last = state["first"], state["last"]
+        expected = [fixes[0]] + [[f for f in fixes if f[0] < s][-1]
+                                 for s in range(floor(first) + 1, floor(last) + 1)]
+        assert received["1hz"] == expected
+
+        # A movement push on each fix farther than 100 m from the previous push
+        pushed = set(received["100m"])
+        reference = fixes[0]
+        assert reference in pushed
+        for fix in fixes[1:]:
+            d = distance(reference, fix)
+            if fix in pushed:
+                assert d > 100 - 0.01
+                reference = fix
+            else:
+                assert d < 100 + 0.01
+        print("movement pushes = ", len(received["100m"]))
+
+        # One composite push per round having any of its conditions due, telling which
+        for i, key in enumerate(composite):
+            assert [fix for fix, triggered in received["composite"] if i in triggered] == received[key]
+        separate = sum(len(received[key]) for key in composite)
+        assert 0 < len(received["composite"]) < separate
+        assert received["composite"][0] == (fixes[0], [0, 1, 2])
+        stats = libafb.callsync(self.binder, "gps", "stats", {}).args[0]
+        assert stats["composite pushes"] == len(received["composite"])
+        assert stats["composite triggered"] == separate
+
+
+if __name__ == "__main__":
+    run_afb_binding_tests(bindings)
@@ -0,0 +1,49 @@
+from afb_test import AFBTestCase, configure_afb_binding_tests, run_afb_binding_tests
+"""
+Real-time mode tests, in a binder of their own so that the pools
+are only enabled here. Needs the same gpsfake instance as 'tests.py'.
+
+To run the file 'tests_rt.py' use the command
+python tests_rt.py --path ../build
+"""
+
+import libafb
+import os
+import time
+
+
+bindings = {"gps": f"gps-binding.so"}
+
+
+def setUpModule():
+    os.environ["RPGPS_RT"] = "1"
+    configure_afb_binding_tests(bindings=bindings)
+
+
+class TestRealTime(AFBTestCase):
+
+    "Pools in use: no pool miss once the payloads are warmed up"
+    def test_pool_misses(self):
+        time.sleep(1.0) # add a sleep time to wait for the gpsd to start
+
+        count = 0
+        def evt_freq(binder, evt_name, userdata, data):
+            nonlocal count
+            count += 1
+
+        e = libafb.evthandler(self.binder, {"uid": "gps", "pattern": "gps/*", "callback": evt_freq})
+        r = libafb.callsync(self.binder, "gps", "subscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10})
+        time.sleep(1.0)
+        r = libafb.callsync(self.binder, "gps", "stats", {})
+        misses = r.args[0]["rt"]["pool misses"]
+        assert r.args[0]["rt"]["enabled"] == True
+        time.sleep(3.0)
+        r = libafb.callsync(self.binder, "gps", "stats", {})
+        assert count >= 30
+        assert r.args[0]["rt"]["pool misses"] == misses
+        libafb.callsync(self.binder, "gps", "unsubscribe", {"data" : "gps_data", "condition" : "frequency", "value" : 10})
+        libafb.evtdelete(self.binder, "gps/*")
+
+
+if __name__ == "__main__":
+    run_afb_binding_tests(bindings)